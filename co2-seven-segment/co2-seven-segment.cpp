@@ -16,13 +16,14 @@
 
 #include <tusb.h>
 
+#include <common/history.h>
+
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <functional>
 #include <iterator>
-#include <vector>
 
 class SevenSegmentDisplay {
   // digits 0 - F
@@ -188,6 +189,20 @@ void SevenSegmentDisplay::error(int hex) {
   update();
 }
 
+// Every CO2 reading is kept in `history`, for as long as there's room.
+struct [[gnu::packed]] HistoryRecord {
+  std::uint32_t uptime_seconds;
+  std::uint16_t co2_ppm;
+};
+
+static_assert(sizeof(HistoryRecord) == 6);
+
+// 64 KiB of history is about 15 hours of readings at the SCD4x's five second
+// interval. Without WiFi, this program uses little of the heap otherwise.
+constexpr std::size_t history_bytes = 64 * 1024;
+
+common::History<HistoryRecord, common::history_capacity<HistoryRecord>(history_bytes)> history;
+
 picoro::Coroutine<bool> data_ready(const picoro::sensirion::SCD4x &sensor, const std::function<void(int hex)>& show_error) {
   bool result;
   int rc = co_await sensor.get_data_ready_flag(&result);
@@ -264,6 +279,9 @@ picoro::Coroutine<void> monitor_scd4x(
     } else {
       std::printf("CO2: %hu ppm\ttemperature: %.1f C\thumidity: %.1f%%\n", co2_ppm, temperature_millicelsius / 1000.0f, relative_humidity_millipercent / 1000.0f);
       show_number(co2_ppm);
+      history.push(HistoryRecord{
+        .uptime_seconds = std::uint32_t(to_us_since_boot(get_absolute_time()) / 1'000'000),
+        .co2_ppm = co2_ppm});
     }
   }
 }
@@ -287,16 +305,6 @@ picoro::Coroutine<void> boing_boing(
   }
 }
 
-/* TODO
-struct Measurements {
-  absolute_time_t first_measurement;
-  std::vector<std::uint16_t> co2_ppm;
-} measurements = {
-  .first_measurement = nil_time,
-  .co2_ppm = {}
-};
-*/
-
 struct Button {
   async_when_pending_worker worker;
   async_context_t *ctx;
@@ -0,0 +1,156 @@
+#pragma once
+
+// `AdmissionControl` limits how many connections a server handles at once,
+// and keeps new connections from using up the heap. Each connection costs a
+// handler coroutine frame plus lwIP's pcb and pbufs, so a burst of clients
+// would otherwise allocate until something fails (or the watchdog resets the
+// board).
+//
+// The server consults it after each `accept`:
+//
+//     auto [conn, err] = co_await listener.accept();
+//     ...
+//     switch (admission().decide(get_free_heap())) {
+//     case common::AdmissionControl::ADMIT:
+//         handle_client(std::move(conn), admission().admit()).detach();
+//         break;
+//     case common::AdmissionControl::REFUSE:
+//         common::refuse(std::move(conn), admission().refuse()).detach();
+//         break;
+//     case common::AdmissionControl::DROP:
+//         admission().drop();
+//         break;  // `conn` is closed when it goes out of scope.
+//     }
+//
+// The `Ticket` returned by `admit` or `refuse` is kept in the handler's frame,
+// and counts the connection as live until the handler finishes. A refused
+// connection gets `overloaded_response`, which is a constant, from
+// `common::refuse`, and then is closed. A dropped connection is closed without a response, which is what
+// happens when even a refusal would cost too much.
+
+#include <picoro/coroutine.h>
+#include <picoro/tcp.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace common {
+
+// A complete response for a refused connection.
+constexpr std::string_view overloaded_response =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 5\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+class AdmissionControl {
+ public:
+    struct Limits {
+        // Handle at most this many connections at once.
+        std::size_t max_connections;
+        // Refuse at most this many connections at once. Past that, drop them.
+        std::size_t max_refusing;
+        // Admit a connection only if this much heap would remain free after
+        // it, for the rest of the program.
+        std::uint32_t reserve_bytes;
+        // A connection is expected to use this much heap: its handler's
+        // coroutine frame, and lwIP's pcb and buffers.
+        std::uint32_t connection_bytes;
+    };
+
+    enum Decision {
+        ADMIT,
+        REFUSE,
+        DROP
+    };
+
+    class Ticket;
+
+ private:
+    Limits limits;
+    std::size_t live = 0;
+    std::size_t refusing = 0;
+    unsigned admitted_total = 0;
+    unsigned refused_total = 0;
+    unsigned dropped_total = 0;
+
+ public:
+    explicit AdmissionControl(const Limits& limits)
+    : limits(limits) {}
+
+    AdmissionControl(const AdmissionControl&) = delete;
+
+    // Return what to do with a new connection, given the specified amount of
+    // `free_heap`.
+    Decision decide(std::uint32_t free_heap) const {
+        if (live < limits.max_connections && free_heap >= limits.reserve_bytes + limits.connection_bytes) {
+            return ADMIT;
+        }
+        if (refusing < limits.max_refusing && free_heap >= limits.reserve_bytes) {
+            return REFUSE;
+        }
+        return DROP;
+    }
+
+    Ticket admit();
+    Ticket refuse();
+    void drop() { ++dropped_total; }
+
+    // the number of connections being handled
+    std::size_t connections() const { return live; }
+    // the number of connections being refused
+    std::size_t refusals() const { return refusing; }
+
+    unsigned admitted() const { return admitted_total; }
+    unsigned refused() const { return refused_total; }
+    unsigned dropped() const { return dropped_total; }
+};
+
+// `Ticket` counts a connection as live (or as being refused) for as long as
+// the ticket exists.
+class AdmissionControl::Ticket {
+    std::size_t *counter;
+
+ public:
+    explicit Ticket(std::size_t& counter)
+    : counter(&counter) {
+        ++counter;
+    }
+
+    Ticket(Ticket&& other)
+    : counter(std::exchange(other.counter, nullptr)) {}
+
+    Ticket(const Ticket&) = delete;
+    Ticket& operator=(const Ticket&) = delete;
+
+    ~Ticket() {
+        if (counter) {
+            --*counter;
+        }
+    }
+};
+
+inline
+AdmissionControl::Ticket AdmissionControl::admit() {
+    ++admitted_total;
+    return Ticket(live);
+}
+
+inline
+AdmissionControl::Ticket AdmissionControl::refuse() {
+    ++refused_total;
+    return Ticket(refusing);
+}
+
+// Send `overloaded_response` to the client, and then close the connection.
+// The specified `ticket`, from `AdmissionControl::refuse`, counts this
+// connection as being refused until then.
+inline picoro::Coroutine<void> refuse(picoro::Connection conn, AdmissionControl::Ticket ticket) {
+    (void) ticket;
+    co_await conn.send(overloaded_response);
+}
+
+} // namespace common
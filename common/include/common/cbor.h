@@ -0,0 +1,146 @@
+#pragma once
+
+// This component encodes CBOR (RFC 8949) data items, for clients that would
+// rather not parse JSON. `CborWriter` writes integers, text strings, and the
+// heads of arrays and maps directly into a buffer, without `printf` and
+// without floating point:
+//
+//     constexpr std::size_t max_length =
+//         common::cbor_head_length(2) +
+//         common::cbor_text_length("co2") + common::cbor_max_integer_length +
+//         common::cbor_text_length("seq") + common::cbor_max_integer_length;
+//
+//     std::array<char, max_length> buffer;
+//     common::CborWriter cbor(buffer.data());
+//     cbor.map(2)
+//         .text("co2").integer(co2_ppm)
+//         .text("seq").integer(sequence_number);
+//     const int length = cbor.end() - buffer.data();
+//
+// The encoding is deterministic (RFC 8949 section 4.2): each head is as short
+// as possible, and lengths are always definite. Map keys must be written in
+// the deterministic order, which `cbor_keys_are_deterministic` checks at
+// compile time:
+//
+//     constexpr std::string_view keys[] = {"co2", "seq"};
+//     static_assert(common::cbor_keys_are_deterministic(keys));
+//
+// Integers are at most 32 bits, so that the RP2040 never does 64-bit
+// arithmetic here.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+namespace common {
+
+enum class CborMajorType : std::uint8_t {
+    UNSIGNED_INTEGER = 0,
+    NEGATIVE_INTEGER = 1,
+    BYTE_STRING = 2,
+    TEXT_STRING = 3,
+    ARRAY = 4,
+    MAP = 5
+};
+
+// Return the length of the head of a data item whose argument (its value, or
+// its length or count) is the specified `argument`.
+constexpr std::size_t cbor_head_length(std::uint32_t argument) {
+    return argument < 24 ? 1 : argument <= 0xFF ? 2 : argument <= 0xFFFF ? 3 : 5;
+}
+
+// the maximum length of an integer written by `CborWriter`
+constexpr std::size_t cbor_max_integer_length = cbor_head_length(0xFFFFFFFF);
+
+// Return the length of the specified `text` as a CBOR text string.
+constexpr std::size_t cbor_text_length(std::string_view text) {
+    return cbor_head_length(text.size()) + text.size();
+}
+
+// Return whether the specified map `keys`, as text strings, are in the
+// deterministic order: shorter keys first, and keys of the same length in
+// bytewise order.
+constexpr bool cbor_keys_are_deterministic(std::span<const std::string_view> keys) {
+    for (std::size_t i = 1; i < keys.size(); ++i) {
+        const std::string_view before = keys[i - 1];
+        const std::string_view after = keys[i];
+        if (before.size() > after.size() || (before.size() == after.size() && !(before < after))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class CborWriter {
+    char *output;
+
+    CborWriter& head(CborMajorType type, std::uint32_t argument);
+
+ public:
+    // Write to the specified `output`, which must have room for everything
+    // written.
+    explicit CborWriter(char *output)
+    : output(output) {}
+
+    CborWriter& unsigned_integer(std::uint32_t value) {
+        return head(CborMajorType::UNSIGNED_INTEGER, value);
+    }
+
+    CborWriter& integer(std::int32_t value) {
+        if (value < 0) {
+            // -1 - value, without overflow
+            return head(CborMajorType::NEGATIVE_INTEGER, ~std::uint32_t(value));
+        }
+        return head(CborMajorType::UNSIGNED_INTEGER, std::uint32_t(value));
+    }
+
+    CborWriter& text(std::string_view value) {
+        head(CborMajorType::TEXT_STRING, value.size());
+        std::memcpy(output, value.data(), value.size());
+        output += value.size();
+        return *this;
+    }
+
+    // Begin an array of the specified `count` data items, which are written
+    // next.
+    CborWriter& array(std::uint32_t count) {
+        return head(CborMajorType::ARRAY, count);
+    }
+
+    // Begin a map of the specified `count` key/value pairs, whose keys and
+    // values are written next, alternately.
+    CborWriter& map(std::uint32_t count) {
+        return head(CborMajorType::MAP, count);
+    }
+
+    // Return a pointer to the character after the last one written.
+    char *end() const { return output; }
+};
+
+inline
+CborWriter& CborWriter::head(CborMajorType type, std::uint32_t argument) {
+    const std::uint8_t major = std::uint8_t(type) << 5;
+    int size;
+    if (argument < 24) {
+        *output++ = char(major | argument);
+        return *this;
+    } else if (argument <= 0xFF) {
+        *output++ = char(major | 24);
+        size = 1;
+    } else if (argument <= 0xFFFF) {
+        *output++ = char(major | 25);
+        size = 2;
+    } else {
+        *output++ = char(major | 26);
+        size = 4;
+    }
+    // big-endian
+    for (int i = size - 1; i >= 0; --i) {
+        *output++ = char(argument >> (8 * i));
+    }
+    return *this;
+}
+
+} // namespace common
@@ -0,0 +1,341 @@
+#pragma once
+
+// `CompressedHistory` keeps a history of samples, like `History` (see
+// <common/history.h>), but compressed, so that the same SRAM holds days of
+// samples rather than hours. Each sample is a fixed number of integer
+// channels, such as a timestamp and some readings, and each channel is coded
+// as the difference from the previous sample, in the style of Facebook's
+// Gorilla time-series database:
+//
+//     using Compressed = common::CompressedHistory<256, 192,
+//         common::DeltaCoding::DELTA_OF_DELTA,  // uptime seconds
+//         common::DeltaCoding::DELTA>;          // CO2 ppm
+//
+//     Compressed history;
+//     history.push({uptime_seconds, co2_ppm});
+//     ...
+//     Compressed::Sample sample;
+//     for (auto cursor = history.cursor(); cursor.next(sample);) {
+//         ...
+//     }
+//
+// `DELTA` codes each value's change since the previous sample, which is
+// usually zero or small for slowly changing readings. `DELTA_OF_DELTA` codes
+// the change in that change, which is usually zero for timestamps and
+// sequence numbers taken at a regular interval. Either way, the difference is
+// zig-zag coded (0, -1, 1, -2, 2, ... become 0, 1, 2, 3, 4, ...) and then
+// written with a variable-length prefix code, so that zero takes one bit.
+//
+// Samples are written to fixed-size blocks. The first sample in a block is
+// written in full, so that each block can be decoded by itself, and once a
+// block is full, the next sample starts a new block, replacing the oldest
+// block if the history is full. Samples are never decompressed into RAM as a
+// whole: a `Cursor` decodes one sample at a time, and can be kept across
+// pushes, such as in a coroutine that sends the history a piece at a time.
+// If the block that a cursor is reading is replaced, the cursor skips ahead
+// to the oldest block kept.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace common {
+
+enum class DeltaCoding {
+    DELTA,
+    DELTA_OF_DELTA
+};
+
+// `DeltaCode` is the prefix code for one kind of difference. A zig-zag coded
+// difference less than `2^widths[i]` is written as `i` one bits, a zero bit,
+// and then `widths[i]` bits, except that the last width, 32, has no zero bit.
+// The first width is zero, so that a difference of zero takes one bit.
+struct DeltaCode {
+    std::array<int, 5> widths;
+};
+
+// Values that change slowly change by a little or not at all.
+inline constexpr DeltaCode delta_code = {{0, 3, 7, 12, 32}};
+// Gorilla's timestamp code: differences of differences are usually zero, and
+// otherwise are jitter.
+inline constexpr DeltaCode delta_of_delta_code = {{0, 7, 9, 12, 32}};
+
+// Return the specified `value` zig-zag coded.
+constexpr std::uint32_t zigzag_encode(std::int32_t value) {
+    return (std::uint32_t(value) << 1) ^ std::uint32_t(value >> 31);
+}
+
+constexpr std::int32_t zigzag_decode(std::uint32_t value) {
+    return std::int32_t((value >> 1) ^ (0u - (value & 1)));
+}
+
+// `CompressedBlock` holds the bits of some samples.
+template <std::size_t size_bytes>
+struct CompressedBlock {
+    static_assert(size_bytes * 8 <= UINT16_MAX);
+
+    std::array<std::uint8_t, size_bytes> bytes;
+    std::uint16_t bit_count = 0;
+    std::uint16_t sample_count = 0;
+
+    void clear() {
+        bit_count = 0;
+        sample_count = 0;
+    }
+
+    // Append the specified low `width` bits of the specified `value`, most
+    // significant first. Return false if they don't fit.
+    bool write(std::uint32_t value, int width);
+
+    // Return the `width` bits at the specified bit `position`, and advance
+    // `position` past them.
+    std::uint32_t read(std::size_t& position, int width) const;
+};
+
+template <std::size_t size_bytes>
+bool CompressedBlock<size_bytes>::write(std::uint32_t value, int width) {
+    if (bit_count + std::size_t(width) > size_bytes * 8) {
+        return false;
+    }
+    while (width) {
+        const int free_bits = 8 - bit_count % 8;
+        const int count = width < free_bits ? width : free_bits;
+        const std::uint32_t chunk = (value >> (width - count)) & ((1u << count) - 1);
+        std::uint8_t& byte = bytes[bit_count / 8];
+        // Clear what's left of the byte, which may hold bits from a sample
+        // that didn't fit.
+        byte &= std::uint8_t(0xFF00 >> (8 - free_bits));
+        byte |= std::uint8_t(chunk << (free_bits - count));
+        bit_count += count;
+        width -= count;
+    }
+    return true;
+}
+
+template <std::size_t size_bytes>
+std::uint32_t CompressedBlock<size_bytes>::read(std::size_t& position, int width) const {
+    std::uint32_t value = 0;
+    while (width) {
+        const int available = 8 - position % 8;
+        const int count = width < available ? width : available;
+        const std::uint32_t byte = bytes[position / 8];
+        value = (value << count) | ((byte >> (available - count)) & ((1u << count) - 1));
+        position += count;
+        width -= count;
+    }
+    return value;
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+class CompressedHistory {
+    static constexpr std::size_t channel_count = sizeof...(codings);
+    static constexpr std::array<DeltaCoding, channel_count> channel_codings = {codings...};
+
+    static_assert(channel_count > 0);
+    static_assert(block_count > 1);
+    // A block must hold at least one sample, written in full.
+    static_assert(block_bytes * 8 >= 32 * channel_count);
+
+ public:
+    using Sample = std::array<std::int32_t, channel_count>;
+    using Block = CompressedBlock<block_bytes>;
+
+    class Cursor;
+
+ private:
+    // the state of encoding or decoding a block: the previous sample, and
+    // its difference from the one before it
+    struct State {
+        Sample previous{};
+        Sample previous_delta{};
+    };
+
+    std::array<Block, block_count> blocks;
+    // the number of blocks ever started; the newest is `blocks_started - 1`
+    std::uint32_t blocks_started = 0;
+    std::uint32_t pushed = 0;
+    State encoder;
+
+    static const DeltaCode& code(std::size_t channel) {
+        return channel_codings[channel] == DeltaCoding::DELTA ? delta_code : delta_of_delta_code;
+    }
+
+    // Append the specified `sample` to the specified `block`, whose encoding
+    // state is the specified `state`. Return false, leaving the block and
+    // `state` as they were, if the sample doesn't fit.
+    static bool encode(Block& block, State& state, const Sample& sample);
+
+    // Read the next sample in the specified `block`, at the specified bit
+    // `position`, into the specified `state`.
+    static void decode(const Block& block, std::size_t& position, std::uint16_t index, State& state);
+
+    const Block& block(std::uint32_t number) const { return blocks[number % block_count]; }
+
+ public:
+    CompressedHistory() = default;
+    CompressedHistory(const CompressedHistory&) = delete;
+
+    void push(const Sample& sample);
+
+    // the number of samples ever pushed
+    std::uint32_t total() const { return pushed; }
+
+    // the number of samples kept
+    std::size_t size() const;
+
+    // the number of bits used by the samples kept
+    std::size_t bits() const;
+
+    // the number of the oldest block kept, and one past the newest
+    std::uint32_t first_block() const { return blocks_started > block_count ? blocks_started - block_count : 0; }
+    std::uint32_t end_block() const { return blocks_started; }
+
+    // Return a cursor at the oldest sample kept.
+    Cursor cursor() const;
+};
+
+// `Cursor` decodes the samples in a `CompressedHistory`, oldest first.
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+class CompressedHistory<block_bytes, block_count, codings...>::Cursor {
+    friend class CompressedHistory;
+
+    const CompressedHistory *history;
+    std::uint32_t block_number;
+    std::size_t position = 0;
+    std::uint16_t index = 0;
+    State state;
+
+    Cursor(const CompressedHistory& history, std::uint32_t block_number)
+    : history(&history)
+    , block_number(block_number) {}
+
+ public:
+    // Read the next sample into the specified `sample`. Return false if there
+    // isn't one yet.
+    bool next(Sample& sample);
+};
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+bool CompressedHistory<block_bytes, block_count, codings...>::encode(
+    Block& block, State& state, const Sample& sample) {
+    const std::uint16_t bit_count = block.bit_count;
+    State next = state;
+    bool fits = true;
+    for (std::size_t channel = 0; channel < channel_count && fits; ++channel) {
+        if (block.sample_count == 0) {
+            fits = block.write(sample[channel], 32);
+            next.previous_delta[channel] = 0;
+            next.previous[channel] = sample[channel];
+            continue;
+        }
+        const std::int32_t delta = std::int32_t(std::uint32_t(sample[channel]) - std::uint32_t(state.previous[channel]));
+        const std::int32_t difference = channel_codings[channel] == DeltaCoding::DELTA ? delta
+            : std::int32_t(std::uint32_t(delta) - std::uint32_t(state.previous_delta[channel]));
+        const std::uint32_t zigzag = zigzag_encode(difference);
+        const auto& widths = code(channel).widths;
+        std::size_t bucket = 0;
+        while (bucket + 1 < widths.size() && widths[bucket] < 32 && zigzag >> widths[bucket]) {
+            ++bucket;
+        }
+        const bool last = bucket + 1 == widths.size();
+        // `bucket` ones, then a zero unless it's the last bucket
+        fits = block.write(((1u << bucket) - 1) << !last, bucket + !last) && block.write(zigzag, widths[bucket]);
+        next.previous_delta[channel] = delta;
+        next.previous[channel] = sample[channel];
+    }
+    if (!fits) {
+        block.bit_count = bit_count;
+        return false;
+    }
+    ++block.sample_count;
+    state = next;
+    return true;
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+void CompressedHistory<block_bytes, block_count, codings...>::decode(
+    const Block& block, std::size_t& position, std::uint16_t index, State& state) {
+    for (std::size_t channel = 0; channel < channel_count; ++channel) {
+        if (index == 0) {
+            state.previous[channel] = std::int32_t(block.read(position, 32));
+            state.previous_delta[channel] = 0;
+            continue;
+        }
+        const auto& widths = code(channel).widths;
+        std::size_t bucket = 0;
+        while (bucket + 1 < widths.size() && block.read(position, 1)) {
+            ++bucket;
+        }
+        const std::int32_t difference = zigzag_decode(block.read(position, widths[bucket]));
+        const std::int32_t delta = channel_codings[channel] == DeltaCoding::DELTA ? difference
+            : std::int32_t(std::uint32_t(difference) + std::uint32_t(state.previous_delta[channel]));
+        state.previous[channel] = std::int32_t(std::uint32_t(state.previous[channel]) + std::uint32_t(delta));
+        state.previous_delta[channel] = delta;
+    }
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+void CompressedHistory<block_bytes, block_count, codings...>::push(const Sample& sample) {
+    if (blocks_started == 0 || !encode(blocks[(blocks_started - 1) % block_count], encoder, sample)) {
+        Block& fresh = blocks[blocks_started % block_count];
+        fresh.clear();
+        ++blocks_started;
+        encoder = State();
+        encode(fresh, encoder, sample);
+    }
+    ++pushed;
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+std::size_t CompressedHistory<block_bytes, block_count, codings...>::size() const {
+    std::size_t count = 0;
+    for (std::uint32_t number = first_block(); number != end_block(); ++number) {
+        count += block(number).sample_count;
+    }
+    return count;
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+std::size_t CompressedHistory<block_bytes, block_count, codings...>::bits() const {
+    std::size_t count = 0;
+    for (std::uint32_t number = first_block(); number != end_block(); ++number) {
+        count += block(number).bit_count;
+    }
+    return count;
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+typename CompressedHistory<block_bytes, block_count, codings...>::Cursor
+CompressedHistory<block_bytes, block_count, codings...>::cursor() const {
+    return Cursor(*this, first_block());
+}
+
+template <std::size_t block_bytes, std::size_t block_count, DeltaCoding... codings>
+bool CompressedHistory<block_bytes, block_count, codings...>::Cursor::next(Sample& sample) {
+    for (;;) {
+        if (block_number < history->first_block()) {
+            // The block was replaced. Skip to the oldest one kept.
+            block_number = history->first_block();
+            position = 0;
+            index = 0;
+        }
+        if (block_number == history->end_block()) {
+            return false;
+        }
+        const Block& current = history->block(block_number);
+        if (index < current.sample_count) {
+            decode(current, position, index, state);
+            ++index;
+            sample = state.previous;
+            return true;
+        }
+        if (block_number + 1 == history->end_block()) {
+            return false;
+        }
+        ++block_number;
+        position = 0;
+        index = 0;
+    }
+}
+
+} // namespace common
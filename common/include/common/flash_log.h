@@ -0,0 +1,575 @@
+#pragma once
+
+// `FlashLog` keeps records, such as timestamped measurements, in an
+// append-only log in a region of the board's flash that the program doesn't
+// occupy, so that they survive resets, including the watchdog's:
+//
+//     // the last megabyte of a 4 MB chip
+//     common::FlashLog log(PICO_FLASH_SIZE_BYTES - 1024 * 1024, 1024 * 1024);
+//
+//     log.mount();
+//     common::FlashLog::Record record;
+//     for (auto cursor = log.cursor(); cursor.next(record);) {
+//         // record.number, record.time, record.payload
+//     }
+//     ...
+//     log.append(time, {reinterpret_cast<const std::uint8_t*>(&reading), sizeof reading});
+//     ...
+//     // from time to time, but not while appending must be quick
+//     log.erase_ahead();
+//
+//     // the records from the last hour
+//     for (auto cursor = log.seek_time(now - 3600); cursor.next(record);) {
+//         ...
+//     }
+//
+// Flash is erased a sector (4 KiB) at a time, to all one bits, and programmed
+// a page (256 bytes) at a time, which can only clear bits. The log fills the
+// region's sectors in turn, and once they're all full, it erases the oldest
+// to make room, so every sector is erased equally often. Records are
+// collected in a page in RAM, which is programmed once it's full. A page is
+// programmed only once per erase, and the SDK programs it from RAM, which it
+// must, since flash can't be read while it's being programmed.
+//
+// Erasing a sector takes far longer than programming a page, so it's done
+// ahead of time, by `erase_ahead`, once the sector being appended to is half
+// full. Then `append` only ever programs a page, unless `erase_ahead` wasn't
+// called in time, in which case `append` erases the sector itself, and
+// counts it in `late_erases`.
+//
+// Each sector begins with a header having the number and time of its first
+// record, and each record begins with a header having its time and length.
+// Both headers have a CRC-32. Records are numbered from zero, consecutively,
+// and the number of a record is its sector's first number plus the number of
+// valid records before it in the sector.
+//
+// If power is lost, the records still in RAM are lost: at most a page's
+// worth. If it's lost while a page is being programmed, that page's CRCs
+// don't match, and its records are skipped. If it's lost while a sector is
+// being erased, that sector's header, or its records' CRCs, don't match, and
+// it's skipped too. `mount` finds the newest sector and the first page in it
+// that is still erased, and appends continue from there. It also checks
+// whether the sector after the newest is wholly erased, so that one whose
+// erase was interrupted is erased again.
+//
+// Interrupts are disabled while flash is erased (tens of milliseconds) or
+// programmed (about a millisecond), and the other core, if any, must not be
+// running code from flash.
+
+#include <hardware/flash.h>
+#include <hardware/regs/addressmap.h>
+#include <hardware/sync.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace common {
+
+namespace flash_log_detail {
+
+constexpr std::array<std::uint32_t, 16> crc32_table() {
+    std::array<std::uint32_t, 16> table{};
+    for (std::uint32_t i = 0; i < table.size(); ++i) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 4; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+inline constexpr std::array<std::uint32_t, 16> crc32_nibbles = crc32_table();
+
+constexpr std::uint16_t load16(const std::uint8_t *bytes) {
+    return std::uint16_t(bytes[0] | bytes[1] << 8);
+}
+
+constexpr std::uint32_t load32(const std::uint8_t *bytes) {
+    return std::uint32_t(bytes[0]) | std::uint32_t(bytes[1]) << 8 |
+        std::uint32_t(bytes[2]) << 16 | std::uint32_t(bytes[3]) << 24;
+}
+
+constexpr void store16(std::uint8_t *bytes, std::uint16_t value) {
+    bytes[0] = std::uint8_t(value);
+    bytes[1] = std::uint8_t(value >> 8);
+}
+
+constexpr void store32(std::uint8_t *bytes, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = std::uint8_t(value >> (8 * i));
+    }
+}
+
+} // namespace flash_log_detail
+
+// Return the CRC-32 (as in zlib and Ethernet) of the specified `data`,
+// continuing from the specified `crc` of whatever preceded it. The table is a
+// nibble's, not a byte's, to spare 960 bytes.
+constexpr std::uint32_t crc32(std::span<const std::uint8_t> data, std::uint32_t crc = 0) {
+    using flash_log_detail::crc32_nibbles;
+    crc = ~crc;
+    for (const std::uint8_t byte : data) {
+        crc = crc32_nibbles[(crc ^ byte) & 0xF] ^ (crc >> 4);
+        crc = crc32_nibbles[(crc ^ (byte >> 4)) & 0xF] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+class FlashLog {
+ public:
+    static constexpr std::size_t page_size = FLASH_PAGE_SIZE;
+    static constexpr std::size_t sector_size = FLASH_SECTOR_SIZE;
+    static constexpr std::size_t pages_per_sector = sector_size / page_size;
+
+    // magic, first number, first time, and CRC
+    static constexpr std::size_t sector_header_size = 16;
+    // CRC, time, and length
+    static constexpr std::size_t record_header_size = 10;
+
+    // the longest payload that a record can have, so that every record fits
+    // in a page, even the first page of a sector
+    static constexpr std::size_t max_payload_size = page_size - sector_header_size - record_header_size;
+
+    struct Record {
+        std::uint32_t number;
+        std::uint32_t time;
+        // in flash, so valid until the record's sector is erased
+        std::span<const std::uint8_t> payload;
+    };
+
+    class Cursor;
+
+ private:
+    static constexpr std::uint32_t sector_magic = 0x474F4C46; // "FLOG"
+
+    struct SectorHeader {
+        std::uint32_t first_number;
+        std::uint32_t first_time;
+    };
+
+    enum class Parsed {
+        RECORD,
+        // The rest of the page is unused.
+        END_OF_PAGE,
+        // The rest of the page is not to be trusted.
+        INVALID
+    };
+
+    const std::uint32_t region_offset;
+    const std::uint32_t sector_count;
+
+    // whether any sector holds records
+    bool started = false;
+    // the sector being appended to, the page of it that `page_buffer` will
+    // be programmed to, and how much of `page_buffer` is used
+    std::uint32_t head_sector = 0;
+    std::uint32_t head_page = 0;
+    std::size_t page_used = 0;
+    std::array<std::uint8_t, page_size> page_buffer;
+
+    // whether the sector that `start_sector` will continue into is erased
+    bool next_sector_erased = false;
+    // the position (see `sector_at`) of the oldest sector with a valid
+    // header, or `sector_count` if there is none. The sectors before it are
+    // erased, so they're left out of searches. The newest sector is always at
+    // the last position.
+    std::uint32_t oldest_position = 0;
+
+    std::uint32_t next_number = 0;
+    std::uint32_t newest_time = 0;
+    unsigned torn_page_count = 0;
+    unsigned late_erase_count = 0;
+
+    const std::uint8_t *address(std::uint32_t sector, std::uint32_t page) const {
+        return reinterpret_cast<const std::uint8_t*>(
+            XIP_BASE + region_offset + sector * sector_size + page * page_size);
+    }
+
+    bool read_sector_header(std::uint32_t sector, SectorHeader& header) const;
+
+    // Read the record at the specified `offset` in the specified `page`. If
+    // there is one, advance `offset` past it.
+    static Parsed parse(const std::uint8_t *page, std::size_t& offset, Record& record);
+
+    static bool is_erased(const std::uint8_t *page);
+
+    // Return the sector that `start_sector` will continue into.
+    std::uint32_t next_sector() const {
+        return started ? (head_sector + 1) % sector_count : 0;
+    }
+
+    void erase_sector(std::uint32_t sector);
+    void program_page();
+    void start_sector(std::uint32_t time);
+
+    // Return the sector at the specified `position` from the oldest.
+    std::uint32_t sector_at(std::uint32_t position) const {
+        return (head_sector + 1 + position) % sector_count;
+    }
+
+    // Return a cursor at the first record whose `record_key` is at least the
+    // specified `key`, given that each sector's first record has the
+    // `sector_key` in its header.
+    Cursor seek(std::uint32_t key,
+        std::uint32_t SectorHeader::*sector_key,
+        std::uint32_t Record::*record_key) const;
+
+ public:
+    // Keep the log in the specified `size` bytes of flash at the specified
+    // `offset` from the beginning of flash. Both must be multiples of
+    // `sector_size`, and there must be at least two sectors.
+    FlashLog(std::uint32_t offset, std::uint32_t size)
+    : region_offset(offset)
+    , sector_count(size / sector_size) {
+        page_buffer.fill(0xFF);
+    }
+
+    FlashLog(const FlashLog&) = delete;
+
+    // Find where the log left off. Call once, before anything else.
+    void mount();
+
+    // Append a record having the specified `time` and `payload`. Return
+    // false if the payload is longer than `max_payload_size`. `time` is
+    // whatever the application orders records by, e.g. seconds.
+    bool append(std::uint32_t time, std::span<const std::uint8_t> payload);
+
+    // Erase the sector that `append` will continue into once the current one
+    // is full, if the current one is at least half full and that sector isn't
+    // erased yet. Return whether it erased. That sector is the oldest, so its
+    // records are lost half a sector sooner than `append` would lose them.
+    // Call it often enough that a half sector's records aren't appended in
+    // between, and when a pause of tens of milliseconds is harmless.
+    bool erase_ahead();
+
+    // whether no record has ever been appended
+    bool empty() const { return next_number == 0; }
+    // the number that the next record appended will have
+    std::uint32_t end() const { return next_number; }
+    // the time of the newest record
+    std::uint32_t last_time() const { return newest_time; }
+    // the number of pages that `mount` found to have been partly programmed
+    unsigned torn_pages() const { return torn_page_count; }
+    // the number of sectors that `append` erased, because `erase_ahead`
+    // hadn't
+    unsigned late_erases() const { return late_erase_count; }
+    std::uint32_t sectors() const { return sector_count; }
+
+    // Return a cursor at the oldest record in flash. Records still in RAM
+    // aren't read. The cursor is invalidated by `append` and `erase_ahead`.
+    Cursor cursor() const;
+
+    // Return a cursor at the first record in flash whose time is at least
+    // the specified `time`, or at the end if there is none. Sector headers
+    // have the time and number of their first record, and are in order from
+    // the oldest sector, so they serve as an index: the sector is found by a
+    // binary search of the headers of the sectors written, which takes
+    // O(log sectors) header reads, and then only that sector is read.
+    Cursor seek_time(std::uint32_t time) const;
+
+    // Return a cursor at the first record in flash whose number is at least
+    // the specified `number`, or at the end if there is none, as `seek_time`
+    // does.
+    Cursor seek_number(std::uint32_t number) const;
+};
+
+// `Cursor` reads the records in a `FlashLog`, oldest first, directly from
+// flash.
+class FlashLog::Cursor {
+    friend class FlashLog;
+
+    const FlashLog *log;
+    // sectors not yet visited, of those after `sector`
+    std::uint32_t sectors_left;
+    std::uint32_t sector;
+    bool in_sector = false;
+    std::uint32_t page = 0;
+    std::size_t offset = 0;
+    std::uint32_t number = 0;
+
+    Cursor(const FlashLog& log, std::uint32_t sector, std::uint32_t sectors_left)
+    : log(&log)
+    , sectors_left(sectors_left)
+    , sector(sector) {}
+
+ public:
+    // Read the next record into the specified `record`. Return false if
+    // there isn't one.
+    bool next(Record& record);
+};
+
+inline
+bool FlashLog::read_sector_header(std::uint32_t sector, SectorHeader& header) const {
+    using namespace flash_log_detail;
+    const std::uint8_t *const bytes = address(sector, 0);
+    if (load32(bytes) != sector_magic || load32(bytes + 12) != crc32({bytes, 12})) {
+        return false;
+    }
+    header.first_number = load32(bytes + 4);
+    header.first_time = load32(bytes + 8);
+    return true;
+}
+
+inline
+FlashLog::Parsed FlashLog::parse(const std::uint8_t *page, std::size_t& offset, Record& record) {
+    using namespace flash_log_detail;
+    if (offset + record_header_size > page_size) {
+        return Parsed::END_OF_PAGE;
+    }
+    const std::uint8_t *const header = page + offset;
+    const std::uint16_t length = load16(header + 8);
+    if (length == 0xFFFF) {
+        return Parsed::END_OF_PAGE;
+    }
+    if (offset + record_header_size + length > page_size ||
+        load32(header) != crc32({header + 4, 6u + length})) {
+        return Parsed::INVALID;
+    }
+    record.time = load32(header + 4);
+    record.payload = {header + record_header_size, length};
+    offset += record_header_size + length;
+    return Parsed::RECORD;
+}
+
+inline
+bool FlashLog::is_erased(const std::uint8_t *page) {
+    for (std::size_t i = 0; i < page_size; ++i) {
+        if (page[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline
+void FlashLog::mount() {
+    SectorHeader newest{};
+    started = false;
+    for (std::uint32_t sector = 0; sector < sector_count; ++sector) {
+        SectorHeader header;
+        if (read_sector_header(sector, header) && (!started || header.first_number > newest.first_number)) {
+            newest = header;
+            head_sector = sector;
+            started = true;
+        }
+    }
+
+    torn_page_count = 0;
+    page_used = 0;
+    page_buffer.fill(0xFF);
+    next_sector_erased = true;
+    for (std::uint32_t page = 0; page < pages_per_sector && next_sector_erased; ++page) {
+        next_sector_erased = is_erased(address(next_sector(), page));
+    }
+    if (!started) {
+        next_number = 0;
+        newest_time = 0;
+        oldest_position = sector_count;
+        return;
+    }
+    SectorHeader header;
+    for (oldest_position = 0; !read_sector_header(sector_at(oldest_position), header); ++oldest_position) {
+    }
+
+    // Count the records in the newest sector, up to its first erased page.
+    next_number = newest.first_number;
+    newest_time = newest.first_time;
+    head_page = pages_per_sector;
+    for (std::uint32_t page = 0; page < pages_per_sector; ++page) {
+        const std::uint8_t *const bytes = address(head_sector, page);
+        if (page != 0 && is_erased(bytes)) {
+            head_page = page;
+            break;
+        }
+        std::size_t offset = page == 0 ? sector_header_size : 0;
+        Record record;
+        Parsed parsed;
+        while ((parsed = parse(bytes, offset, record)) == Parsed::RECORD) {
+            ++next_number;
+            newest_time = record.time;
+        }
+        torn_page_count += parsed == Parsed::INVALID;
+    }
+}
+
+inline
+void FlashLog::erase_sector(std::uint32_t sector) {
+    const std::uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_erase(region_offset + sector * sector_size, sector_size);
+    restore_interrupts(interrupts);
+}
+
+inline
+void FlashLog::program_page() {
+    const std::uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_program(region_offset + head_sector * sector_size + head_page * page_size,
+        page_buffer.data(), page_size);
+    restore_interrupts(interrupts);
+    page_buffer.fill(0xFF);
+    page_used = 0;
+    ++head_page;
+}
+
+inline
+void FlashLog::start_sector(std::uint32_t time) {
+    using namespace flash_log_detail;
+    // The new sector moves to the last position, and the others move up one,
+    // the oldest being overwritten if it's at the first.
+    oldest_position = started ? std::max<std::uint32_t>(oldest_position, 1) - 1 : sector_count - 1;
+    head_sector = next_sector();
+    head_page = 0;
+    started = true;
+
+    if (!next_sector_erased) {
+        erase_sector(head_sector);
+        ++late_erase_count;
+    }
+    next_sector_erased = false;
+
+    std::uint8_t *const header = page_buffer.data();
+    store32(header, sector_magic);
+    store32(header + 4, next_number);
+    store32(header + 8, time);
+    store32(header + 12, crc32({header, 12}));
+    page_used = sector_header_size;
+}
+
+inline
+bool FlashLog::append(std::uint32_t time, std::span<const std::uint8_t> payload) {
+    using namespace flash_log_detail;
+    if (payload.size() > max_payload_size) {
+        return false;
+    }
+    const std::size_t size = record_header_size + payload.size();
+    if (page_used + size > page_size) {
+        program_page();
+    }
+    if (!started || head_page == pages_per_sector) {
+        start_sector(time);
+    }
+
+    std::uint8_t *const header = page_buffer.data() + page_used;
+    store32(header + 4, time);
+    store16(header + 8, std::uint16_t(payload.size()));
+    std::memcpy(header + record_header_size, payload.data(), payload.size());
+    store32(header, crc32({header + 4, 6 + payload.size()}));
+    page_used += size;
+
+    ++next_number;
+    newest_time = time;
+    return true;
+}
+
+inline
+bool FlashLog::erase_ahead() {
+    if (next_sector_erased || (started && head_page < pages_per_sector / 2)) {
+        return false;
+    }
+    erase_sector(next_sector());
+    next_sector_erased = true;
+    if (started && oldest_position == 0) {
+        oldest_position = 1;
+    }
+    return true;
+}
+
+inline
+FlashLog::Cursor FlashLog::cursor() const {
+    // Start after the newest sector, which is where the oldest one is, and
+    // end with the newest.
+    return Cursor(*this, started ? head_sector : 0, started ? sector_count : 0);
+}
+
+inline
+FlashLog::Cursor FlashLog::seek_time(std::uint32_t time) const {
+    return seek(time, &SectorHeader::first_time, &Record::time);
+}
+
+inline
+FlashLog::Cursor FlashLog::seek_number(std::uint32_t number) const {
+    return seek(number, &SectorHeader::first_number, &Record::number);
+}
+
+inline
+FlashLog::Cursor FlashLog::seek(std::uint32_t key,
+    std::uint32_t SectorHeader::*sector_key,
+    std::uint32_t Record::*record_key) const {
+    if (!started) {
+        return cursor();
+    }
+    // Find the newest sector whose first record's key is at most `key`,
+    // among those from the oldest written to the newest. Sectors among them
+    // whose headers aren't valid, having been torn while being erased, are
+    // passed over, as is the newest if its first page isn't programmed yet.
+    std::uint32_t low = oldest_position;
+    std::uint32_t high = sector_count;
+    std::uint32_t found = oldest_position;
+    while (low < high) {
+        const std::uint32_t middle = low + (high - low) / 2;
+        std::uint32_t position = middle;
+        SectorHeader header;
+        while (position < high && !read_sector_header(sector_at(position), header)) {
+            ++position;
+        }
+        if (position < high && header.*sector_key <= key) {
+            found = position;
+            low = position + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // Start just before the sector found, and read up to the record.
+    Cursor result(*this, sector_at(found + sector_count - 1), sector_count - found);
+    for (;;) {
+        const Cursor before = result;
+        Record record;
+        if (!result.next(record) || record.*record_key >= key) {
+            return before;
+        }
+    }
+}
+
+inline
+bool FlashLog::Cursor::next(Record& record) {
+    for (;;) {
+        if (!in_sector) {
+            if (sectors_left == 0) {
+                return false;
+            }
+            --sectors_left;
+            sector = (sector + 1) % log->sector_count;
+            SectorHeader header;
+            if (!log->read_sector_header(sector, header)) {
+                continue;
+            }
+            in_sector = true;
+            page = 0;
+            offset = sector_header_size;
+            number = header.first_number;
+        }
+        if (page == pages_per_sector) {
+            in_sector = false;
+            continue;
+        }
+        const std::uint8_t *const bytes = log->address(sector, page);
+        if (offset == 0 && is_erased(bytes)) {
+            // The rest of the sector hasn't been written.
+            in_sector = false;
+            continue;
+        }
+        if (parse(bytes, offset, record) == Parsed::RECORD) {
+            record.number = number++;
+            return true;
+        }
+        ++page;
+        offset = 0;
+    }
+}
+
+} // namespace common
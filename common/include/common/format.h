@@ -0,0 +1,459 @@
+#pragma once
+
+// This component formats integers into text using printf-style format
+// strings, without `printf` and without floating point. It also computes, at
+// compile time, the maximum length of the text that a format can produce, so
+// that response buffers can be sized exactly rather than counted by hand or
+// fudged.
+//
+// Each conversion in the format string is described by a field type that
+// knows how to write its value and the longest text it can produce:
+//
+//     constexpr char format[] = "{\"CO2_ppm\": %hu, \"celsius\": %.1f}";
+//     using Body = common::Format<format,
+//         common::Decimal<uint16_t>,
+//         common::Fixed<int32_t, 1000, 1>>;
+//
+//     std::array<char, Body::max_length + 1> buffer; // +1 for null terminator
+//     const int length = Body::write(buffer, co2_ppm, millicelsius);
+//
+// `Fixed<int32_t, 1000, 1>` writes millicelsius as degrees Celsius with one
+// decimal place, as `%.1f` would write `millicelsius / 1000.0f`, but using only
+// integer arithmetic. This matters on the RP2040, which has no FPU: `%f` pulls
+// in soft-float and the heavyweight parts of newlib's `printf`.
+//
+// If the number of field types differs from the number of conversions in the
+// format string, then `max_length` is not a constant expression, and so the
+// code that uses it fails to compile.
+//
+// Only the parts of printf-style formatting that the field types understand
+// are supported: flags '-' and '0', a minimum field width, and a precision,
+// which is ignored in favor of the field type's own.
+//
+// If each conversion's minimum width is at least its field's maximum length,
+// then the format is "fixed width": its text always has length `max_length`,
+// and each field is always in the same place. Text written by such a format
+// can be updated in place, one field at a time, with `patch`:
+//
+//     constexpr char format[] = "{\"seq\": %10u, \"CO2_ppm\": %5hu}";
+//     using Body = common::Format<format,
+//         common::Decimal<unsigned>,
+//         common::Decimal<uint16_t>>;
+//     static_assert(Body::is_fixed_width);
+//
+//     Body::write(buffer, sequence_number, co2_ppm);
+//     ...
+//     Body::patch<1>(buffer.data(), new_co2_ppm);
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+namespace common {
+
+// Return the number of digits needed to write the specified `magnitude` in the
+// specified `base`.
+constexpr std::size_t digit_count(unsigned long long magnitude, unsigned base = 10) {
+    std::size_t count = 1;
+    while (magnitude >= base) {
+        magnitude /= base;
+        ++count;
+    }
+    return count;
+}
+
+// Return the absolute value of the specified `value` without overflowing, even
+// for the most negative value of a signed type.
+template <typename Integer>
+constexpr std::make_unsigned_t<Integer> magnitude(Integer value) {
+    using Unsigned = std::make_unsigned_t<Integer>;
+    if (value < 0) {
+        return Unsigned(0) - static_cast<Unsigned>(value);
+    }
+    return static_cast<Unsigned>(value);
+}
+
+// Write the specified `value` in the specified `base` to the specified
+// `output`, without a null terminator. Return a pointer to the character after
+// the last one written. `Unsigned` is as narrow as possible so that the RP2040
+// does not need 64-bit division.
+template <typename Unsigned>
+char *write_digits(char *output, Unsigned value, unsigned base = 10, bool uppercase = true) {
+    static_assert(std::is_unsigned_v<Unsigned>);
+    const char *const digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    char reversed[std::numeric_limits<Unsigned>::digits];
+    int count = 0;
+    do {
+        reversed[count++] = digits[value % base];
+        value /= base;
+    } while (value);
+    while (count) {
+        *output++ = reversed[--count];
+    }
+    return output;
+}
+
+// `Conversion` is one parsed printf-style conversion specification.
+struct Conversion {
+    // Index of the character after the specification.
+    std::size_t end = 0;
+    // Minimum field width, e.g. 10 in "%10lu".
+    std::size_t width = 0;
+    // The '-' flag: pad on the right instead of on the left.
+    bool left_justify = false;
+    // The '0' flag: pad with zeros instead of spaces.
+    bool zero_pad = false;
+    // The conversion specifier, e.g. 'u' in "%10lu", or '%' in "%%".
+    char specifier = '\0';
+};
+
+// Parse the conversion specification beginning at the '%' at the specified
+// `offset` in the specified `format`.
+constexpr Conversion parse_conversion(const char *format, std::size_t offset) {
+    Conversion result;
+    std::size_t i = offset + 1;
+    // flags
+    for (;; ++i) {
+        if (format[i] == '-') {
+            result.left_justify = true;
+        } else if (format[i] == '0') {
+            result.zero_pad = true;
+        } else if (format[i] != '+' && format[i] != ' ' && format[i] != '#') {
+            break;
+        }
+    }
+    // width
+    while (format[i] >= '0' && format[i] <= '9') {
+        result.width = result.width * 10 + (format[i] - '0');
+        ++i;
+    }
+    // precision
+    if (format[i] == '.') {
+        ++i;
+        while (format[i] >= '0' && format[i] <= '9') {
+            ++i;
+        }
+    }
+    // length modifiers
+    while (format[i] == 'h' || format[i] == 'l' || format[i] == 'L' || format[i] == 'j' || format[i] == 'z' || format[i] == 't') {
+        ++i;
+    }
+    result.specifier = format[i];
+    result.end = i + 1;
+    return result;
+}
+
+// `Decimal<Integer, min, max>` describes a conversion like `%d`, `%u`, `%hu`,
+// or `%ld` applied to an `Integer` in the range `[min, max]`.
+template <typename Integer,
+          Integer min = std::numeric_limits<Integer>::min(),
+          Integer max = std::numeric_limits<Integer>::max()>
+struct Decimal {
+    static_assert(std::is_integral_v<Integer>);
+    static_assert(min <= max);
+
+    using Value = Integer;
+
+    static constexpr std::size_t max_length = std::max(
+        digit_count(magnitude(min)) + (min < 0),
+        digit_count(magnitude(max)) + (max < 0));
+
+    static char *write(char *output, const Conversion&, Integer value) {
+        if (value < 0) {
+            *output++ = '-';
+        }
+        return write_digits(output, magnitude(value));
+    }
+};
+
+// `Hex<Integer, max>` describes a conversion like `%X` or `%x` applied to a
+// non-negative `Integer` no greater than `max`.
+template <typename Integer, Integer max = std::numeric_limits<Integer>::max()>
+struct Hex {
+    static_assert(std::is_integral_v<Integer>);
+    static_assert(max >= 0);
+
+    using Value = Integer;
+
+    static constexpr std::size_t max_length = digit_count(magnitude(max), 16);
+
+    static char *write(char *output, const Conversion& conversion, Integer value) {
+        return write_digits(output, magnitude(value), 16, conversion.specifier == 'X');
+    }
+};
+
+// `Fixed<Integer, scale, decimals>` describes `%.<decimals>f` applied to an
+// `Integer` divided by `scale`. For example, `%.1f` applied to
+// `millicelsius / 1000.0f` is described by `Fixed<int32_t, 1000, 1>`.
+//
+// The value is rounded to the nearest `decimals` places, with ties rounded
+// away from zero. The result is the same as `printf`'s except in some cases
+// where the value is exactly halfway between two outputs, where `printf`'s
+// answer depends on the rounding error in `value / float(scale)`.
+template <typename Integer, Integer scale, int decimals>
+struct Fixed {
+    static_assert(std::is_integral_v<Integer>);
+    static_assert(scale > 0);
+    static_assert(decimals >= 0);
+
+    using Value = Integer;
+    using Unsigned = std::make_unsigned_t<Integer>;
+
+    static constexpr Unsigned power_of_ten(int exponent) {
+        Unsigned result = 1;
+        while (exponent--) {
+            result *= 10;
+        }
+        return result;
+    }
+
+    static constexpr Unsigned unit = power_of_ten(decimals);
+    static_assert(scale % unit == 0 || unit % scale == 0,
+                  "scale and decimals must differ by a power of ten");
+
+    // Rounding can carry into the integer part, so leave room for one more
+    // than the largest quotient.
+    static constexpr std::size_t max_length =
+        std::is_signed_v<Integer>
+        + digit_count(std::max(
+              magnitude(std::numeric_limits<Integer>::min()),
+              magnitude(std::numeric_limits<Integer>::max())) / scale + 1)
+        + (decimals ? 1 + decimals : 0);
+
+    static char *write(char *output, const Conversion&, Integer value) {
+        // Like `printf`, write a '-' for any negative value, even if it rounds
+        // to zero.
+        if (value < 0) {
+            *output++ = '-';
+        }
+
+        // `units` is the magnitude of `value` in multiples of 10^-decimals.
+        const Unsigned absolute = magnitude(value);
+        Unsigned units;
+        if constexpr (unit <= Unsigned(scale)) {
+            constexpr Unsigned divisor = Unsigned(scale) / unit;
+            const Unsigned remainder = absolute % divisor;
+            units = absolute / divisor + (remainder >= divisor - remainder);
+        } else {
+            units = absolute * (unit / Unsigned(scale));
+        }
+
+        output = write_digits(output, Unsigned(units / unit));
+        if constexpr (decimals > 0) {
+            *output++ = '.';
+            Unsigned fraction = units % unit;
+            for (int i = decimals - 1; i >= 0; --i) {
+                output[i] = '0' + fraction % 10;
+                fraction /= 10;
+            }
+            output += decimals;
+        }
+        return output;
+    }
+};
+
+// This function is deliberately not `constexpr`. Calling it during constant
+// evaluation makes the enclosing expression ill-formed, which is how
+// `max_length` reports a mismatched format string at compile time.
+void format_string_and_field_types_disagree();
+
+// Return the maximum length, not including the null terminator, of the text
+// that `snprintf` produces for the specified printf-style `format` when its
+// conversions are described, in order, by `Fields`.
+template <typename... Fields>
+constexpr std::size_t max_length(const char *format) {
+    const std::size_t field_lengths[] = {Fields::max_length..., 0};
+    std::size_t field = 0;
+    std::size_t length = 0;
+    for (std::size_t i = 0; format[i] != '\0';) {
+        if (format[i] != '%') {
+            ++length;
+            ++i;
+            continue;
+        }
+        const Conversion conversion = parse_conversion(format, i);
+        i = conversion.end;
+        if (conversion.specifier == '%') {
+            ++length;
+            continue;
+        }
+        if (field == sizeof...(Fields)) {
+            format_string_and_field_types_disagree();
+        }
+        length += std::max(conversion.width, field_lengths[field]);
+        ++field;
+    }
+    if (field != sizeof...(Fields)) {
+        format_string_and_field_types_disagree();
+    }
+    return length;
+}
+
+// `FieldPosition` is where a field's conversion begins in a format string, and
+// where its text begins in the output of a fixed-width format.
+struct FieldPosition {
+    std::size_t format_offset = 0;
+    std::size_t text_offset = 0;
+    // whether the conversion's width is at least the field's maximum length
+    bool fixed_width = false;
+};
+
+// Return the position of each of the conversions in the specified `format`,
+// which are described, in order, by `Fields`. A field's `text_offset` is
+// meaningful only if every field before it has a fixed width.
+template <typename... Fields>
+constexpr std::array<FieldPosition, sizeof...(Fields)> field_positions(const char *format) {
+    const std::size_t field_lengths[] = {Fields::max_length..., 0};
+    std::array<FieldPosition, sizeof...(Fields)> positions{};
+    std::size_t field = 0;
+    std::size_t length = 0;
+    for (std::size_t i = 0; format[i] != '\0';) {
+        if (format[i] != '%') {
+            ++length;
+            ++i;
+            continue;
+        }
+        const Conversion conversion = parse_conversion(format, i);
+        if (conversion.specifier == '%') {
+            ++length;
+            i = conversion.end;
+            continue;
+        }
+        if (field == sizeof...(Fields)) {
+            format_string_and_field_types_disagree();
+        }
+        positions[field] = {
+            .format_offset = i,
+            .text_offset = length,
+            .fixed_width = conversion.width >= field_lengths[field]};
+        length += std::max(conversion.width, field_lengths[field]);
+        i = conversion.end;
+        ++field;
+    }
+    return positions;
+}
+
+// `Format<format, Fields...>` writes text according to the printf-style
+// `format`, whose conversions are described, in order, by `Fields`.
+template <const char *format, typename... Fields>
+class Format {
+    // Copy the literal text at the specified `offset` in `format` up to the
+    // next conversion (or the end) to the specified `output`. Update `offset`
+    // to refer to the next conversion. Return the new end of `output`.
+    static char *write_literal(char *output, std::size_t& offset) {
+        for (;;) {
+            const char ch = format[offset];
+            if (ch == '\0') {
+                return output;
+            }
+            if (ch != '%') {
+                *output++ = ch;
+                ++offset;
+                continue;
+            }
+            const Conversion conversion = parse_conversion(format, offset);
+            if (conversion.specifier != '%') {
+                return output;
+            }
+            *output++ = '%';
+            offset = conversion.end;
+        }
+    }
+
+    template <typename Field>
+    static char *write_field(char *output, std::size_t& offset, typename Field::Value value) {
+        const Conversion conversion = parse_conversion(format, offset);
+        offset = conversion.end;
+        char *const end = Field::write(output, conversion, value);
+        const std::size_t length = end - output;
+        if (length >= conversion.width) {
+            return end;
+        }
+
+        const std::size_t padding = conversion.width - length;
+        if (conversion.left_justify) {
+            std::memset(end, ' ', padding);
+        } else if (conversion.zero_pad) {
+            // Zeros go after the sign, if any.
+            char *const digits = output + (*output == '-');
+            std::memmove(digits + padding, digits, end - digits);
+            std::memset(digits, '0', padding);
+        } else {
+            std::memmove(output + padding, output, length);
+            std::memset(output, ' ', padding);
+        }
+        return end + padding;
+    }
+
+    static constexpr auto positions = field_positions<Fields...>(format);
+
+ public:
+    // The maximum length of the text, not including the null terminator.
+    static constexpr std::size_t max_length = common::max_length<Fields...>(format);
+
+    // Whether the text always has length `max_length`, with each field in
+    // the same place (see `patch`).
+    static constexpr bool is_fixed_width = std::apply([](const auto&... position) {
+        return (position.fixed_width && ...);
+    }, positions);
+
+    // Write the text for the specified `values`, followed by a null terminator,
+    // to the specified `output`, which must have room for at least
+    // `max_length + 1` characters. Return the length of the text.
+    static int write(char *output, typename Fields::Value... values) {
+        char *const begin = output;
+        std::size_t offset = 0;
+        output = write_literal(output, offset);
+        ((output = write_field<Fields>(output, offset, values),
+          output = write_literal(output, offset)), ...);
+        *output = '\0';
+        return output - begin;
+    }
+
+    template <std::size_t size>
+    static int write(std::array<char, size>& buffer, typename Fields::Value... values) {
+        static_assert(size >= max_length + 1);
+        return write(buffer.data(), values...);
+    }
+
+    template <std::size_t size>
+    static int write(char (&buffer)[size], typename Fields::Value... values) {
+        static_assert(size >= max_length + 1);
+        return write(&buffer[0], values...);
+    }
+
+    // Overwrite the field at the specified `index` in the specified `text`,
+    // which was written by `write`, with the specified `value`. The rest of
+    // the text is left alone. The format must be fixed width.
+    template <std::size_t index>
+    static void patch(char *text, typename std::tuple_element_t<index, std::tuple<Fields...>>::Value value) {
+        static_assert(is_fixed_width, "each conversion's width must be at least its field's maximum length");
+        std::size_t offset = positions[index].format_offset;
+        write_field<std::tuple_element_t<index, std::tuple<Fields...>>>(
+            text + positions[index].text_offset, offset, value);
+    }
+};
+
+// Insert the text of `Prefix`, whose fields are the specified
+// `leading_values` followed by `body_length`, in front of the `body_length`
+// characters at the specified `output`. `output` must have room for
+// `Prefix::max_length + body_length` characters. Return the length of the
+// prefix.
+//
+// This is how to write a length-prefixed message, such as an HTTP response
+// with a Content-Length header or a chunk in a chunked response: format the
+// body first, and then insert the prefix.
+template <typename Prefix, typename... Values>
+int insert_length_prefix(char *output, int body_length, Values... leading_values) {
+    char prefix[Prefix::max_length + 1];
+    const int prefix_length = Prefix::write(prefix, leading_values..., body_length);
+    std::memmove(output + prefix_length, output, body_length);
+    std::memcpy(output, prefix, prefix_length);
+    return prefix_length;
+}
+
+} // namespace common
@@ -0,0 +1,82 @@
+#pragma once
+
+// `History<Record, capacity>` keeps the most recent `capacity` records, such
+// as timestamped sensor readings, in a ring buffer reserved at compile time,
+// so that a board can answer for the last few hours by itself, even if
+// whatever usually collects its readings was down. Recording never
+// allocates; once the buffer is full, each new record replaces the oldest.
+//
+// Records should be small and packed, since their number is what decides how
+// far back the history goes. An application chooses how much SRAM to spend,
+// and `history_capacity` says how many records fit:
+//
+//     struct [[gnu::packed]] Record {
+//         uint32_t uptime_seconds;
+//         uint16_t co2_ppm;
+//     };
+//
+//     constexpr std::size_t history_bytes = 32 * 1024;
+//     common::History<Record, common::history_capacity<Record>(history_bytes)> history;
+//
+//     history.push({.uptime_seconds = ..., .co2_ppm = ...});
+//
+// Each record pushed gets the next record number, starting at zero. The
+// records kept are numbered from `first()` up to, but not including,
+// `end()`. Readers that can be interrupted by `push`, such as a coroutine
+// sending the history a piece at a time, keep a record number rather than a
+// position, and skip ahead to `first()` if the records they wanted have since
+// been replaced:
+//
+//     for (std::uint32_t number = history.first(); number != history.end(); ++number) {
+//         const Record& record = history.at(number);
+//         ...
+//     }
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace common {
+
+// Return how many `Record`s fit in the specified number of `bytes`.
+template <typename Record>
+constexpr std::size_t history_capacity(std::size_t bytes) {
+    return bytes / sizeof(Record);
+}
+
+template <typename Record, std::size_t capacity>
+class History {
+    static_assert(capacity > 0);
+
+    std::array<Record, capacity> records;
+    // the number of records ever pushed
+    std::uint32_t pushed = 0;
+
+ public:
+    static constexpr std::size_t max_size = capacity;
+
+    History() = default;
+    History(const History&) = delete;
+
+    void push(const Record& record) {
+        records[pushed % capacity] = record;
+        ++pushed;
+    }
+
+    std::size_t size() const { return pushed < capacity ? pushed : capacity; }
+    bool empty() const { return pushed == 0; }
+
+    // the number of the oldest record kept
+    std::uint32_t first() const { return pushed - size(); }
+    // the number that the next record pushed will have
+    std::uint32_t end() const { return pushed; }
+
+    // Return the record having the specified `number`, which must be at least
+    // `first()` and less than `end()`.
+    const Record& at(std::uint32_t number) const { return records[number % capacity]; }
+
+    // Return the most recent record. The history must not be empty.
+    const Record& newest() const { return at(pushed - 1); }
+};
+
+} // namespace common
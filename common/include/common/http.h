@@ -0,0 +1,704 @@
+#pragma once
+
+// This component parses HTTP/1.x requests incrementally, as their bytes
+// arrive, without allocating and without holding the whole request in memory.
+//
+// `RequestParser` is a state machine that consumes bytes and extracts the
+// method, path, query, and a small set of interesting headers into
+// fixed-size `Slot`s of a `Request`. Other headers are skipped over.
+//
+// `RequestReader` pairs a `RequestParser` with a small receive buffer, so that
+// a connection handler can receive requests in pieces of any size, including
+// pipelined requests and requests split across TCP segments:
+//
+//     common::RequestReader<256> reader;
+//     for (;;) {
+//         while (!reader.next()) {
+//             auto [count, err] = co_await conn.recv(reader.free_space(), reader.free_size());
+//             if (err) {
+//                 co_return;
+//             }
+//             reader.received(count);
+//         }
+//         if (reader.status() != common::RequestParser::COMPLETE) {
+//             co_await conn.send(common::error_response(reader.status()));
+//             co_return;
+//         }
+//         const common::Request& request = reader.request();
+//         ... respond to `request` ...
+//         if (!request.keep_alive()) {
+//             co_return;
+//         }
+//     }
+//
+// A request body, if its Content-Length is nonzero, is consumed and
+// discarded.
+//
+// This component also supports conditional requests: a response carries an
+// ETag derived from a version number, and `write_not_modified` answers a
+// request whose If-None-Match header has that ETag with a bodiless 304.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <common/format.h>
+#include <common/reader.h>
+
+namespace common {
+
+// Return whether `a` and `b` are equal, ignoring ASCII case.
+inline bool equal_ignoring_case(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        const auto lower = [](char ch) { return ch >= 'A' && ch <= 'Z' ? char(ch - 'A' + 'a') : ch; };
+        return lower(x) == lower(y);
+    });
+}
+
+// Remove the next item from the specified comma-separated `list` (e.g. the
+// value of a Connection header), and return the item without surrounding
+// whitespace.
+inline std::string_view next_list_item(std::string_view& list) {
+    const std::size_t comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+        item.remove_prefix(1);
+    }
+    while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+        item.remove_suffix(1);
+    }
+    return item;
+}
+
+// Return whether the comma-separated `list` contains the specified `token`,
+// ignoring ASCII case.
+inline bool has_token(std::string_view list, std::string_view token) {
+    while (!list.empty()) {
+        if (equal_ignoring_case(next_list_item(list), token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return whether the specified `accept` header value (e.g.
+// "application/cbor, application/json;q=0.5") names the specified media
+// `type` without giving it a quality of zero. Wildcards don't count, so that
+// a server can keep its default representation for clients that accept
+// anything.
+inline bool accepts_media_type(std::string_view accept, std::string_view type) {
+    while (!accept.empty()) {
+        std::string_view parameters = next_list_item(accept);
+        const std::size_t semicolon = parameters.find(';');
+        std::string_view range = parameters.substr(0, semicolon);
+        parameters.remove_prefix(semicolon == std::string_view::npos ? parameters.size() : semicolon + 1);
+        while (!range.empty() && (range.back() == ' ' || range.back() == '\t')) {
+            range.remove_suffix(1);
+        }
+        if (!equal_ignoring_case(range, type)) {
+            continue;
+        }
+        // Look for "q=0", "q=0.0", etc.
+        bool rejected = false;
+        while (!parameters.empty()) {
+            const std::size_t next = parameters.find(';');
+            std::string_view parameter = parameters.substr(0, next);
+            parameters.remove_prefix(next == std::string_view::npos ? parameters.size() : next + 1);
+            while (!parameter.empty() && (parameter.front() == ' ' || parameter.front() == '\t')) {
+                parameter.remove_prefix(1);
+            }
+            if (parameter.size() >= 3 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+                rejected = parameter.substr(2).find_first_not_of("0.") == std::string_view::npos;
+            }
+        }
+        return !rejected;
+    }
+    return false;
+}
+
+// Return the value of the parameter having the specified `name` in the
+// specified URL `query` (e.g. "after=12&limit=3"), or an empty string if there
+// is no such parameter. The value is not percent-decoded.
+inline std::string_view query_parameter(std::string_view query, std::string_view name) {
+    while (!query.empty()) {
+        const std::size_t ampersand = query.find('&');
+        const std::string_view parameter = query.substr(0, ampersand);
+        query.remove_prefix(ampersand == std::string_view::npos ? query.size() : ampersand + 1);
+        if (parameter.size() > name.size() && parameter.starts_with(name) && parameter[name.size()] == '=') {
+            return parameter.substr(name.size() + 1);
+        }
+    }
+    return std::string_view();
+}
+
+// `Slot<capacity>` holds up to `capacity` characters of a request field.
+// Characters beyond that are dropped, and the slot remembers that it
+// overflowed.
+template <std::size_t capacity>
+class Slot {
+    char data[capacity];
+    std::uint16_t length = 0;
+    bool overflow = false;
+
+ public:
+    void clear() {
+        length = 0;
+        overflow = false;
+    }
+
+    void push(char ch) {
+        if (length < capacity) {
+            data[length++] = ch;
+        } else {
+            overflow = true;
+        }
+    }
+
+    void trim_trailing_whitespace() {
+        while (length && (data[length - 1] == ' ' || data[length - 1] == '\t')) {
+            --length;
+        }
+    }
+
+    bool overflowed() const { return overflow; }
+    bool empty() const { return length == 0; }
+    std::string_view view() const { return std::string_view(data, length); }
+};
+
+// `Request` is the parts of an HTTP request that the servers care about.
+struct Request {
+    // e.g. "GET"
+    Slot<8> method;
+    // e.g. "/latest", from "GET /latest?after=12 HTTP/1.1"
+    Slot<48> path;
+    // e.g. "after=12", from "GET /latest?after=12 HTTP/1.1"
+    Slot<48> query;
+    // 0 for HTTP/1.0, 1 for HTTP/1.1
+    int minor_version = 1;
+
+    // The values of interesting headers, without surrounding whitespace, or
+    // empty if the request did not have the header. A repeated header's
+    // values are joined with commas, as though they were one list. A value
+    // too long for its slot is left empty too, as though the header were
+    // absent, rather than truncated into something that the client didn't
+    // send.
+    Slot<32> connection;
+    Slot<64> accept;
+    Slot<48> if_none_match;
+    Slot<16> last_event_id;
+    Slot<16> upgrade;
+    Slot<32> sec_websocket_key;
+    Slot<8> sec_websocket_version;
+    std::uint32_t content_length = 0;
+
+    void clear();
+
+    // Return whether the connection may be used for further requests.
+    // HTTP/1.1 connections are persistent unless the client sends
+    // "Connection: close". HTTP/1.0 connections are persistent only if the
+    // client sends "Connection: keep-alive".
+    bool keep_alive() const {
+        if (minor_version == 0) {
+            return has_token(connection.view(), "keep-alive");
+        }
+        return !has_token(connection.view(), "close");
+    }
+};
+
+// Return the Connection header line, including its CRLF, that a response to
+// the specified `request` needs in order to tell the client what `keep_alive`
+// decided, or an empty string if the request's HTTP version already implies
+// it: "Connection: keep-alive" to an HTTP/1.0 client that asked for it, and
+// "Connection: close" to an HTTP/1.1 client that asked for that. The line
+// goes right after the response's status line.
+inline std::string_view connection_header(const Request& request) {
+    if (request.minor_version == 0) {
+        return request.keep_alive() ? "Connection: keep-alive\r\n" : "";
+    }
+    return request.keep_alive() ? "" : "Connection: close\r\n";
+}
+
+inline
+void Request::clear() {
+    method.clear();
+    path.clear();
+    query.clear();
+    minor_version = 1;
+    connection.clear();
+    accept.clear();
+    if_none_match.clear();
+    last_event_id.clear();
+    upgrade.clear();
+    sec_websocket_key.clear();
+    sec_websocket_version.clear();
+    content_length = 0;
+}
+
+class RequestParser {
+ public:
+    enum Status {
+        INCOMPLETE,
+        COMPLETE,
+        BAD_REQUEST,
+        URI_TOO_LONG,
+        HEADERS_TOO_LARGE
+    };
+
+    // A request's line and headers together may be at most this long.
+    static constexpr std::size_t max_header_bytes = 4096;
+
+ private:
+    enum State {
+        METHOD,
+        PATH,
+        QUERY,
+        VERSION,
+        REQUEST_LINE_LF,
+        HEADER_LINE_START,
+        HEADER_NAME,
+        HEADER_VALUE_START,
+        HEADER_VALUE,
+        HEADER_LINE_LF,
+        HEADERS_END_LF,
+        BODY,
+        DONE
+    };
+
+    // The `Request` field that header value characters go into.
+    enum Field {
+        NO_FIELD,
+        CONNECTION,
+        ACCEPT,
+        IF_NONE_MATCH,
+        LAST_EVENT_ID,
+        UPGRADE,
+        SEC_WEBSOCKET_KEY,
+        SEC_WEBSOCKET_VERSION,
+        CONTENT_LENGTH
+    };
+
+    Request current;
+    Status state_status = INCOMPLETE;
+    State state = METHOD;
+    Field field = NO_FIELD;
+    Slot<8> version;
+    Slot<24> header_name;
+    std::size_t header_bytes = 0;
+    std::uint32_t body_remaining = 0;
+    // not reset by `reset()`
+    unsigned resets = 0;
+
+    Status fail(Status why) {
+        state = DONE;
+        return state_status = why;
+    }
+
+    // Prepare the specified header value `slot` for a value. If the header
+    // is repeated, its values are joined into a comma-separated list, which
+    // is what a repeated header means.
+    template <std::size_t capacity>
+    static void begin_header_value(Slot<capacity>& slot);
+
+    // Trim the specified header value `slot`, or, if the value didn't fit,
+    // empty it.
+    template <std::size_t capacity>
+    static void end_header_value(Slot<capacity>& slot);
+
+    void begin_header_value();
+    void end_header_value();
+    void append_header_value(char ch);
+    bool end_headers();
+    Status consume(char ch);
+
+ public:
+    // Parse as much of the specified `input` as belongs to the current
+    // request. Return the number of bytes consumed. Parsing stops at the end
+    // of the request, so that any bytes of a subsequent (pipelined) request
+    // remain unconsumed.
+    std::size_t parse(std::string_view input);
+
+    // Return whether the current request is complete, malformed, or still
+    // incomplete.
+    Status status() const { return state_status; }
+
+    // Return the request parsed so far.
+    const Request& request() const { return current; }
+
+    // Return whether any of the current request has been received.
+    bool started() const { return header_bytes != 0; }
+
+    // Return whether the current request's headers have been received, and
+    // its body is being received.
+    bool receiving_body() const { return state == BODY; }
+
+    // Return a number that identifies the current request among those parsed
+    // by this object.
+    unsigned request_number() const { return resets; }
+
+    // Prepare to parse a new request.
+    void reset();
+};
+
+inline
+void RequestParser::reset() {
+    current.clear();
+    state_status = INCOMPLETE;
+    state = METHOD;
+    field = NO_FIELD;
+    version.clear();
+    header_name.clear();
+    header_bytes = 0;
+    body_remaining = 0;
+    ++resets;
+}
+
+inline
+void RequestParser::begin_header_value() {
+    const std::string_view name = header_name.view();
+    if (header_name.overflowed()) {
+        field = NO_FIELD;
+    } else if (equal_ignoring_case(name, "Connection")) {
+        field = CONNECTION;
+        begin_header_value(current.connection);
+    } else if (equal_ignoring_case(name, "Accept")) {
+        field = ACCEPT;
+        begin_header_value(current.accept);
+    } else if (equal_ignoring_case(name, "If-None-Match")) {
+        field = IF_NONE_MATCH;
+        begin_header_value(current.if_none_match);
+    } else if (equal_ignoring_case(name, "Last-Event-ID")) {
+        field = LAST_EVENT_ID;
+        begin_header_value(current.last_event_id);
+    } else if (equal_ignoring_case(name, "Upgrade")) {
+        field = UPGRADE;
+        begin_header_value(current.upgrade);
+    } else if (equal_ignoring_case(name, "Sec-WebSocket-Key")) {
+        field = SEC_WEBSOCKET_KEY;
+        begin_header_value(current.sec_websocket_key);
+    } else if (equal_ignoring_case(name, "Sec-WebSocket-Version")) {
+        field = SEC_WEBSOCKET_VERSION;
+        begin_header_value(current.sec_websocket_version);
+    } else if (equal_ignoring_case(name, "Content-Length")) {
+        field = CONTENT_LENGTH;
+        current.content_length = 0;
+    } else {
+        field = NO_FIELD;
+    }
+}
+
+inline
+void RequestParser::append_header_value(char ch) {
+    switch (field) {
+    case NO_FIELD: break;
+    case CONNECTION: current.connection.push(ch); break;
+    case ACCEPT: current.accept.push(ch); break;
+    case IF_NONE_MATCH: current.if_none_match.push(ch); break;
+    case LAST_EVENT_ID: current.last_event_id.push(ch); break;
+    case UPGRADE: current.upgrade.push(ch); break;
+    case SEC_WEBSOCKET_KEY: current.sec_websocket_key.push(ch); break;
+    case SEC_WEBSOCKET_VERSION: current.sec_websocket_version.push(ch); break;
+    case CONTENT_LENGTH:
+        if (ch >= '0' && ch <= '9' && current.content_length < 100'000'000) {
+            current.content_length = current.content_length * 10 + (ch - '0');
+        } else if (ch != ' ' && ch != '\t') {
+            fail(BAD_REQUEST);
+        }
+        break;
+    }
+}
+
+template <std::size_t capacity>
+void RequestParser::begin_header_value(Slot<capacity>& slot) {
+    if (!slot.empty()) {
+        slot.push(',');
+        slot.push(' ');
+    }
+}
+
+template <std::size_t capacity>
+void RequestParser::end_header_value(Slot<capacity>& slot) {
+    if (slot.overflowed()) {
+        slot.clear();
+    } else {
+        slot.trim_trailing_whitespace();
+    }
+}
+
+inline
+void RequestParser::end_header_value() {
+    switch (field) {
+    case CONNECTION: end_header_value(current.connection); break;
+    case ACCEPT: end_header_value(current.accept); break;
+    case IF_NONE_MATCH: end_header_value(current.if_none_match); break;
+    case LAST_EVENT_ID: end_header_value(current.last_event_id); break;
+    case UPGRADE: end_header_value(current.upgrade); break;
+    case SEC_WEBSOCKET_KEY: end_header_value(current.sec_websocket_key); break;
+    case SEC_WEBSOCKET_VERSION: end_header_value(current.sec_websocket_version); break;
+    case NO_FIELD:
+    case CONTENT_LENGTH: break;
+    }
+    field = NO_FIELD;
+    header_name.clear();
+}
+
+// Finish the header section. Return whether the request is complete, i.e.
+// whether it has no body.
+inline
+bool RequestParser::end_headers() {
+    body_remaining = current.content_length;
+    if (body_remaining) {
+        state = BODY;
+        return false;
+    }
+    state = DONE;
+    state_status = COMPLETE;
+    return true;
+}
+
+inline
+RequestParser::Status RequestParser::consume(char ch) {
+    if (state != BODY && ++header_bytes > max_header_bytes) {
+        return fail(HEADERS_TOO_LARGE);
+    }
+
+    switch (state) {
+    case METHOD:
+        if (ch == ' ') {
+            if (current.method.empty()) {
+                return fail(BAD_REQUEST);
+            }
+            state = PATH;
+        } else if ((ch == '\r' || ch == '\n') && current.method.empty()) {
+            // Ignore empty lines before the request line.
+        } else if (ch >= 'A' && ch <= 'Z') {
+            current.method.push(ch);
+            if (current.method.overflowed()) {
+                return fail(BAD_REQUEST);
+            }
+        } else {
+            return fail(BAD_REQUEST);
+        }
+        break;
+    case PATH:
+        if (ch == ' ') {
+            state = VERSION;
+        } else if (ch == '?') {
+            state = QUERY;
+        } else if (ch == '\r' || ch == '\n') {
+            return fail(BAD_REQUEST);
+        } else {
+            current.path.push(ch);
+            if (current.path.overflowed()) {
+                return fail(URI_TOO_LONG);
+            }
+        }
+        break;
+    case QUERY:
+        if (ch == ' ') {
+            state = VERSION;
+        } else if (ch == '\r' || ch == '\n') {
+            return fail(BAD_REQUEST);
+        } else {
+            current.query.push(ch);
+            if (current.query.overflowed()) {
+                return fail(URI_TOO_LONG);
+            }
+        }
+        break;
+    case VERSION:
+        if (ch == '\r' || ch == '\n') {
+            if (version.view() == "HTTP/1.1") {
+                current.minor_version = 1;
+            } else if (version.view() == "HTTP/1.0") {
+                current.minor_version = 0;
+            } else {
+                return fail(BAD_REQUEST);
+            }
+            state = ch == '\r' ? REQUEST_LINE_LF : HEADER_LINE_START;
+        } else {
+            version.push(ch);
+            // e.g. "HTTP/1.10", which mustn't be read as "HTTP/1.1"
+            if (version.overflowed()) {
+                return fail(BAD_REQUEST);
+            }
+        }
+        break;
+    case REQUEST_LINE_LF:
+    case HEADER_LINE_LF:
+        if (ch != '\n') {
+            return fail(BAD_REQUEST);
+        }
+        state = HEADER_LINE_START;
+        break;
+    case HEADER_LINE_START:
+        if (ch == '\r') {
+            state = HEADERS_END_LF;
+            break;
+        }
+        if (ch == '\n') {
+            end_headers();
+            break;
+        }
+        if (ch == ' ' || ch == '\t' || ch == ':') {
+            // obsolete line folding, or an empty header name
+            return fail(BAD_REQUEST);
+        }
+        state = HEADER_NAME;
+        [[fallthrough]];
+    case HEADER_NAME:
+        if (ch == ':') {
+            begin_header_value();
+            state = HEADER_VALUE_START;
+        } else if (ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t') {
+            return fail(BAD_REQUEST);
+        } else {
+            header_name.push(ch);
+        }
+        break;
+    case HEADER_VALUE_START:
+        if (ch == ' ' || ch == '\t') {
+            break;
+        }
+        state = HEADER_VALUE;
+        [[fallthrough]];
+    case HEADER_VALUE:
+        if (ch == '\r' || ch == '\n') {
+            end_header_value();
+            state = ch == '\r' ? HEADER_LINE_LF : HEADER_LINE_START;
+        } else {
+            append_header_value(ch);
+        }
+        break;
+    case HEADERS_END_LF:
+        if (ch != '\n') {
+            return fail(BAD_REQUEST);
+        }
+        end_headers();
+        break;
+    case BODY:
+        if (--body_remaining == 0) {
+            state = DONE;
+            state_status = COMPLETE;
+        }
+        break;
+    case DONE:
+        break;
+    }
+    return state_status;
+}
+
+inline
+std::size_t RequestParser::parse(std::string_view input) {
+    std::size_t consumed = 0;
+    while (consumed < input.size() && state != DONE) {
+        if (state == BODY) {
+            // Skip the body in bulk, rather than one byte at a time.
+            const std::size_t skip = std::min<std::size_t>(body_remaining, input.size() - consumed);
+            body_remaining -= skip;
+            consumed += skip;
+            if (body_remaining == 0) {
+                state = DONE;
+                state_status = COMPLETE;
+            }
+            continue;
+        }
+        consume(input[consumed++]);
+    }
+    return consumed;
+}
+
+// `RequestReader<capacity>` receives bytes into a buffer of the specified
+// `capacity` and parses them into requests. The capacity limits only how much
+// is received at a time, not how large a request can be.
+template <std::size_t capacity>
+class RequestReader : public Reader<RequestParser, capacity> {
+ public:
+    // Return the request parsed by the most recent call to `next()`.
+    const Request& request() const { return this->parser().request(); }
+};
+
+// Return a complete response, including "Connection: close", appropriate for
+// a request that failed to parse with the specified `status`.
+inline std::string_view error_response(RequestParser::Status status) {
+    switch (status) {
+    case RequestParser::URI_TOO_LONG:
+        return "HTTP/1.1 414 URI Too Long\r\n"
+               "Connection: close\r\n"
+               "Content-Length: 0\r\n"
+               "\r\n";
+    case RequestParser::HEADERS_TOO_LARGE:
+        return "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+               "Connection: close\r\n"
+               "Content-Length: 0\r\n"
+               "\r\n";
+    default:
+        return "HTTP/1.1 400 Bad Request\r\n"
+               "Connection: close\r\n"
+               "Content-Length: 0\r\n"
+               "\r\n";
+    }
+}
+
+// An entity tag (ETag) identifies one version of a resource. The servers
+// derive theirs from a version number, such as a measurement's sequence
+// number, and a random number chosen at boot, so that a tag from before a
+// reboot does not match the same version number afterward.
+// `COMMON_HTTP_ETAG_FORMAT` and `COMMON_HTTP_ETAG_FIELDS` are macros so that
+// they can be spliced into response header formats.
+#define COMMON_HTTP_ETAG_FORMAT "\"%08X-%X\""
+#define COMMON_HTTP_ETAG_FIELDS common::Hex<std::uint32_t>, common::Hex<std::uint32_t>
+
+inline constexpr char etag_format[] = COMMON_HTTP_ETAG_FORMAT;
+
+using ETag = Format<etag_format, COMMON_HTTP_ETAG_FIELDS>;
+
+inline constexpr char not_modified_format[] =
+    "HTTP/1.1 304 Not Modified\r\n"
+    "ETag: " COMMON_HTTP_ETAG_FORMAT "\r\n"
+    "\r\n";
+
+using NotModified = Format<not_modified_format, COMMON_HTTP_ETAG_FIELDS>;
+
+// Return whether the specified `if_none_match` value of an If-None-Match
+// header matches the specified `etag`, using the weak comparison that
+// If-None-Match calls for.
+inline bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+    while (!if_none_match.empty()) {
+        std::string_view item = next_list_item(if_none_match);
+        if (item == "*") {
+            return true;
+        }
+        if (item.starts_with("W/")) {
+            item.remove_prefix(2);
+        }
+        if (item == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// If the specified `request` has an If-None-Match header that matches the
+// ETag of the specified `version` served since the specified `boot_id`, then
+// write a 304 (Not Modified) response to the specified `output` and return its
+// length. Otherwise, return zero.
+inline int write_not_modified(
+    char (&output)[NotModified::max_length + 1],
+    const Request& request,
+    std::uint32_t boot_id,
+    std::uint32_t version) {
+    if (request.if_none_match.empty()) {
+        return 0;
+    }
+    char etag[ETag::max_length + 1];
+    const int etag_length = ETag::write(etag, boot_id, version);
+    if (!etag_matches(request.if_none_match.view(), std::string_view(etag, etag_length))) {
+        return 0;
+    }
+    return NotModified::write(output, boot_id, version);
+}
+
+} // namespace common
@@ -0,0 +1,186 @@
+#pragma once
+
+// `IdleTimeout` closes client connections that have been idle for too long,
+// e.g. a keep-alive connection whose client has gone away without closing it,
+// or a client that sends a request too slowly, or one that stops reading a
+// response.
+//
+// Each connection handler keeps an `IdleTimeout::Watch` on its connection, and
+// arms it before waiting for the client:
+//
+//     picoro::Coroutine<void> handle_client(picoro::Connection conn) {
+//         common::IdleTimeout::Watch watch(idle_timeout(), conn);
+//         for (;;) {
+//             while (!requests.next()) {
+//                 watch.expect_request(requests.parser(), request_timeouts);
+//                 auto [count, err] = co_await conn.recv(requests.free_space(), requests.free_size());
+//                 watch.cancel();
+//                 ...
+//             }
+//             ...
+//             watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+//             auto [count, err] = co_await conn.send(response);
+//             watch.cancel();
+//             ...
+//         }
+//     }
+//
+// One coroutine per server, `IdleTimeout::run`, periodically closes the
+// connections whose watches have expired. Closing the connection makes the
+// handler's pending `recv` or `send` complete with an error, so the handler
+// returns and its coroutine frame is freed.
+//
+// That depends on `picoro::Connection::close` completing a pending operation
+// with an error, rather than only detaching it from the connection, in which
+// case the handler would never be resumed and its frame would leak.
+// `coroutines-timeout-bench` (see coroutines/host/) checks that the reaper
+// frees handlers blocked in `recv` and in `send` on the host's stand-in for
+// picoro's TCP. picoro's lwIP `Connection` isn't in this tree, so on the
+// board the contract is assumed, not checked.
+//
+// Since the reaper wakes up once per period, a connection is closed between
+// zero and one period after its deadline: timeouts are accurate only to
+// within the period passed to `run`.
+//
+// Each deadline is for a phase of the connection, and `IdleTimeout` counts how
+// many connections were closed in each phase.
+
+#include <picoro/coroutine.h>
+#include <picoro/debug.h>
+#include <picoro/sleep.h>
+#include <picoro/tcp.h>
+
+#include <pico/time.h>
+
+#include <common/http.h>
+#include <common/intrusive_list.h>
+
+#include <chrono>
+
+namespace common {
+
+class IdleTimeout {
+ public:
+    class Watch;
+
+    // What a connection is waiting for when its watch expires.
+    enum Phase {
+        // the first byte of a request
+        IDLE,
+        // the rest of a request's line and headers
+        HEADERS,
+        // more of a request's body
+        BODY,
+        // the client to accept more of a response
+        WRITE
+    };
+    static constexpr int phase_count = WRITE + 1;
+
+ private:
+    IntrusiveList<Watch> watches;
+    unsigned timeouts_total[phase_count] = {};
+
+ public:
+    IdleTimeout() = default;
+    IdleTimeout(const IdleTimeout&) = delete;
+
+    // Return the number of connections closed in the specified `phase`.
+    unsigned timeouts(Phase phase) const { return timeouts_total[phase]; }
+
+    // Every specified `period`, close the connections whose watches have
+    // expired, so each is closed up to `period` after its deadline. Run
+    // forever.
+    picoro::Coroutine<void> run(async_context_t *ctx, std::chrono::milliseconds period);
+};
+
+// How long a client may take to send each part of a request.
+struct RequestTimeouts {
+    // from the end of the previous request (or from connecting) until the
+    // first byte of the next request
+    std::chrono::milliseconds idle;
+    // from the first byte of a request until the end of its headers, however
+    // many receives that takes
+    std::chrono::milliseconds headers;
+    // between receives of a request's body
+    std::chrono::milliseconds body;
+};
+
+class IdleTimeout::Watch : public IntrusiveList<Watch>::Node {
+    friend class IdleTimeout;
+
+    picoro::Connection& conn;
+    absolute_time_t deadline = at_the_end_of_time;
+    Phase phase = IDLE;
+    // The headers deadline is kept apart from `deadline`, because it spans
+    // receives, while `cancel` is called after each.
+    absolute_time_t headers_deadline = at_the_end_of_time;
+    unsigned headers_request = 0;
+    bool headers_started = false;
+
+ public:
+    Watch(IdleTimeout& owner, picoro::Connection& conn)
+    : Node(owner.watches)
+    , conn(conn) {}
+
+    // Close the connection if the specified `timeout` elapses before the next
+    // call to `cancel`, `expire_in`, `expire_at`, or `expect_request`. Count
+    // the closure under the specified `phase`.
+    void expire_in(std::chrono::milliseconds timeout, Phase phase = IDLE) {
+        expire_at(make_timeout_time_ms(timeout.count()), phase);
+    }
+
+    // Close the connection if the specified `when` is reached before the next
+    // call to `cancel`, `expire_in`, `expire_at`, or `expect_request`. Count
+    // the closure under the specified `phase`.
+    void expire_at(absolute_time_t when, Phase phase) {
+        deadline = when;
+        this->phase = phase;
+    }
+
+    // Arm the watch for receiving more of the request being parsed by the
+    // specified `parser`, with the deadline appropriate to how much of it has
+    // been received so far.
+    void expect_request(const RequestParser& parser, const RequestTimeouts& timeouts);
+
+    // Don't close the connection.
+    void cancel() {
+        deadline = at_the_end_of_time;
+    }
+};
+
+inline
+void IdleTimeout::Watch::expect_request(const RequestParser& parser, const RequestTimeouts& timeouts) {
+    if (!parser.started()) {
+        expire_in(timeouts.idle, IDLE);
+    } else if (parser.receiving_body()) {
+        expire_in(timeouts.body, BODY);
+    } else {
+        if (!headers_started || headers_request != parser.request_number()) {
+            headers_deadline = make_timeout_time_ms(timeouts.headers.count());
+            headers_request = parser.request_number();
+            headers_started = true;
+        }
+        expire_at(headers_deadline, HEADERS);
+    }
+}
+
+inline
+picoro::Coroutine<void> IdleTimeout::run(async_context_t *ctx, std::chrono::milliseconds period) {
+    for (;;) {
+        co_await picoro::sleep_for(ctx, period);
+        for (auto next = watches.begin(); next != watches.end();) {
+            // Closing the connection might resume its handler, which would
+            // then destroy `watch`. Don't touch `watch` afterward.
+            Watch& watch = *next;
+            ++next;
+            if (time_reached(watch.deadline)) {
+                picoro::debug("Closing a connection that timed out in phase %d.\n", int(watch.phase));
+                ++timeouts_total[watch.phase];
+                watch.cancel();
+                watch.conn.close();
+            }
+        }
+    }
+}
+
+} // namespace common
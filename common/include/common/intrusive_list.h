@@ -0,0 +1,98 @@
+#pragma once
+
+// `IntrusiveList<T>` is a doubly linked list of objects that link themselves
+// in for as long as they exist, such as per-connection state living in a
+// connection handler's coroutine frame. The list does not own or allocate
+// anything.
+//
+//     struct Subscriber : common::IntrusiveList<Subscriber>::Node {
+//         explicit Subscriber(common::IntrusiveList<Subscriber>& list)
+//         : Node(list) {}
+//         ...
+//     };
+//
+//     common::IntrusiveList<Subscriber> subscribers;
+//     ...
+//     for (const Subscriber& subscriber : subscribers) {
+//         ...
+//     }
+
+#include <cstddef>
+
+namespace common {
+
+template <typename T>
+class IntrusiveList {
+ public:
+    class Node;
+    class Iterator;
+
+ private:
+    Node *head = nullptr;
+    std::size_t count = 0;
+
+ public:
+    IntrusiveList() = default;
+    IntrusiveList(const IntrusiveList&) = delete;
+
+    Iterator begin() const { return Iterator(head); }
+    Iterator end() const { return Iterator(nullptr); }
+    std::size_t size() const { return count; }
+};
+
+template <typename T>
+class IntrusiveList<T>::Node {
+    friend class IntrusiveList;
+
+    IntrusiveList& owner;
+    Node *prev = nullptr;
+    Node *next;
+
+ public:
+    explicit Node(IntrusiveList& owner)
+    : owner(owner)
+    , next(owner.head) {
+        if (next) {
+            next->prev = this;
+        }
+        owner.head = this;
+        ++owner.count;
+    }
+
+    Node(const Node&) = delete;
+
+    ~Node() {
+        if (prev) {
+            prev->next = next;
+        } else {
+            owner.head = next;
+        }
+        if (next) {
+            next->prev = prev;
+        }
+        --owner.count;
+    }
+};
+
+template <typename T>
+class IntrusiveList<T>::Iterator {
+    friend class IntrusiveList;
+
+    Node *node;
+
+    explicit Iterator(Node *node)
+    : node(node) {}
+
+ public:
+    T& operator*() const { return static_cast<T&>(*node); }
+    T *operator->() const { return static_cast<T*>(node); }
+
+    Iterator& operator++() {
+        node = node->next;
+        return *this;
+    }
+
+    bool operator==(const Iterator&) const = default;
+};
+
+} // namespace common
@@ -0,0 +1,118 @@
+#pragma once
+
+// This component helps servers expose metrics in the Prometheus text format
+// (version 0.0.4). An application's metrics are a `Format` whose format string
+// contains the "# HELP" and "# TYPE" lines and the metric names, so that all
+// of that text is a constant, and only the values are rendered per scrape:
+//
+//     constexpr char sensor_metrics_format[] =
+//         COMMON_METRIC_FAMILY("co2_ppm", "gauge", "CO2 concentration.")
+//         "co2_ppm %hu\n";
+//     using SensorMetrics = common::Format<sensor_metrics_format,
+//         common::Decimal<uint16_t>>;
+//
+//     constexpr std::size_t max_metrics_body_length =
+//         SensorMetrics::max_length + common::ServerMetrics::max_length;
+//     using MetricsHeader = common::MetricsResponseHeader<max_metrics_body_length>;
+//
+//     char *const body = buffer.data();
+//     int body_length = SensorMetrics::write(body, latest.co2_ppm);
+//     body_length += common::write_server_metrics(body + body_length,
+//         admission(), idle_timeout(), get_free_heap(), uptime_seconds);
+//     const int header_length = common::insert_length_prefix<MetricsHeader>(body, body_length);
+//
+// `write_server_metrics` writes the metrics that every server here has: its
+// connections (see <common/admission.h>), its timeouts (see
+// <common/idle_timeout.h>), its free heap, and its uptime.
+
+#include <common/admission.h>
+#include <common/format.h>
+#include <common/idle_timeout.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// the "# HELP" and "# TYPE" lines for the metric family having the specified
+// `name`, `type`, and `help`, all of which must be string literals
+#define COMMON_METRIC_FAMILY(name, type, help) \
+    "# HELP " name " " help "\n" \
+    "# TYPE " name " " type "\n"
+
+namespace common {
+
+constexpr char metrics_response_header_format[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Content-Length: %d\r\n"
+    "\r\n";
+
+// the header of a metrics response whose body is at most `max_body_length`
+template <std::size_t max_body_length>
+using MetricsResponseHeader = Format<metrics_response_header_format,
+    Decimal<int, 0, int(max_body_length)>>;
+
+constexpr char server_metrics_format[] =
+    COMMON_METRIC_FAMILY("http_connections", "gauge",
+        "Connections being handled.")
+    "http_connections %u\n"
+    COMMON_METRIC_FAMILY("http_connections_refusing", "gauge",
+        "Connections being refused with a 503 response.")
+    "http_connections_refusing %u\n"
+    COMMON_METRIC_FAMILY("http_connections_total", "counter",
+        "Connections accepted, by whether they were handled, refused, or dropped.")
+    "http_connections_total{admission=\"admitted\"} %u\n"
+    "http_connections_total{admission=\"refused\"} %u\n"
+    "http_connections_total{admission=\"dropped\"} %u\n"
+    COMMON_METRIC_FAMILY("http_connection_timeouts_total", "counter",
+        "Connections closed for taking too long, by what they were waiting for.")
+    "http_connection_timeouts_total{phase=\"idle\"} %u\n"
+    "http_connection_timeouts_total{phase=\"headers\"} %u\n"
+    "http_connection_timeouts_total{phase=\"body\"} %u\n"
+    "http_connection_timeouts_total{phase=\"write\"} %u\n"
+    COMMON_METRIC_FAMILY("heap_free_bytes", "gauge",
+        "Heap not in use.")
+    "heap_free_bytes %u\n"
+    COMMON_METRIC_FAMILY("uptime_seconds", "gauge",
+        "Time since boot.")
+    "uptime_seconds %u\n";
+
+using ServerMetrics = Format<server_metrics_format,
+    Decimal<std::size_t>,
+    Decimal<std::size_t>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<unsigned>,
+    Decimal<uint32_t>,
+    Decimal<uint32_t>>;
+
+// Write `ServerMetrics` for the specified `admission` and `timeouts`, and the
+// specified `free_heap` and `uptime_seconds`, to the specified `output`, which
+// must have room for `ServerMetrics::max_length + 1` characters. Return the
+// length of the text.
+inline
+int write_server_metrics(
+    char *output,
+    const AdmissionControl& admission,
+    const IdleTimeout& timeouts,
+    uint32_t free_heap,
+    uint32_t uptime_seconds) {
+    return ServerMetrics::write(output,
+        admission.connections(),
+        admission.refusals(),
+        admission.admitted(),
+        admission.refused(),
+        admission.dropped(),
+        timeouts.timeouts(IdleTimeout::IDLE),
+        timeouts.timeouts(IdleTimeout::HEADERS),
+        timeouts.timeouts(IdleTimeout::BODY),
+        timeouts.timeouts(IdleTimeout::WRITE),
+        free_heap,
+        uptime_seconds);
+}
+
+} // namespace common
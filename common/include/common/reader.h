@@ -0,0 +1,77 @@
+#pragma once
+
+// `Reader<Parser, capacity>` receives bytes from a connection into a buffer of
+// the specified `capacity` and feeds them to an incremental `Parser`, such as
+// `RequestParser` in <common/http.h>. The capacity limits only how much is
+// received at a time, not how large a parsed message can be.
+//
+//     while (!reader.next()) {
+//         auto [count, err] = co_await conn.recv(reader.free_space(), reader.free_size());
+//         if (err) {
+//             co_return;
+//         }
+//         reader.received(count);
+//     }
+//     ... use reader.parser() ...
+//
+// `Parser` must have:
+//
+// - `std::size_t parse(std::string_view input)`, which consumes as much of
+//   `input` as belongs to the current message and returns how much that was,
+// - `status()`, which returns `Parser::INCOMPLETE` until the current message
+//   has been parsed (or found to be malformed), and
+// - `reset()`, which prepares to parse the next message.
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+namespace common {
+
+template <typename Parser, std::size_t capacity>
+class Reader {
+    char buffer[capacity];
+    // Bytes in `[begin, end)` have been received but not yet parsed.
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    Parser state;
+
+ public:
+    // Parse received bytes. Return `true` if a message has been completely
+    // received or was found to be malformed (see `status()`), or return
+    // `false` if more bytes need to be received (see `free_space()`).
+    // Whatever was parsed before the previous call to `next()` is discarded.
+    bool next() {
+        if (state.status() != Parser::INCOMPLETE) {
+            state.reset();
+        }
+        begin += state.parse(std::string_view(buffer + begin, end - begin));
+        return state.status() != Parser::INCOMPLETE;
+    }
+
+    auto status() const { return state.status(); }
+
+    const Parser& parser() const { return state; }
+
+    // Return where to receive more bytes.
+    char *free_space() {
+        if (begin) {
+            std::memmove(buffer, buffer + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        return buffer + end;
+    }
+
+    // Return the number of bytes that may be written to `free_space()`.
+    int free_size() const {
+        return int(capacity - (end - begin));
+    }
+
+    // Note that the specified `count` bytes were written to `free_space()`.
+    void received(int count) {
+        end += count;
+    }
+};
+
+} // namespace common
@@ -0,0 +1,81 @@
+#pragma once
+
+// `RenderCache` formats text derived from a sequence-numbered value at most
+// once, and then shares the formatted text among every client that sends it.
+//
+// For example, when a dozen clients are subscribed to a stream of
+// measurements, each published measurement is formatted by whichever client
+// gets to it first, and the other eleven send the same buffer:
+//
+//     common::RenderCache<max_chunk_length + 1> chunks;
+//     ...
+//     Measurement next = co_await broadcaster().next();
+//     auto chunk = chunks.get(next.sequence_number, [&](auto& buffer) {
+//         return format_response_chunk(buffer, next);
+//     });
+//     co_await conn.send(chunk->text());
+//
+// The text is reference counted, so it remains valid for as long as a client
+// holds on to it (e.g. across `co_await conn.send(...)`), even if the cache has
+// since moved on to a newer sequence number.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+namespace common {
+
+template <std::size_t capacity>
+struct Rendered {
+    unsigned sequence_number = 0;
+    std::size_t length = 0;
+    std::array<char, capacity> buffer;
+
+    std::string_view text() const {
+        return std::string_view(buffer.data(), length);
+    }
+};
+
+template <std::size_t capacity>
+class RenderCache {
+    std::shared_ptr<const Rendered<capacity>> latest;
+    unsigned render_count = 0;
+
+ public:
+    // Return the text associated with the specified `sequence_number`. If the
+    // text is not already cached, then produce it by calling the specified
+    // `render` with a `std::array<char, capacity>&` to fill. `render` returns
+    // the length of the text, as `snprintf` does. Text for a sequence number
+    // older than the cached one is rendered but not cached, so that a client
+    // lagging behind does not evict the text that the others are sending.
+    template <typename Render>
+    std::shared_ptr<const Rendered<capacity>> get(unsigned sequence_number, Render&& render);
+
+    // Return the number of times that `get` has had to render text.
+    unsigned renders() const { return render_count; }
+};
+
+template <std::size_t capacity>
+template <typename Render>
+std::shared_ptr<const Rendered<capacity>> RenderCache<capacity>::get(unsigned sequence_number, Render&& render) {
+    if (latest && latest->sequence_number == sequence_number) {
+        return latest;
+    }
+
+    auto rendered = std::make_shared<Rendered<capacity>>();
+    rendered->sequence_number = sequence_number;
+    const int rc = render(rendered->buffer);
+    // `snprintf` returns the length that the text would have had, had the
+    // buffer been large enough. Don't send beyond the end of the buffer.
+    rendered->length = rc < 0 ? 0 : std::min(std::size_t(rc), capacity - 1);
+    ++render_count;
+
+    if (!latest || sequence_number > latest->sequence_number) {
+        latest = rendered;
+    }
+    return rendered;
+}
+
+} // namespace common
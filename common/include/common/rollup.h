@@ -0,0 +1,186 @@
+#pragma once
+
+// `Rollup` summarizes readings, such as CO2 concentration and temperature,
+// over windows of a minute, five minutes, and an hour, so that a dashboard
+// can ask for the minimum, maximum, and mean over the last hours or days
+// without fetching every reading. Each window has, for each channel, the
+// minimum, maximum, and sum of its readings, and the number of readings:
+//
+//     // CO2 in ppm and temperature in centicelsius, keeping 60 one-minute
+//     // windows, 72 five-minute windows, and 48 hour windows
+//     using SensorRollup = common::Rollup<2, 60, 72, 48>;
+//     SensorRollup rollup;
+//
+//     rollup.add(time_seconds, {co2_ppm, centicelsius});
+//     ...
+//     std::array<SensorRollup::Window, 8> windows;
+//     const std::size_t count =
+//         rollup.copy(common::RollupResolution::HOUR, since_seconds, windows);
+//
+// A reading is added to the window in progress at each resolution, which
+// takes a few comparisons and additions per channel, whatever the number of
+// windows. Windows begin at multiples of their width in time, and a window
+// begins when the first reading in it is added, replacing the oldest window
+// at that resolution if they're all in use. Windows without readings aren't
+// kept. The window in progress is copied like any other, so it's always
+// current.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace common {
+
+enum class RollupResolution {
+    MINUTE,
+    FIVE_MINUTES,
+    HOUR
+};
+
+constexpr std::uint32_t rollup_width_seconds(RollupResolution resolution) {
+    switch (resolution) {
+    case RollupResolution::MINUTE: return 60;
+    case RollupResolution::FIVE_MINUTES: return 5 * 60;
+    case RollupResolution::HOUR: return 60 * 60;
+    }
+    return 0;
+}
+
+// Return the resolution whose windows are the specified number of `minutes`
+// wide, or `std::nullopt` if there isn't one.
+constexpr std::optional<RollupResolution> rollup_resolution(unsigned minutes) {
+    switch (minutes) {
+    case 1: return RollupResolution::MINUTE;
+    case 5: return RollupResolution::FIVE_MINUTES;
+    case 60: return RollupResolution::HOUR;
+    }
+    return std::nullopt;
+}
+
+template <std::size_t channel_count>
+struct RollupWindow {
+    using Values = std::array<std::int32_t, channel_count>;
+
+    // in the same units as the times passed to `Rollup::add`
+    std::uint32_t start = 0;
+    std::uint32_t count = 0;
+    Values min{};
+    Values max{};
+    std::array<std::int64_t, channel_count> sum{};
+
+    void add(const Values& values) {
+        for (std::size_t channel = 0; channel < channel_count; ++channel) {
+            const std::int32_t value = values[channel];
+            if (count == 0 || value < min[channel]) {
+                min[channel] = value;
+            }
+            if (count == 0 || value > max[channel]) {
+                max[channel] = value;
+            }
+            sum[channel] += value;
+        }
+        ++count;
+    }
+
+    // Return the mean of the specified `channel`, rounded to the nearest. The
+    // window must have readings.
+    std::int32_t mean(std::size_t channel) const {
+        const std::int64_t half = count / 2;
+        const std::int64_t total = sum[channel];
+        return std::int32_t((total + (total < 0 ? -half : half)) / std::int64_t(count));
+    }
+};
+
+// `RollupLevel` is the windows of one width, in a ring whose newest window is
+// the one in progress.
+template <std::size_t channel_count, std::size_t capacity>
+class RollupLevel {
+    static_assert(capacity > 0);
+
+ public:
+    using Window = RollupWindow<channel_count>;
+
+ private:
+    const std::uint32_t width;
+    std::array<Window, capacity> windows;
+    // the number of windows ever begun
+    std::uint32_t begun = 0;
+
+ public:
+    explicit RollupLevel(std::uint32_t width)
+    : width(width) {}
+
+    void add(std::uint32_t time, const typename Window::Values& values);
+
+    std::size_t size() const { return begun < capacity ? begun : capacity; }
+
+    // Copy as many as fit in the specified `output` of the windows that
+    // begin at or after the specified `since`, oldest first. Return how many
+    // were copied.
+    std::size_t copy(std::uint32_t since, std::span<Window> output) const;
+};
+
+template <std::size_t channel_count, std::size_t capacity>
+void RollupLevel<channel_count, capacity>::add(std::uint32_t time, const typename Window::Values& values) {
+    const std::uint32_t start = time - time % width;
+    // A reading from before the window in progress, if the clock went back,
+    // is counted in it.
+    if (begun == 0 || start > windows[(begun - 1) % capacity].start) {
+        Window& fresh = windows[begun % capacity];
+        fresh = Window();
+        fresh.start = start;
+        ++begun;
+    }
+    windows[(begun - 1) % capacity].add(values);
+}
+
+template <std::size_t channel_count, std::size_t capacity>
+std::size_t RollupLevel<channel_count, capacity>::copy(std::uint32_t since, std::span<Window> output) const {
+    std::size_t copied = 0;
+    for (std::uint32_t number = begun - size(); number != begun && copied < output.size(); ++number) {
+        const Window& window = windows[number % capacity];
+        if (window.start >= since) {
+            output[copied++] = window;
+        }
+    }
+    return copied;
+}
+
+template <std::size_t channel_count, std::size_t minutes, std::size_t five_minutes, std::size_t hours>
+class Rollup {
+ public:
+    using Window = RollupWindow<channel_count>;
+    using Values = typename Window::Values;
+
+ private:
+    RollupLevel<channel_count, minutes> by_minute{rollup_width_seconds(RollupResolution::MINUTE)};
+    RollupLevel<channel_count, five_minutes> by_five_minutes{rollup_width_seconds(RollupResolution::FIVE_MINUTES)};
+    RollupLevel<channel_count, hours> by_hour{rollup_width_seconds(RollupResolution::HOUR)};
+
+ public:
+    Rollup() = default;
+    Rollup(const Rollup&) = delete;
+
+    // Add the specified `values`, read at the specified `time` in seconds.
+    void add(std::uint32_t time, const Values& values) {
+        by_minute.add(time, values);
+        by_five_minutes.add(time, values);
+        by_hour.add(time, values);
+    }
+
+    // Copy as many as fit in the specified `output` of the windows at the
+    // specified `resolution` that begin at or after the specified `since`,
+    // oldest first. Return how many were copied.
+    std::size_t copy(RollupResolution resolution, std::uint32_t since, std::span<Window> output) const {
+        switch (resolution) {
+        case RollupResolution::MINUTE: return by_minute.copy(since, output);
+        case RollupResolution::FIVE_MINUTES: return by_five_minutes.copy(since, output);
+        case RollupResolution::HOUR: return by_hour.copy(since, output);
+        }
+        return 0;
+    }
+};
+
+} // namespace common
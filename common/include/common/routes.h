@@ -0,0 +1,171 @@
+#pragma once
+
+// `RouteTable` maps a request's method and path to an application-defined
+// endpoint. The table is built at compile time, and includes a perfect hash
+// of its paths, so that a lookup hashes the path once and then compares it
+// against at most the routes sharing that path, regardless of how many
+// routes there are.
+//
+//     enum class Endpoint { LATEST, MEASUREMENTS };
+//
+//     constexpr auto routes = common::make_route_table<Endpoint>({
+//         {"GET", "/latest", Endpoint::LATEST},
+//         {"GET", "/measurements", Endpoint::MEASUREMENTS}});
+//
+//     const auto match = routes.find(request.method.view(), request.path.view());
+//     switch (match.status) {
+//     case common::RouteStatus::FOUND:
+//         switch (match.endpoint) { ... }
+//     case common::RouteStatus::NOT_FOUND: ...
+//     case common::RouteStatus::METHOD_NOT_ALLOWED: ...
+//     }
+//
+// Endpoints are values, typically of an `enum`, rather than handler
+// functions, so that an application's connection handler can respond inline
+// without allocating a coroutine frame per request.
+//
+// Paths are matched exactly. Query strings are not part of the path (see
+// `Request::query` in <common/http.h>).
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace common {
+
+template <typename Endpoint>
+struct Route {
+    std::string_view method;
+    std::string_view path;
+    Endpoint endpoint;
+};
+
+enum class RouteStatus {
+    FOUND,
+    NOT_FOUND,
+    METHOD_NOT_ALLOWED
+};
+
+template <typename Endpoint>
+struct RouteMatch {
+    RouteStatus status;
+    // meaningful only if `status == RouteStatus::FOUND`
+    Endpoint endpoint;
+};
+
+// These functions are deliberately not `constexpr`. Calling one during
+// constant evaluation makes the enclosing expression ill-formed, which is how
+// `make_route_table` reports a bad table at compile time.
+void route_table_has_duplicate_routes();
+void route_table_has_no_perfect_hash();
+
+// Return the FNV-1a hash of the specified `text`, perturbed by `seed`.
+constexpr std::uint32_t route_hash(std::string_view text, std::uint32_t seed) {
+    std::uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (const char ch : text) {
+        hash = (hash ^ std::uint8_t(ch)) * 16777619u;
+    }
+    // The low bits of an FNV-1a hash depend only on the low bits of its
+    // inputs, and slots are chosen by the low bits, so fold the high bits in.
+    // Otherwise only a few seeds would actually differ.
+    return hash ^ (hash >> 16);
+}
+
+template <typename Endpoint, std::size_t route_count>
+class RouteTable {
+    static_assert(route_count > 0 && route_count < 255);
+
+    // Twice as many slots as routes, so that a perfect hash is easy to find.
+    static constexpr std::size_t slot_count = std::bit_ceil(2 * route_count);
+
+    // `routes` is sorted by path, so routes that differ only in their method
+    // are adjacent.
+    std::array<Route<Endpoint>, route_count> routes{};
+    // `slots[route_hash(path, seed) % slot_count]` is one more than the index
+    // in `routes` of the first route having `path`, or zero if there is none.
+    std::array<std::uint8_t, slot_count> slots{};
+    std::uint32_t seed = 0;
+
+    constexpr std::size_t slot_of(std::string_view path, std::uint32_t seed) const {
+        return route_hash(path, seed) & (slot_count - 1);
+    }
+
+    // Return whether `candidate` hashes each distinct path to a distinct
+    // slot, and if so, fill `slots` accordingly.
+    constexpr bool try_seed(std::uint32_t candidate) {
+        std::array<std::uint8_t, slot_count> trial{};
+        for (std::size_t i = 0; i < route_count; ++i) {
+            if (i && routes[i].path == routes[i - 1].path) {
+                continue;
+            }
+            std::uint8_t& slot = trial[slot_of(routes[i].path, candidate)];
+            if (slot) {
+                return false;
+            }
+            slot = std::uint8_t(i + 1);
+        }
+        slots = trial;
+        seed = candidate;
+        return true;
+    }
+
+ public:
+    consteval explicit RouteTable(const Route<Endpoint> (&table)[route_count]) {
+        std::copy(table, table + route_count, routes.begin());
+        std::sort(routes.begin(), routes.end(), [](const auto& left, const auto& right) {
+            return left.path < right.path || (left.path == right.path && left.method < right.method);
+        });
+        for (std::size_t i = 1; i < route_count; ++i) {
+            if (routes[i].path == routes[i - 1].path && routes[i].method == routes[i - 1].method) {
+                route_table_has_duplicate_routes();
+            }
+        }
+        for (std::uint32_t candidate = 0; !try_seed(candidate); ++candidate) {
+            if (candidate == 10'000) {
+                route_table_has_no_perfect_hash();
+            }
+        }
+    }
+
+    // Return the endpoint of the route having the specified `method` and
+    // `path`. If there is no such route, return whether a route has `path`
+    // with a different method.
+    constexpr RouteMatch<Endpoint> find(std::string_view method, std::string_view path) const {
+        std::size_t index = slots[slot_of(path, seed)];
+        if (index == 0 || routes[--index].path != path) {
+            return {RouteStatus::NOT_FOUND, Endpoint{}};
+        }
+        for (; index < route_count && routes[index].path == path; ++index) {
+            if (routes[index].method == method) {
+                return {RouteStatus::FOUND, routes[index].endpoint};
+            }
+        }
+        return {RouteStatus::METHOD_NOT_ALLOWED, Endpoint{}};
+    }
+};
+
+// Return a `RouteTable` of the specified `routes`. Compilation fails if two
+// routes have the same method and path.
+template <typename Endpoint, std::size_t route_count>
+consteval RouteTable<Endpoint, route_count> make_route_table(const Route<Endpoint> (&routes)[route_count]) {
+    return RouteTable<Endpoint, route_count>(routes);
+}
+
+// Complete responses for requests that don't match any route. They have no
+// body, so they are safe to send on a persistent connection.
+constexpr std::string_view not_found_response =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+// for servers whose routes all use GET
+constexpr std::string_view get_only_response =
+    "HTTP/1.1 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+} // namespace common
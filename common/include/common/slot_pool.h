@@ -0,0 +1,97 @@
+#pragma once
+
+// `SlotPool<T, capacity>` holds up to `capacity` objects of type `T` in
+// storage reserved at compile time, for servers whose per-connection state
+// would otherwise be allocated with `new` and freed with `delete` for each
+// connection. Over months of uptime, that churn can fragment the heap, and a
+// server has no way to tell when it's about to run out. With a pool, a new
+// connection either gets a slot or is refused:
+//
+//     common::SlotPool<Client, max_clients> clients;
+//     ...
+//     Client *client = clients.acquire(constructor arguments...);
+//     if (!client) {
+//         // The pool is exhausted. Refuse the connection.
+//     }
+//     ...
+//     clients.release(client);
+//
+// Free slots are kept in a singly linked list threaded through the slots
+// themselves, so that `acquire` and `release` take constant time and the pool
+// needs no memory beyond the slots. The pool also counts how often it was
+// exhausted, and the most slots ever in use at once.
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace common {
+
+template <typename T, std::size_t capacity>
+class SlotPool {
+    static_assert(capacity > 0);
+
+    union Slot {
+        Slot *next_free;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::array<Slot, capacity> slots;
+    Slot *free_list = slots.data();
+    std::size_t in_use = 0;
+    std::size_t most_in_use = 0;
+    unsigned exhausted_total = 0;
+
+ public:
+    SlotPool() {
+        for (std::size_t i = 0; i + 1 < capacity; ++i) {
+            slots[i].next_free = &slots[i + 1];
+        }
+        slots[capacity - 1].next_free = nullptr;
+    }
+
+    SlotPool(const SlotPool&) = delete;
+
+    // Construct a `T` from the specified `args` in a free slot, and return a
+    // pointer to it. If there is no free slot, return null instead.
+    template <typename... Args>
+    T *acquire(Args&&... args);
+
+    // Destroy the specified `object`, which was returned by `acquire`, and
+    // free its slot.
+    void release(T *object);
+
+    // the number of slots in use
+    std::size_t size() const { return in_use; }
+    // the most slots that have been in use at once
+    std::size_t high_water_mark() const { return most_in_use; }
+    // the number of times that `acquire` found no free slot
+    unsigned exhausted() const { return exhausted_total; }
+};
+
+template <typename T, std::size_t capacity>
+template <typename... Args>
+T *SlotPool<T, capacity>::acquire(Args&&... args) {
+    if (!free_list) {
+        ++exhausted_total;
+        return nullptr;
+    }
+    Slot *const slot = free_list;
+    free_list = slot->next_free;
+    if (++in_use > most_in_use) {
+        most_in_use = in_use;
+    }
+    return new (slot->storage) T(std::forward<Args>(args)...);
+}
+
+template <typename T, std::size_t capacity>
+void SlotPool<T, capacity>::release(T *object) {
+    object->~T();
+    Slot *const slot = reinterpret_cast<Slot*>(object);
+    slot->next_free = free_list;
+    free_list = slot;
+    --in_use;
+}
+
+} // namespace common
@@ -0,0 +1,414 @@
+#pragma once
+
+// This component implements the server side of the WebSocket protocol
+// (RFC 6455) on top of <common/http.h>:
+//
+// - `is_websocket_upgrade` checks whether a request asks to switch to the
+//   WebSocket protocol, and `write_websocket_handshake` writes the "101
+//   Switching Protocols" response that does so.
+// - `write_websocket_frame_header` writes the header of a frame sent by the
+//   server. Server frames are not masked, so the payload follows as is.
+// - `WebSocketFrameParser` parses, incrementally, the masked frames sent by
+//   the client. It unmasks and keeps the payload of control frames (ping,
+//   pong, close), and skips the payload of data frames.
+//
+//     common::WebSocketReader<128> frames;
+//     while (!frames.next()) {
+//         auto [count, err] = co_await conn.recv(frames.free_space(), frames.free_size());
+//         ...
+//         frames.received(count);
+//     }
+//     const common::WebSocketFrameParser& frame = frames.parser();
+//     if (frame.opcode() == common::WebSocketOpcode::PING) {
+//         ... send a PONG frame with `frame.payload()` ...
+//     }
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <common/http.h>
+#include <common/reader.h>
+
+namespace common {
+
+// `Sha1` computes the SHA-1 digest of a message given in pieces. It's here
+// only because the WebSocket handshake requires it.
+class Sha1 {
+    std::uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::uint8_t block[64];
+    std::size_t block_length = 0;
+    std::uint64_t message_length = 0;
+
+    static std::uint32_t rotate_left(std::uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    void process_block();
+
+ public:
+    void update(std::string_view data);
+
+    // Return the digest of everything passed to `update`. Afterward, this
+    // object is no longer usable.
+    std::array<std::uint8_t, 20> finish();
+};
+
+inline
+void Sha1::process_block() {
+    std::uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = std::uint32_t(block[4 * i]) << 24 | std::uint32_t(block[4 * i + 1]) << 16 |
+               std::uint32_t(block[4 * i + 2]) << 8 | std::uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+        std::uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        const std::uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotate_left(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+inline
+void Sha1::update(std::string_view data) {
+    message_length += data.size();
+    for (const char ch : data) {
+        block[block_length++] = std::uint8_t(ch);
+        if (block_length == sizeof block) {
+            process_block();
+            block_length = 0;
+        }
+    }
+}
+
+inline
+std::array<std::uint8_t, 20> Sha1::finish() {
+    const std::uint64_t bit_length = message_length * 8;
+    block[block_length++] = 0x80;
+    if (block_length > 56) {
+        std::memset(block + block_length, 0, sizeof block - block_length);
+        process_block();
+        block_length = 0;
+    }
+    std::memset(block + block_length, 0, 56 - block_length);
+    for (int i = 0; i < 8; ++i) {
+        block[56 + i] = std::uint8_t(bit_length >> (56 - 8 * i));
+    }
+    process_block();
+
+    std::array<std::uint8_t, 20> digest;
+    for (int i = 0; i < 20; ++i) {
+        digest[i] = std::uint8_t(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return digest;
+}
+
+// Write the base64 encoding of the specified `size` bytes at `data` to the
+// specified `output`, which must have room for `(size + 2) / 3 * 4`
+// characters. Return the length of the encoding.
+inline int base64_encode(const std::uint8_t *data, std::size_t size, char *output) {
+    constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *const begin = output;
+    for (std::size_t i = 0; i < size; i += 3) {
+        const std::uint32_t group = std::uint32_t(data[i]) << 16 |
+            (i + 1 < size ? std::uint32_t(data[i + 1]) << 8 : 0) |
+            (i + 2 < size ? std::uint32_t(data[i + 2]) : 0);
+        *output++ = alphabet[group >> 18 & 0x3F];
+        *output++ = alphabet[group >> 12 & 0x3F];
+        *output++ = i + 1 < size ? alphabet[group >> 6 & 0x3F] : '=';
+        *output++ = i + 2 < size ? alphabet[group & 0x3F] : '=';
+    }
+    return output - begin;
+}
+
+// Return whether the specified `request` asks to switch to the WebSocket
+// protocol, with a handshake that this component supports.
+inline bool is_websocket_upgrade(const Request& request) {
+    return request.method.view() == "GET" &&
+        request.minor_version == 1 &&
+        has_token(request.upgrade.view(), "websocket") &&
+        has_token(request.connection.view(), "Upgrade") &&
+        request.sec_websocket_version.view() == "13" &&
+        // the base64 encoding of 16 bytes
+        request.sec_websocket_key.view().size() == 24;
+}
+
+// A complete response to a request for a WebSocket endpoint that is not a
+// supported WebSocket handshake.
+constexpr std::string_view websocket_upgrade_required_response =
+    "HTTP/1.1 426 Upgrade Required\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+constexpr std::string_view websocket_handshake_prefix =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: ";
+
+constexpr std::string_view websocket_handshake_suffix =
+    "\r\n"
+    "\r\n";
+
+// base64 of a SHA-1 digest
+constexpr std::size_t websocket_accept_length = 28;
+
+constexpr std::size_t websocket_handshake_length =
+    websocket_handshake_prefix.size() + websocket_accept_length + websocket_handshake_suffix.size();
+
+// Write to the specified `output` the response that accepts the specified
+// WebSocket upgrade `request` (see `is_websocket_upgrade`). Return the length
+// of the response.
+inline int write_websocket_handshake(char (&output)[websocket_handshake_length], const Request& request) {
+    Sha1 sha1;
+    sha1.update(request.sec_websocket_key.view());
+    sha1.update("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    const auto digest = sha1.finish();
+
+    char *position = output;
+    std::memcpy(position, websocket_handshake_prefix.data(), websocket_handshake_prefix.size());
+    position += websocket_handshake_prefix.size();
+    position += base64_encode(digest.data(), digest.size(), position);
+    std::memcpy(position, websocket_handshake_suffix.data(), websocket_handshake_suffix.size());
+    position += websocket_handshake_suffix.size();
+    return position - output;
+}
+
+enum class WebSocketOpcode : std::uint8_t {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA
+};
+
+// Control frames' payloads are at most this long.
+constexpr std::size_t max_websocket_control_payload = 125;
+
+// A frame header is at most this long (server frames are not masked).
+constexpr std::size_t max_websocket_frame_header_length = 10;
+
+// Write to the specified `output` the header of an unfragmented, unmasked
+// frame having the specified `opcode` and `payload_length`. Return the length
+// of the header.
+inline int write_websocket_frame_header(char *output, WebSocketOpcode opcode, std::uint64_t payload_length) {
+    output[0] = char(0x80 | std::uint8_t(opcode));
+    if (payload_length < 126) {
+        output[1] = char(payload_length);
+        return 2;
+    }
+    if (payload_length < 65536) {
+        output[1] = char(126);
+        output[2] = char(payload_length >> 8);
+        output[3] = char(payload_length);
+        return 4;
+    }
+    output[1] = char(127);
+    for (int i = 0; i < 8; ++i) {
+        output[2 + i] = char(payload_length >> (56 - 8 * i));
+    }
+    return 10;
+}
+
+class WebSocketFrameParser {
+ public:
+    enum Status {
+        INCOMPLETE,
+        COMPLETE,
+        PROTOCOL_ERROR
+    };
+
+ private:
+    enum State {
+        FIRST_BYTE,
+        SECOND_BYTE,
+        EXTENDED_LENGTH,
+        MASKING_KEY,
+        PAYLOAD,
+        DONE
+    };
+
+    Status current_status = INCOMPLETE;
+    State state = FIRST_BYTE;
+    WebSocketOpcode op = WebSocketOpcode::CONTINUATION;
+    bool final = false;
+    int extended_length_bytes = 0;
+    std::uint64_t payload_length = 0;
+    std::uint64_t payload_received = 0;
+    std::uint8_t mask[4];
+    int mask_bytes = 0;
+    std::array<char, max_websocket_control_payload> control_payload;
+
+    bool is_control() const { return std::uint8_t(op) & 0x8; }
+
+    Status fail() {
+        state = DONE;
+        return current_status = PROTOCOL_ERROR;
+    }
+
+    Status finish() {
+        state = DONE;
+        return current_status = COMPLETE;
+    }
+
+    Status begin_payload() {
+        if (payload_length == 0) {
+            return finish();
+        }
+        state = PAYLOAD;
+        return current_status;
+    }
+
+    Status consume(std::uint8_t byte);
+
+ public:
+    // Parse as much of the specified `input` as belongs to the current frame.
+    // Return the number of bytes consumed.
+    std::size_t parse(std::string_view input);
+
+    Status status() const { return current_status; }
+
+    WebSocketOpcode opcode() const { return op; }
+
+    // Return whether this frame is the last of its message.
+    bool fin() const { return final; }
+
+    // Return the unmasked payload of a control frame. Data frames' payloads
+    // are skipped, and so this returns an empty string for them.
+    std::string_view payload() const {
+        return is_control() ? std::string_view(control_payload.data(), payload_length) : std::string_view();
+    }
+
+    // Prepare to parse the next frame.
+    void reset() { *this = WebSocketFrameParser(); }
+};
+
+inline
+WebSocketFrameParser::Status WebSocketFrameParser::consume(std::uint8_t byte) {
+    switch (state) {
+    case FIRST_BYTE:
+        final = byte & 0x80;
+        if (byte & 0x70) {
+            // We didn't negotiate any extensions, so the reserved bits must be
+            // zero.
+            return fail();
+        }
+        op = WebSocketOpcode(byte & 0x0F);
+        switch (op) {
+        case WebSocketOpcode::CONTINUATION:
+        case WebSocketOpcode::TEXT:
+        case WebSocketOpcode::BINARY:
+        case WebSocketOpcode::CLOSE:
+        case WebSocketOpcode::PING:
+        case WebSocketOpcode::PONG:
+            break;
+        default:
+            return fail();
+        }
+        state = SECOND_BYTE;
+        break;
+    case SECOND_BYTE:
+        if (!(byte & 0x80)) {
+            // Clients must mask their frames.
+            return fail();
+        }
+        payload_length = byte & 0x7F;
+        if (is_control() && (!final || payload_length > max_websocket_control_payload)) {
+            return fail();
+        }
+        if (payload_length == 126 || payload_length == 127) {
+            extended_length_bytes = payload_length == 126 ? 2 : 8;
+            payload_length = 0;
+            state = EXTENDED_LENGTH;
+        } else {
+            state = MASKING_KEY;
+        }
+        break;
+    case EXTENDED_LENGTH:
+        payload_length = payload_length << 8 | byte;
+        if (--extended_length_bytes == 0) {
+            if (payload_length >> 63) {
+                return fail();
+            }
+            state = MASKING_KEY;
+        }
+        break;
+    case MASKING_KEY:
+        mask[mask_bytes++] = byte;
+        if (mask_bytes == 4) {
+            return begin_payload();
+        }
+        break;
+    case PAYLOAD:
+        if (is_control()) {
+            control_payload[payload_received] = char(byte ^ mask[payload_received % 4]);
+        }
+        if (++payload_received == payload_length) {
+            return finish();
+        }
+        break;
+    case DONE:
+        break;
+    }
+    return current_status;
+}
+
+inline
+std::size_t WebSocketFrameParser::parse(std::string_view input) {
+    std::size_t consumed = 0;
+    while (consumed < input.size() && state != DONE) {
+        if (state == PAYLOAD && !is_control()) {
+            // Skip data payloads in bulk, rather than one byte at a time.
+            const std::uint64_t skip = std::min<std::uint64_t>(payload_length - payload_received, input.size() - consumed);
+            payload_received += skip;
+            consumed += skip;
+            if (payload_received == payload_length) {
+                finish();
+            }
+            continue;
+        }
+        consume(std::uint8_t(input[consumed++]));
+    }
+    return consumed;
+}
+
+// `WebSocketReader<capacity>` receives bytes into a buffer of the specified
+// `capacity` and parses them into client frames.
+template <std::size_t capacity>
+using WebSocketReader = Reader<WebSocketFrameParser, capacity>;
+
+} // namespace common
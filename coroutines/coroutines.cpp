@@ -9,24 +9,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <algorithm>
-#include <array>
 #include <chrono>
 #include <cinttypes>
-#include <cmath>
-#include <cmath>
 #include <cstdio>
-#include <iterator>
 
+#include <hardware/regs/addressmap.h>
 #include <hardware/watchdog.h>
-#include <picoro/broadcaster.h>
 #include <picoro/coroutine.h>
 #include <picoro/debug.h>
 #include <picoro/event_loop.h>
 #include <picoro/sleep.h>
-#include <picoro/tcp.h>
 #include <picoro/drivers/sensirion/scd4x.h>
 
+#include "http_server.h"
 #include "secrets.h"
 
 const char *cyw43_describe(int status) {
@@ -58,16 +53,6 @@ const char *pico_describe(int error) {
     return "Unknown Pico error code";
 }
 
-struct Measurement {
-    unsigned sequence_number = 0;
-    uint16_t co2_ppm = 0;
-    int32_t temperature_millicelsius = 0;
-    int32_t relative_humidity_millipercent = 0;
-} latest;
-
-// TODO: Need to recalculate this. For now I fudge it up to 511.
-constexpr std::size_t max_response_length = 511;
-
 uint32_t get_total_heap() {
    extern char __StackLimit, __bss_end__;
    return &__StackLimit  - &__bss_end__;
@@ -78,107 +63,6 @@ uint32_t get_free_heap() {
    return get_total_heap() - m.uordblks;
 }
 
-int format_response(
-    // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer,
-    const Measurement& data) {
-
-    // If we haven't made a measurement yet, respond with an error telling the
-    // client to try again in a few seconds.
-    if (data.sequence_number == 0) {
-        constexpr char response[] =
-            "HTTP/1.1 503 Service Unavailable\r\n"
-            "Connection: close\r\n"
-            "Retry-After: 5\r\n"
-            "\r\n";
-        return std::snprintf(buffer.data(), buffer.size(), "%s", response);
-    }
-
-    constexpr char response_format[] =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: close\r\n"
-        "Content-Type: application/json\r\n"
-        "\r\n"
-        "{\"sequence_number\": %u,"
-        " \"CO2_ppm\": %hu,"
-        " \"temperature_celsius\": %.1f,"
-        " \"relative_humidity_percent\": %.1f,"
-        " \"free_bytes\": %lu}";
-
-    const uint32_t free_bytes = get_free_heap();
-
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
-}
-
-int format_chunked_response_header(
-    // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer) {
-    constexpr char response_format[] =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: keep-alive\r\n"
-        "Content-Type: application/x-ndjson\r\n"
-        "Transfer-Encoding: chunked\r\n"
-        "Cache-Control: no-cache\r\n"
-        "\r\n";
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format);
-}
-
-int format_response_chunk(
-    // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer,
-    const Measurement& data) {
-    #define LENGTH_PREFIX_FORMAT \
-        "%X\r\n"
-    #define CHUNK_FORMAT \
-        "{\"sequence_number\": %u," \
-        " \"CO2_ppm\": %hu," \
-        " \"temperature_celsius\": %.1f," \
-        " \"relative_humidity_percent\": %.1f," \
-        " \"free_bytes\": %lu}" \
-        "\n"
-    constexpr char response_format[] =
-        LENGTH_PREFIX_FORMAT \
-        CHUNK_FORMAT \
-        "\r\n";
-
-    const uint32_t free_bytes = get_free_heap();
-
-    const int chunk_size = std::snprintf(
-        nullptr,
-        0,
-        CHUNK_FORMAT,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
-
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format,
-        chunk_size,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
-
-    #undef CHUNK_FORMAT
-    #undef LENGTH_PREFIX_FORMAT
-}
-
 // Wait for the host to attach to the USB terminal (i.e. ttyACM0).
 // Blink the onboard LED while we're waiting.
 // Give up after the specified number of seconds.
@@ -205,11 +89,6 @@ picoro::Coroutine<bool> data_ready(const picoro::sensirion::SCD4x& sensor) {
     co_return result;
 }
 
-picoro::Broadcaster<Measurement>& broadcaster() {
-    static picoro::Broadcaster<Measurement> instance;
-    return instance;
-}
-
 picoro::Coroutine<void> monitor_scd4x(async_context_t *ctx) {
     // I²C GPIO pins
     const uint sda_pin = 20; // GP20, which is physical pin 26
@@ -282,11 +161,10 @@ picoro::Coroutine<void> monitor_scd4x(async_context_t *ctx) {
             picoro::debug("Unable to read sensor measurement. Error code %d.\n", rc);
         } else {
             std::printf("CO2: %hu ppm\ttemperature: %.1f C\thumidity: %.1f%%\n", co2_ppm, temperature_millicelsius / 1000.0f, relative_humidity_millipercent / 1000.0f);
-            ++latest.sequence_number;
-            latest.co2_ppm = co2_ppm;
-            latest.temperature_millicelsius = temperature_millicelsius;
-            latest.relative_humidity_millipercent = relative_humidity_millipercent;
-            broadcaster().publish(latest);
+            publish({
+                .co2_ppm = co2_ppm,
+                .temperature_millicelsius = temperature_millicelsius,
+                .relative_humidity_millipercent = relative_humidity_millipercent});
         }
     }
 
@@ -362,75 +240,12 @@ picoro::Coroutine<void> wifi_connect(async_context_t *ctx, const char *SSID, con
     picoro::debug("Connected to WiFi.\n");
 }
 
-picoro::Coroutine<void> handle_client(picoro::Connection conn) {
-    picoro::debug("in handle_client(...), about to await recv()\n");
-    char readbuf[2048];
-    auto [count, err] = co_await conn.recv(readbuf, sizeof readbuf);
-    picoro::debug("in handle_client(...), received %d bytes with error %s\n", count, picoro::lwip_describe(err));
-    if (err) {
-      picoro::debug("in handle_client(...), since there was an error, I'm closing the connection and returning.\n");
-      co_return;
-    }
-
-    std::array<char, max_response_length + 1> buffer;
-    picoro::debug("in handle_client(...), about to format response and await send()\n");
-    // GET /measurements
-    //     Stream future measurements as JSON lines in a single chunked response.
-    //
-    // GET /latest
-    // <or anything else>
-    //     Return the most recent measurement immediately and close the connection.
-    if (std::string_view(readbuf, count).starts_with("GET /measurements HTTP/1.1\r\n")) {
-        count = format_chunked_response_header(buffer);
-        std::tie(count, err) = co_await conn.send(std::string_view(buffer.data(), count));
-        if (err) {
-            picoro::debug("Error sending headers: %s\n", picoro::lwip_describe(err));
-            co_return;
-        }
-        for (;;) {
-            Measurement next = co_await broadcaster().next();
-            count = format_response_chunk(buffer, next);
-            picoro::debug("handle_client(...), about to send() a chunk.\n");
-            std::tie(count, err) = co_await conn.send(std::string_view(buffer.data(), count));
-            picoro::debug("handle_client(...), finished send(). Sent %d bytes with error %s.\n", count, picoro::lwip_describe(err));
-            if (err) {
-                picoro::debug("handle_client(...), send() had an error, so finishing handle_client\n");
-                co_return;
-            }
-        }
-    } else {
-        count = format_response(buffer, latest);
-        std::tie(count, err) = co_await conn.send(std::string_view(buffer.data(), count));
-        picoro::debug("handle_client(...), finished send(). Sent %d bytes with error %s. About to close and return.\n", count, picoro::lwip_describe(err));
-    }
-}
-
-picoro::Coroutine<void> http_server(int port, int listen_backlog) {
-    picoro::debug("http_server: Starting server at %s on port %d\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), port);
-    auto [listener, err] = picoro::listen(port, listen_backlog);
-    if (err) {
-        picoro::debug("http_server: Error starting server: %s\n", picoro::lwip_describe(err));
-        co_return;
-    }
-    picoro::debug("http_server: server started\n");
-
-    for (;;) {
-        picoro::debug("http_server: about to await accept()\n");
-        auto [conn, err] = co_await listener.accept();
-        if (err) {
-            picoro::debug("http_server: Error accepting connection: %s\n", picoro::lwip_describe(err));
-            continue;
-        }
-        picoro::debug("http_server: accept()ed a connection\n");
-        handle_client(std::move(conn)).detach();
-    }
-}
-
 picoro::Coroutine<void> networking(async_context_t *ctx) {
     co_await wifi_connect(ctx, "Annoying Saxophone", wifi_password);
     const int port = 80;
     const int listen_backlog = 4;
-    co_await http_server(port, listen_backlog);
+    picoro::debug("Serving HTTP at %s on port %d\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), port);
+    co_await serve_http(ctx, port, listen_backlog);
 }
 
 picoro::Coroutine<void> coroutine_main(async_context_t *ctx) {
@@ -456,6 +271,13 @@ int main() {
     if (watchdog_caused_reboot()) {
         printf("rebooted by watchdog\n");
     }
+
+    // The measurement log must be beyond the end of the program in flash.
+    extern char __flash_binary_end;
+    hard_assert(uintptr_t(&__flash_binary_end) <= XIP_BASE + PICO_FLASH_SIZE_BYTES - measurement_log_bytes);
+    // Before the watchdog is enabled, since reading the whole log takes a
+    // while.
+    restore_history();
     // Watchdog is updated every second in `time_beacon`. If we miss five
     // updates, then watchdog will reset the board.
     const uint32_t timeout_ms = 5000;
@@ -0,0 +1,104 @@
+#include <pico/async_context.h>
+#include <pico/time.h>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+absolute_time_t get_absolute_time() {
+    static const auto start = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+async_context_t *host_async_context() {
+    static async_context_t instance = [] {
+        const int fd = epoll_create1(EPOLL_CLOEXEC);
+        if (fd == -1) {
+            std::perror("epoll_create1");
+            std::abort();
+        }
+        return async_context_t{.epoll_fd = fd, .timers = {}, .closed = {}};
+    }();
+    return &instance;
+}
+
+namespace host {
+
+Waiters *watch(async_context_t *ctx, int fd) {
+    Waiters *const waiters = new Waiters;
+    // Edge-triggered: an operation first tries its system call, and waits
+    // only if that would block, so no readiness goes unnoticed.
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = waiters;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        std::perror("epoll_ctl");
+        std::abort();
+    }
+    return waiters;
+}
+
+void close(async_context_t *ctx, int fd, Waiters *waiters) {
+    // Closing the socket removes it from epoll, but an event for it might
+    // already be in the batch that `poll` is handling, so `waiters` lives
+    // until the batch is done.
+    ::close(fd);
+    waiters->closed = true;
+    waiters->reader = nullptr;
+    waiters->writer = nullptr;
+    ctx->closed.push_back(waiters);
+}
+
+namespace {
+
+// If the specified `operation` finishes, resume whatever was waiting on it.
+void retry(Operation *&operation) {
+    if (operation && operation->attempt()) {
+        const std::coroutine_handle<> waiting = operation->waiting;
+        operation = nullptr;
+        waiting.resume();
+    }
+}
+
+} // namespace
+
+void poll(async_context_t *ctx) {
+    int timeout_ms = -1;
+    if (!ctx->timers.empty()) {
+        const int64_t us = absolute_time_diff_us(get_absolute_time(), ctx->timers.begin()->first);
+        timeout_ms = us <= 0 ? 0 : int((us + 999) / 1000);
+    }
+
+    epoll_event events[64];
+    const int count = epoll_wait(ctx->epoll_fd, events, std::size(events), timeout_ms);
+    for (int i = 0; i < count; ++i) {
+        Waiters *const waiters = static_cast<Waiters*>(events[i].data.ptr);
+        // Resuming the reader might close the socket, which clears the
+        // writer, so check `closed` in between.
+        if (!waiters->closed && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            retry(waiters->reader);
+        }
+        if (!waiters->closed && (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+            retry(waiters->writer);
+        }
+    }
+    for (Waiters *waiters : ctx->closed) {
+        delete waiters;
+    }
+    ctx->closed.clear();
+
+    // Resuming a sleeper might add timers, including ones that are already
+    // due, so take them one at a time.
+    while (!ctx->timers.empty() && time_reached(ctx->timers.begin()->first)) {
+        const std::coroutine_handle<> sleeper = ctx->timers.begin()->second;
+        ctx->timers.erase(ctx->timers.begin());
+        sleeper.resume();
+    }
+}
+
+} // namespace host
@@ -0,0 +1,246 @@
+// `coroutines-bench` measures how many requests per second an HTTP server
+// answers, and how long the answers take, using keep-alive connections that
+// each send one request at a time.
+//
+//     usage: coroutines-bench [-c] [-i] [HOST [PORT [CONNECTIONS [SECONDS [PATH]]]]]
+//
+// The defaults are 127.0.0.1, 8080, 4 connections, 10 seconds, and /latest.
+// Each connection has its own thread. A connection that the server closes,
+// e.g. after a 503 from admission control, is reopened. A request's latency
+// includes opening the connection, if it had to be.
+//
+// With -c, each request is sent on a new connection, with "Connection: close",
+// as clients did before the servers kept connections alive, so that the two
+// can be compared.
+//
+// With -i, requests are conditional: each has an If-None-Match header with
+// the ETag of the last response, if it had one, as a client polling for
+// changes would send. The bytes received per request show what the 304s save.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    const char *host = "127.0.0.1";
+    int port = 8080;
+    int connections = 4;
+    int seconds = 10;
+    const char *path = "/latest";
+    // whether to send each request on a new connection
+    bool close_each = false;
+    // whether to send If-None-Match with the previous response's ETag
+    bool conditional = false;
+};
+
+struct Results {
+    // microseconds per successful request
+    std::vector<int64_t> latencies;
+    // responses having a status other than 2xx or 304
+    unsigned unsuccessful = 0;
+    // successful responses that were 304 (Not Modified)
+    unsigned not_modified = 0;
+    // bytes received in successful responses, headers and all
+    uint64_t bytes = 0;
+    // connections that failed other than by the server closing them
+    unsigned errors = 0;
+    // connections opened
+    unsigned connects = 0;
+};
+
+int connect_to(const Options& options) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host, &address.sin_addr);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address)) {
+        ::close(fd);
+        return -1;
+    }
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    return fd;
+}
+
+// Return the value of the specified header `name` in the specified `headers`,
+// or an empty string if there isn't one. `name` must be lower case, and
+// include the colon.
+std::string_view header_value(std::string_view headers, std::string_view name) {
+    for (std::size_t line = headers.find("\r\n"); line != std::string_view::npos; line = headers.find("\r\n", line + 2)) {
+        const std::string_view rest = headers.substr(line + 2);
+        if (rest.size() < name.size()) {
+            break;
+        }
+        if (std::equal(name.begin(), name.end(), rest.begin(), [](char wanted, char actual) {
+                return wanted == (actual >= 'A' && actual <= 'Z' ? actual - 'A' + 'a' : actual);
+            })) {
+            std::string_view value = rest.substr(name.size(), rest.find("\r\n") - name.size());
+            value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+            return value;
+        }
+    }
+    return {};
+}
+
+// Send requests on connections to the server until `deadline`.
+void run_client(const Options& options, Clock::time_point deadline, Results& results) {
+    std::string request_start = "GET ";
+    request_start += options.path;
+    request_start += " HTTP/1.1\r\nHost: ";
+    request_start += options.host;
+    request_start += options.close_each ? "\r\nConnection: close\r\n" : "\r\n";
+
+    std::string request;
+    std::string etag;
+    std::string response;
+    char buffer[4096];
+    int fd = -1;
+    while (Clock::now() < deadline) {
+        const auto start = Clock::now();
+        if (fd == -1) {
+            if ((fd = connect_to(options)) == -1) {
+                ++results.errors;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            ++results.connects;
+        }
+
+        request = request_start;
+        if (!etag.empty()) {
+            request += "If-None-Match: ";
+            request += etag;
+            request += "\r\n";
+        }
+        request += "\r\n";
+        bool ok = ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+        // Receive the headers, and then the rest of the body, if any.
+        response.clear();
+        std::size_t headers_end = std::string::npos;
+        std::size_t expected = std::string::npos;
+        while (ok && response.size() != expected) {
+            const ssize_t count = ::recv(fd, buffer, sizeof buffer, 0);
+            if (count <= 0) {
+                ok = false;
+                break;
+            }
+            response.append(buffer, count);
+            if (headers_end == std::string::npos && (headers_end = response.find("\r\n\r\n")) != std::string::npos) {
+                const std::string_view length = header_value(std::string_view(response).substr(0, headers_end), "content-length:");
+                std::size_t body_length = 0;
+                std::from_chars(length.data(), length.data() + length.size(), body_length);
+                expected = headers_end + 4 + body_length;
+            }
+        }
+        const auto finish = Clock::now();
+        if (!ok) {
+            ++results.errors;
+            ::close(fd);
+            fd = -1;
+            continue;
+        }
+
+        const std::string_view headers = std::string_view(response).substr(0, headers_end);
+        const bool success = headers.size() > 9 && (headers[9] == '2' || headers.substr(9, 3) == "304");
+        if (success) {
+            results.latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count());
+            results.bytes += response.size();
+            results.not_modified += headers.substr(9, 3) == "304";
+            if (options.conditional) {
+                etag = header_value(headers, "etag:");
+            }
+        } else {
+            ++results.unsuccessful;
+        }
+        if (options.close_each || header_value(headers, "connection:") == "close") {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int option; (option = getopt(argc, argv, "ci")) != -1;) {
+        switch (option) {
+        case 'c':
+            options.close_each = true;
+            break;
+        case 'i':
+            options.conditional = true;
+            break;
+        default:
+            std::fprintf(stderr, "usage: %s [-c] [-i] [HOST [PORT [CONNECTIONS [SECONDS [PATH]]]]]\n", argv[0]);
+            return 2;
+        }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
+    if (argc > 1) options.host = argv[1];
+    if (argc > 2) options.port = std::atoi(argv[2]);
+    if (argc > 3) options.connections = std::atoi(argv[3]);
+    if (argc > 4) options.seconds = std::atoi(argv[4]);
+    if (argc > 5) options.path = argv[5];
+
+    std::printf("%d %s to %s:%d%s%s for %d seconds\n",
+        options.connections, options.close_each ? "clients, a connection per request," : "keep-alive connections",
+        options.host, options.port, options.path, options.conditional ? ", conditionally," : "", options.seconds);
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::seconds(options.seconds);
+    std::vector<Results> results(options.connections);
+    std::vector<std::thread> threads;
+    for (Results& result : results) {
+        threads.emplace_back(run_client, std::cref(options), deadline, std::ref(result));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Results total;
+    for (const Results& result : results) {
+        total.latencies.insert(total.latencies.end(), result.latencies.begin(), result.latencies.end());
+        total.unsuccessful += result.unsuccessful;
+        total.not_modified += result.not_modified;
+        total.bytes += result.bytes;
+        total.errors += result.errors;
+        total.connects += result.connects;
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+    const auto percentile = [&](double p) -> long long {
+        if (total.latencies.empty()) {
+            return 0;
+        }
+        return total.latencies[std::size_t(p / 100 * (total.latencies.size() - 1))];
+    };
+
+    std::printf("requests: %zu (%.0f per second)\n", total.latencies.size(), total.latencies.size() / elapsed);
+    std::printf("latency (us): p50 %lld, p90 %lld, p99 %lld, p99.9 %lld, max %lld\n",
+        percentile(50), percentile(90), percentile(99), percentile(99.9), percentile(100));
+    std::printf("received: %.1f bytes per request, %u of the responses 304 (Not Modified)\n",
+        total.latencies.empty() ? 0.0 : double(total.bytes) / total.latencies.size(), total.not_modified);
+    std::printf("unsuccessful responses: %u\n", total.unsuccessful);
+    std::printf("connections opened: %u\n", total.connects);
+    std::printf("connection errors: %u\n", total.errors);
+    // Fail only if the server answered nothing at all.
+    return total.latencies.empty() && total.unsuccessful == 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+# usage: benchmark.sh SERVER BENCH WS_BENCH PORT
+#
+# Run the server on the specified port, and then the benchmark against
+# several paths, and then stop the server. /latest is also benchmarked with a
+# connection per request, to compare with keep-alive, and with conditional
+# requests, to compare with unconditional ones. Then run another server, on
+# the next port, that publishes a measurement every 10 ms, and the WebSocket
+# benchmark against it.
+
+set -e
+
+server=$1
+bench=$2
+ws_bench=$3
+port=$4
+
+"$server" "$port" 1000 &
+server_pid=$!
+trap 'kill "$server_pid"' EXIT
+sleep 1
+
+for path in /latest /nonexistent; do
+  "$bench" 127.0.0.1 "$port" 4 5 "$path"
+  echo
+done
+
+"$bench" -c 127.0.0.1 "$port" 4 5 /latest
+echo
+"$bench" -i 127.0.0.1 "$port" 4 5 /latest
+
+kill "$server_pid"
+ws_port=$((port + 1))
+"$server" "$ws_port" 10 &
+server_pid=$!
+sleep 1
+
+echo
+"$ws_bench" 127.0.0.1 "$ws_port" 4 5
@@ -0,0 +1,445 @@
+// `coroutines-cbor-bench` checks that `CborWriter` (see <common/cbor.h>)
+// writes valid, deterministically encoded CBOR, and compares the coroutines
+// project's CBOR measurements with its JSON ones.
+//
+//     usage: coroutines-cbor-bench
+//
+// First, it checks `CborWriter`'s output against the examples in RFC 8949's
+// appendix A. Then it writes random data items (integers across the whole
+// 32-bit range and at each boundary of the head's length, text strings of
+// every length up to 300, and arrays and maps of them) and reads each back
+// with a decoder written here from RFC 8949, independently of `CborWriter`.
+// The decoder rejects anything that isn't well-formed, or whose heads aren't
+// as short as possible (section 4.2.1), or whose map keys aren't in order,
+// which is checked first. It checks that the value read back is the one written, and that the length is
+// what `cbor_head_length` and `cbor_text_length` predict.
+//
+// Then it writes random measurements as the server does, as a CBOR map and as
+// the JSON body, decodes the CBOR, and reports the sizes of both and the time
+// taken to write each.
+//
+// It exits with a nonzero status if any check fails.
+
+#include <common/cbor.h>
+#include <common/format.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// A decoded data item. Integers are kept as int64_t, which holds every
+// integer that `CborWriter` can write.
+struct Item;
+using Array = std::vector<Item>;
+using Map = std::vector<std::pair<Item, Item>>;
+
+struct Item {
+    std::variant<std::int64_t, std::string, Array, Map> value;
+
+    bool operator==(const Item&) const = default;
+};
+
+// `Decoder` reads data items as RFC 8949 describes them, accepting only the
+// subset that `CborWriter` can write: integers, text strings, and arrays and
+// maps of definite length.
+class Decoder {
+    std::string_view input;
+    std::size_t offset = 0;
+    const char *error = nullptr;
+
+    bool fail(const char *why) {
+        if (!error) {
+            error = why;
+        }
+        return false;
+    }
+
+    // Read a head (section 3). Return its major type and argument.
+    bool head(unsigned& major, std::uint64_t& argument) {
+        if (offset == input.size()) {
+            return fail("truncated head");
+        }
+        const std::uint8_t initial = std::uint8_t(input[offset++]);
+        major = initial >> 5;
+        const unsigned additional = initial & 0x1F;
+        if (additional < 24) {
+            argument = additional;
+            return true;
+        }
+        if (additional > 27) {
+            return fail("reserved or indefinite-length additional information");
+        }
+        const std::size_t size = std::size_t(1) << (additional - 24);
+        if (input.size() - offset < size) {
+            return fail("truncated argument");
+        }
+        argument = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            argument = argument << 8 | std::uint8_t(input[offset++]);
+        }
+        // preferred serialization: the shortest head that holds the argument
+        const std::uint64_t smallest = size == 1 ? 24 : std::uint64_t(1) << (8 * size / 2);
+        if (argument < smallest) {
+            return fail("the head isn't as short as it could be");
+        }
+        return true;
+    }
+
+    bool item(Item& result, int depth) {
+        if (depth > 16) {
+            return fail("nested too deeply");
+        }
+        unsigned major;
+        std::uint64_t argument;
+        if (!head(major, argument)) {
+            return false;
+        }
+        switch (major) {
+        case 0:
+            if (argument > std::uint64_t(INT64_MAX)) {
+                return fail("integer too large");
+            }
+            result.value = std::int64_t(argument);
+            return true;
+        case 1:
+            if (argument > std::uint64_t(INT64_MAX)) {
+                return fail("integer too small");
+            }
+            result.value = -1 - std::int64_t(argument);
+            return true;
+        case 3: {
+            if (input.size() - offset < argument) {
+                return fail("truncated text string");
+            }
+            result.value = std::string(input.substr(offset, argument));
+            offset += argument;
+            return true;
+        }
+        case 4: {
+            Array array;
+            for (std::uint64_t i = 0; i < argument; ++i) {
+                array.emplace_back();
+                if (!item(array.back(), depth + 1)) {
+                    return false;
+                }
+            }
+            result.value = std::move(array);
+            return true;
+        }
+        case 5: {
+            Map map;
+            std::string_view previous_key;
+            for (std::uint64_t i = 0; i < argument; ++i) {
+                // Deterministic order is the bytewise order of the keys'
+                // encodings (section 4.2.1).
+                const std::size_t key_offset = offset;
+                map.emplace_back();
+                if (!item(map.back().first, depth + 1)) {
+                    return false;
+                }
+                const std::string_view key = input.substr(key_offset, offset - key_offset);
+                if (i && !(previous_key < key)) {
+                    return fail("map keys out of order, or repeated");
+                }
+                previous_key = key;
+                if (!item(map.back().second, depth + 1)) {
+                    return false;
+                }
+            }
+            result.value = std::move(map);
+            return true;
+        }
+        default:
+            return fail("a major type that CborWriter doesn't write");
+        }
+    }
+
+ public:
+    explicit Decoder(std::string_view input)
+    : input(input) {}
+
+    // Decode the one data item that the input must consist of.
+    bool decode(Item& result) {
+        return item(result, 0) && (offset == input.size() || fail("bytes after the data item"));
+    }
+
+    const char *why() const { return error; }
+};
+
+bool failed(const char *what, const char *detail = "") {
+    std::fprintf(stderr, "%s%s%s\n", what, *detail ? ": " : "", detail);
+    return false;
+}
+
+std::string hex(std::string_view bytes) {
+    std::string result;
+    for (const char byte : bytes) {
+        char digits[3];
+        std::snprintf(digits, sizeof digits, "%02x", unsigned(std::uint8_t(byte)));
+        result += digits;
+    }
+    return result;
+}
+
+// Check `CborWriter` against examples from RFC 8949 appendix A.
+bool check_examples() {
+    struct Example {
+        const char *expected;
+        void (*write)(common::CborWriter&);
+    };
+    const Example examples[] = {
+        {"00", [](common::CborWriter& cbor) { cbor.integer(0); }},
+        {"17", [](common::CborWriter& cbor) { cbor.integer(23); }},
+        {"1818", [](common::CborWriter& cbor) { cbor.integer(24); }},
+        {"1864", [](common::CborWriter& cbor) { cbor.integer(100); }},
+        {"1903e8", [](common::CborWriter& cbor) { cbor.integer(1000); }},
+        {"1a000f4240", [](common::CborWriter& cbor) { cbor.integer(1000000); }},
+        {"1affffffff", [](common::CborWriter& cbor) { cbor.unsigned_integer(4294967295); }},
+        {"20", [](common::CborWriter& cbor) { cbor.integer(-1); }},
+        {"29", [](common::CborWriter& cbor) { cbor.integer(-10); }},
+        {"3863", [](common::CborWriter& cbor) { cbor.integer(-100); }},
+        {"3903e7", [](common::CborWriter& cbor) { cbor.integer(-1000); }},
+        {"60", [](common::CborWriter& cbor) { cbor.text(""); }},
+        {"6161", [](common::CborWriter& cbor) { cbor.text("a"); }},
+        {"6449455446", [](common::CborWriter& cbor) { cbor.text("IETF"); }},
+        {"80", [](common::CborWriter& cbor) { cbor.array(0); }},
+        {"83010203", [](common::CborWriter& cbor) { cbor.array(3).integer(1).integer(2).integer(3); }},
+        {"a0", [](common::CborWriter& cbor) { cbor.map(0); }},
+        {"a26161016162820203", [](common::CborWriter& cbor) {
+            cbor.map(2).text("a").integer(1).text("b").array(2).integer(2).integer(3); }},
+    };
+    for (const Example& example : examples) {
+        char buffer[16];
+        common::CborWriter cbor(buffer);
+        example.write(cbor);
+        const std::string actual = hex({buffer, std::size_t(cbor.end() - buffer)});
+        if (actual != example.expected) {
+            std::fprintf(stderr, "expected %s but wrote %s\n", example.expected, actual.c_str());
+            return false;
+        }
+    }
+    std::printf("RFC 8949 examples:        %zu, byte for byte\n", std::size(examples));
+    return true;
+}
+
+// Check that the decoder rejects what it should, so that its accepting
+// `CborWriter`'s output means something.
+bool check_decoder() {
+    const std::string_view rejected[] = {
+        // 23 in a two-byte head
+        {"\x18\x17", 2},
+        // 255 in a three-byte head
+        {"\x19\x00\xff", 3},
+        // a text string longer than the input
+        {"\x63" "ab", 3},
+        // {"b": 1, "a": 1}, out of order
+        {"\xa2\x61" "b\x01\x61" "a\x01", 7},
+        // {"a": 1, "a": 1}, repeated
+        {"\xa2\x61" "a\x01\x61" "a\x01", 7},
+        // an indefinite-length array
+        {"\x9f\xff", 2},
+        // two data items
+        {"\x01\x02", 2},
+    };
+    for (const std::string_view encoded : rejected) {
+        Item item;
+        if (Decoder(encoded).decode(item)) {
+            return failed("the decoder accepted", hex(encoded).c_str());
+        }
+    }
+    return true;
+}
+
+// Decode the specified `encoded` bytes, and check that they're the specified
+// `expected` item, and are `expected_length` bytes long.
+bool round_trips(std::string_view encoded, const Item& expected, std::size_t expected_length) {
+    Item decoded;
+    Decoder decoder(encoded);
+    if (!decoder.decode(decoded)) {
+        return failed(decoder.why(), hex(encoded).c_str());
+    }
+    if (!(decoded == expected)) {
+        return failed("decoded something else", hex(encoded).c_str());
+    }
+    if (encoded.size() != expected_length) {
+        return failed("not the predicted length", hex(encoded).c_str());
+    }
+    return true;
+}
+
+bool check_round_trips(int count) {
+    std::mt19937 random(2024);
+    const auto pick = [&](std::uint32_t low, std::uint32_t high) {
+        return std::uniform_int_distribution<std::uint32_t>(low, high)(random);
+    };
+    // the arguments at which the head's length changes
+    const std::uint32_t boundaries[] = {0, 23, 24, 255, 256, 65535, 65536, 4294967295};
+    std::vector<char> buffer(1024);
+
+    for (int i = 0; i < count; ++i) {
+        const std::uint32_t u = i < int(std::size(boundaries)) ? boundaries[i] : pick(0, UINT32_MAX) >> pick(0, 31);
+        const std::int32_t s = std::int32_t(i % 2 ? u : ~u);
+        common::CborWriter cbor(buffer.data());
+        cbor.unsigned_integer(u);
+        if (!round_trips({buffer.data(), std::size_t(cbor.end() - buffer.data())},
+                Item{std::int64_t(u)}, common::cbor_head_length(u))) {
+            return false;
+        }
+        cbor = common::CborWriter(buffer.data());
+        cbor.integer(s);
+        const std::uint32_t argument = s < 0 ? ~std::uint32_t(s) : std::uint32_t(s);
+        if (!round_trips({buffer.data(), std::size_t(cbor.end() - buffer.data())},
+                Item{std::int64_t(s)}, common::cbor_head_length(argument))) {
+            return false;
+        }
+
+        std::string text(i % 301, 'x');
+        for (char& ch : text) {
+            ch = char(pick(0x20, 0x7E));
+        }
+        cbor = common::CborWriter(buffer.data());
+        cbor.text(text);
+        if (!round_trips({buffer.data(), std::size_t(cbor.end() - buffer.data())},
+                Item{text}, common::cbor_text_length(text))) {
+            return false;
+        }
+
+        // an array of a map whose keys are in deterministic order, and an
+        // integer
+        static constexpr std::string_view keys[] = {"a", "rh", "co2", "seq", "heap", "temp"};
+        static_assert(common::cbor_keys_are_deterministic(keys));
+        const std::uint32_t pairs = pick(0, std::size(keys));
+        cbor = common::CborWriter(buffer.data());
+        cbor.array(2).map(pairs);
+        Map map;
+        std::size_t length = 1 + common::cbor_head_length(pairs) + common::cbor_head_length(u);
+        for (std::uint32_t pair = 0; pair < pairs; ++pair) {
+            cbor.text(keys[pair]).integer(s);
+            map.emplace_back(Item{std::string(keys[pair])}, Item{std::int64_t(s)});
+            length += common::cbor_text_length(keys[pair]) + common::cbor_head_length(argument);
+        }
+        cbor.unsigned_integer(u);
+        if (!round_trips({buffer.data(), std::size_t(cbor.end() - buffer.data())},
+                Item{Array{Item{map}, Item{std::int64_t(u)}}}, length)) {
+            return false;
+        }
+    }
+    std::printf("round trips:              %d each of integers, text strings, and arrays of maps\n", count);
+    return true;
+}
+
+// the coroutines project's measurement, as ../http_server.cpp writes it
+struct Measurement {
+    unsigned sequence_number;
+    uint16_t co2_ppm;
+    int32_t temperature_millicelsius;
+    int32_t relative_humidity_millipercent;
+    uint32_t free_bytes;
+};
+
+constexpr std::string_view cbor_keys[] = {"rh", "co2", "seq", "heap", "temp"};
+static_assert(common::cbor_keys_are_deterministic(cbor_keys));
+
+char *write_cbor(char *output, const Measurement& data) {
+    common::CborWriter cbor(output);
+    cbor.map(std::size(cbor_keys))
+        .text(cbor_keys[0]).integer(data.relative_humidity_millipercent)
+        .text(cbor_keys[1]).unsigned_integer(data.co2_ppm)
+        .text(cbor_keys[2]).unsigned_integer(data.sequence_number)
+        .text(cbor_keys[3]).unsigned_integer(data.free_bytes)
+        .text(cbor_keys[4]).integer(data.temperature_millicelsius);
+    return cbor.end();
+}
+
+constexpr char json_format[] =
+    "{\"sequence_number\": %u,"
+    " \"CO2_ppm\": %hu,"
+    " \"temperature_celsius\": %.1f,"
+    " \"relative_humidity_percent\": %.1f,"
+    " \"free_bytes\": %lu}";
+
+using Json = common::Format<json_format,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Decimal<uint32_t>>;
+
+double nanoseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+bool compare_with_json(int count) {
+    std::mt19937 random(2024);
+    std::vector<Measurement> measurements(count);
+    for (unsigned i = 0; i < measurements.size(); ++i) {
+        measurements[i] = {
+            .sequence_number = i,
+            .co2_ppm = uint16_t(std::uniform_int_distribution<int>(400, 5000)(random)),
+            .temperature_millicelsius = std::uniform_int_distribution<int32_t>(-10000, 40000)(random),
+            .relative_humidity_millipercent = std::uniform_int_distribution<int32_t>(0, 100000)(random),
+            .free_bytes = std::uniform_int_distribution<uint32_t>(20000, 200000)(random)};
+    }
+
+    constexpr std::size_t cbor_capacity = 64;
+    std::vector<std::array<char, cbor_capacity>> cbor(count);
+    std::vector<std::size_t> cbor_lengths(count);
+    const auto cbor_start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        cbor_lengths[i] = write_cbor(cbor[i].data(), measurements[i]) - cbor[i].data();
+    }
+    const auto cbor_time = Clock::now() - cbor_start;
+
+    std::vector<std::array<char, Json::max_length + 1>> json(count);
+    std::vector<std::size_t> json_lengths(count);
+    const auto json_start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        json_lengths[i] = Json::write(json[i], measurements[i].sequence_number, measurements[i].co2_ppm,
+            measurements[i].temperature_millicelsius, measurements[i].relative_humidity_millipercent,
+            measurements[i].free_bytes);
+    }
+    const auto json_time = Clock::now() - json_start;
+
+    double cbor_total = 0;
+    double json_total = 0;
+    for (int i = 0; i < count; ++i) {
+        const Measurement& data = measurements[i];
+        const Item expected{Map{
+            {Item{std::string("rh")}, Item{std::int64_t(data.relative_humidity_millipercent)}},
+            {Item{std::string("co2")}, Item{std::int64_t(data.co2_ppm)}},
+            {Item{std::string("seq")}, Item{std::int64_t(data.sequence_number)}},
+            {Item{std::string("heap")}, Item{std::int64_t(data.free_bytes)}},
+            {Item{std::string("temp")}, Item{std::int64_t(data.temperature_millicelsius)}}}};
+        Item decoded;
+        Decoder decoder({cbor[i].data(), cbor_lengths[i]});
+        if (!decoder.decode(decoded) || !(decoded == expected)) {
+            return failed("a measurement didn't round trip", decoder.why() ? decoder.why() : "");
+        }
+        cbor_total += cbor_lengths[i];
+        json_total += json_lengths[i];
+    }
+
+    std::printf("measurement size:         %.1f bytes as CBOR, %.1f bytes as JSON, on average\n",
+        cbor_total / count, json_total / count);
+    std::printf("measurement write time:   %.0f ns as CBOR, %.0f ns as JSON\n",
+        nanoseconds(cbor_time) / count, nanoseconds(json_time) / count);
+    return true;
+}
+
+} // namespace
+
+int main() {
+    return !(check_decoder() && check_examples() && check_round_trips(200 * 1000) && compare_with_json(1000 * 1000));
+}
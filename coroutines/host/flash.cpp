@@ -0,0 +1,131 @@
+#include <hardware/flash.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace host {
+namespace {
+
+struct Flash {
+    uint8_t *bytes = nullptr;
+    std::vector<unsigned> erase_counts = std::vector<unsigned>(PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE);
+    uint64_t bytes_programmed = 0;
+    // bytes that may be erased or programmed before power is lost
+    uint64_t power_left = UINT64_MAX;
+};
+
+Flash& flash() {
+    static Flash instance;
+    if (!instance.bytes) {
+        void *const memory = mmap(nullptr, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            std::perror("mmap");
+            std::abort();
+        }
+        instance.bytes = static_cast<uint8_t*>(memory);
+        std::memset(instance.bytes, 0xFF, PICO_FLASH_SIZE_BYTES);
+    }
+    return instance;
+}
+
+// Return how many of the specified `count` bytes can be erased or programmed
+// before power is lost.
+size_t powered(size_t count) {
+    Flash& state = flash();
+    const size_t allowed = std::min<uint64_t>(count, state.power_left);
+    state.power_left -= allowed;
+    return allowed;
+}
+
+} // namespace
+
+bool open_flash_image(const char *path) {
+    const int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        std::perror(path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) || ftruncate(fd, PICO_FLASH_SIZE_BYTES)) {
+        std::perror(path);
+        ::close(fd);
+        return false;
+    }
+    void *const memory = mmap(nullptr, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        std::perror(path);
+        return false;
+    }
+    uint8_t *const bytes = static_cast<uint8_t*>(memory);
+    // A new file, or the part by which it was extended, is erased flash.
+    if (status.st_size < PICO_FLASH_SIZE_BYTES) {
+        std::memset(bytes + status.st_size, 0xFF, PICO_FLASH_SIZE_BYTES - status.st_size);
+    }
+    Flash& state = flash();
+    munmap(state.bytes, PICO_FLASH_SIZE_BYTES);
+    state.bytes = bytes;
+    return true;
+}
+
+uintptr_t flash_address() {
+    return reinterpret_cast<uintptr_t>(flash().bytes);
+}
+
+const std::vector<unsigned>& flash_erase_counts() {
+    return flash().erase_counts;
+}
+
+uint64_t flash_bytes_programmed() {
+    return flash().bytes_programmed;
+}
+
+void lose_power_after(uint64_t bytes) {
+    flash().power_left = bytes;
+}
+
+void restore_power() {
+    flash().power_left = UINT64_MAX;
+}
+
+bool power_lost() {
+    return flash().power_left == 0;
+}
+
+} // namespace host
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    host::Flash& state = host::flash();
+    if (flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        std::fprintf(stderr, "flash_range_erase(%u, %zu) is out of bounds or unaligned\n", flash_offs, count);
+        std::abort();
+    }
+    std::memset(state.bytes + flash_offs, 0xFF, host::powered(count));
+    for (size_t offset = 0; offset < count; offset += FLASH_SECTOR_SIZE) {
+        ++state.erase_counts[(flash_offs + offset) / FLASH_SECTOR_SIZE];
+    }
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    host::Flash& state = host::flash();
+    if (flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        std::fprintf(stderr, "flash_range_program(%u, %zu) is out of bounds or unaligned\n", flash_offs, count);
+        std::abort();
+    }
+    // Programming can only clear bits.
+    const size_t allowed = host::powered(count);
+    for (size_t i = 0; i < allowed; ++i) {
+        state.bytes[flash_offs + i] &= data[i];
+    }
+    state.bytes_programmed += allowed;
+}
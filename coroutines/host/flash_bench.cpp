@@ -0,0 +1,325 @@
+// `coroutines-flash-bench` exercises `FlashLog` (see <common/flash_log.h>) on
+// the host's stand-in flash, with the coroutines project's 6-byte
+// measurement records.
+//
+//     usage: coroutines-flash-bench [FLASH_IMAGE]
+//
+// First, it appends several laps' worth of records to a log the size of the
+// board's, calling `erase_ahead` between appends as the server does, and
+// reports the write amplification (bytes erased and programmed per byte of
+// payload), how evenly the sectors were erased, and how long appending,
+// erasing ahead, mounting, and reading the log take. It checks that no
+// append erased a sector itself.
+//
+// Next, it finds records by time in that full log, three ways: with
+// `FlashLog::seek_time`, which binary searches the sector headers; by reading
+// the log from the oldest record; and by a Boyer-Moore-Horspool search of the
+// whole region for the record's header, as flash/flash.cpp once searched
+// flash. It reports the time per lookup of each. It also looks up records in
+// a log that's an eighth full, as a new one is, where the headers searched
+// are only those of the sectors written, not the erased ones after them.
+//
+// Then it loses power at random points while appending and erasing ahead,
+// remounts the log, and checks that every record read back is one that was
+// appended, under the number it was appended with, that `seek_number` finds
+// them, that at most the unprogrammed page's worth of records were lost, and
+// that the log carries on after them.
+//
+// The flash is in memory, unless FLASH_IMAGE is given, in which case it's
+// left holding the log.
+
+#include <common/flash_log.h>
+
+#include <hardware/flash.h>
+
+#include "../http_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr uint32_t log_offset = PICO_FLASH_SIZE_BYTES - measurement_log_bytes;
+constexpr std::size_t payload_size = 6;
+
+// Return the payload of the record having the specified `number`.
+std::array<uint8_t, payload_size> payload(uint32_t number) {
+    std::array<uint8_t, payload_size> bytes;
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = uint8_t(number * 31 + i * 7);
+    }
+    return bytes;
+}
+
+// Return the record's time, made up from its `number`.
+uint32_t time_of(uint32_t number) {
+    return number * 5;
+}
+
+double microseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// Read the whole `log`, and check each record. Return the number read, or -1
+// if any isn't what was appended.
+long check(const common::FlashLog& log) {
+    long count = 0;
+    long previous = -1;
+    common::FlashLog::Record record;
+    for (auto cursor = log.cursor(); cursor.next(record); ++count) {
+        const auto expected = payload(record.number);
+        if (long(record.number) <= previous || record.time != time_of(record.number) ||
+            !std::equal(record.payload.begin(), record.payload.end(), expected.begin(), expected.end())) {
+            std::fprintf(stderr, "record %u is wrong\n", unsigned(record.number));
+            return -1;
+        }
+        previous = record.number;
+    }
+    return count;
+}
+
+int measure_write_amplification() {
+    common::FlashLog log(log_offset, measurement_log_bytes);
+    log.mount();
+    const uint32_t first = log.end();
+
+    const std::vector<unsigned> erases_before = host::flash_erase_counts();
+    const uint64_t programmed_before = host::flash_bytes_programmed();
+
+    // three laps of the log
+    const uint32_t count = 3 * measurement_log_bytes / (common::FlashLog::record_header_size + payload_size);
+    Clock::duration append_time{};
+    Clock::duration erase_time{};
+    unsigned erases_ahead = 0;
+    for (uint32_t number = first; number != first + count; ++number) {
+        const auto bytes = payload(number);
+        const auto append_start = Clock::now();
+        log.append(time_of(number), bytes);
+        const auto erase_start = Clock::now();
+        erases_ahead += log.erase_ahead();
+        append_time += erase_start - append_start;
+        erase_time += Clock::now() - erase_start;
+    }
+    if (log.late_erases() != 0) {
+        std::fprintf(stderr, "append erased %u sectors itself\n", log.late_erases());
+        return 1;
+    }
+
+    const std::vector<unsigned>& erases_after = host::flash_erase_counts();
+    const uint32_t first_sector = log_offset / FLASH_SECTOR_SIZE;
+    uint64_t erased = 0;
+    unsigned least = UINT32_MAX;
+    unsigned most = 0;
+    for (uint32_t sector = first_sector; sector < first_sector + log.sectors(); ++sector) {
+        const unsigned erases = erases_after[sector] - erases_before[sector];
+        erased += erases;
+        least = std::min(least, erases);
+        most = std::max(most, erases);
+    }
+    const uint64_t programmed = host::flash_bytes_programmed() - programmed_before;
+    const double payload_bytes = double(count) * payload_size;
+
+    common::FlashLog remounted(log_offset, measurement_log_bytes);
+    const auto mount_start = Clock::now();
+    remounted.mount();
+    const auto mount_time = Clock::now() - mount_start;
+    const auto read_start = Clock::now();
+    const long read = check(remounted);
+    const auto read_time = Clock::now() - read_start;
+    if (read < 0) {
+        return 1;
+    }
+
+    std::printf("records appended:         %u of %zu bytes, %zu with headers\n",
+        unsigned(count), payload_size, payload_size + common::FlashLog::record_header_size);
+    std::printf("write amplification:      %.2f bytes programmed, %.2f bytes erased per payload byte\n",
+        programmed / payload_bytes, erased * FLASH_SECTOR_SIZE / payload_bytes);
+    std::printf("sector erases:            %u to %u per sector, over %u sectors\n",
+        least, most, unsigned(log.sectors()));
+    std::printf("append:                   %.3f us per record, none erasing\n", microseconds(append_time) / count);
+    std::printf("erase ahead:              %u sectors, %.3f us per call\n", erases_ahead, microseconds(erase_time) / count);
+    std::printf("mount:                    %.0f us\n", microseconds(mount_time));
+    std::printf("read:                     %ld records in flash, %.3f us per record\n",
+        read, microseconds(read_time) / read);
+    return 0;
+}
+
+int measure_lookup(int lookups) {
+    common::FlashLog log(log_offset, measurement_log_bytes);
+    log.mount();
+    common::FlashLog::Record oldest;
+    if (!log.cursor().next(oldest)) {
+        std::fprintf(stderr, "the log is empty\n");
+        return 1;
+    }
+    // Look up times that records have, so that the search has a header to
+    // look for.
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<uint32_t> numbers(oldest.number, log.end() - 1);
+    std::vector<uint32_t> times(lookups);
+    for (uint32_t& time : times) {
+        time = time_of(numbers(random));
+    }
+
+    const auto found = [&](const char *method, uint32_t time, const common::FlashLog::Record& record) {
+        if (record.time != time) {
+            std::fprintf(stderr, "%s found %u for time %u\n", method, unsigned(record.time), unsigned(time));
+            return false;
+        }
+        return true;
+    };
+
+    const auto index_start = Clock::now();
+    for (const uint32_t time : times) {
+        common::FlashLog::Record record;
+        if (!log.seek_time(time).next(record) || !found("seek_time", time, record)) {
+            return 1;
+        }
+    }
+    const auto index_time = Clock::now() - index_start;
+
+    const auto scan_start = Clock::now();
+    for (const uint32_t time : times) {
+        common::FlashLog::Record record{};
+        auto cursor = log.cursor();
+        while (cursor.next(record) && record.time < time) {
+        }
+        if (!found("the cursor", time, record)) {
+            return 1;
+        }
+    }
+    const auto scan_time = Clock::now() - scan_start;
+
+    const auto* const region = reinterpret_cast<const uint8_t*>(XIP_BASE + log_offset);
+    const auto search_start = Clock::now();
+    for (const uint32_t time : times) {
+        // the time and length in the record's header
+        const uint8_t pattern[] = {
+            uint8_t(time), uint8_t(time >> 8), uint8_t(time >> 16), uint8_t(time >> 24),
+            uint8_t(payload_size), 0};
+        const std::boyer_moore_horspool_searcher searcher(std::begin(pattern), std::end(pattern));
+        const uint8_t *const match = std::search(region, region + measurement_log_bytes, searcher);
+        if (match == region + measurement_log_bytes) {
+            std::fprintf(stderr, "the search didn't find time %u\n", unsigned(time));
+            return 1;
+        }
+    }
+    const auto search_time = Clock::now() - search_start;
+
+    std::printf("lookup by time:           %.2f us with seek_time, %.1f us reading from the oldest, %.1f us searching\n",
+        microseconds(index_time) / lookups, microseconds(scan_time) / lookups, microseconds(search_time) / lookups);
+    return 0;
+}
+
+// Look records up by time in a log, in the region before the measurement
+// log, that's only partly written.
+int measure_partial_lookup(int lookups) {
+    constexpr uint32_t offset = log_offset - measurement_log_bytes;
+    flash_range_erase(offset, measurement_log_bytes);
+    common::FlashLog log(offset, measurement_log_bytes);
+    log.mount();
+    const uint32_t count = measurement_log_bytes / 8 / (common::FlashLog::record_header_size + payload_size);
+    for (uint32_t number = 0; number != count; ++number) {
+        log.append(time_of(number), payload(number));
+        log.erase_ahead();
+    }
+
+    std::mt19937 random(2024);
+    // Records in the page not yet programmed aren't in flash to find.
+    const uint32_t records_per_page = common::FlashLog::page_size / (common::FlashLog::record_header_size + payload_size);
+    std::uniform_int_distribution<uint32_t> numbers(0, count - records_per_page - 1);
+    std::vector<uint32_t> times(lookups);
+    for (uint32_t& time : times) {
+        time = time_of(numbers(random));
+    }
+    const auto start = Clock::now();
+    for (const uint32_t time : times) {
+        common::FlashLog::Record record;
+        if (!log.seek_time(time).next(record) || record.time != time) {
+            std::fprintf(stderr, "seek_time didn't find time %u in a partly written log\n", unsigned(time));
+            return 1;
+        }
+    }
+    const auto elapsed = Clock::now() - start;
+    std::printf("lookup by time, 1/8 full: %.2f us with seek_time\n", microseconds(elapsed) / lookups);
+    return 0;
+}
+
+int lose_power(int trials) {
+    std::mt19937 random(2024);
+    const std::size_t records_per_page =
+        common::FlashLog::page_size / (common::FlashLog::record_header_size + payload_size);
+    unsigned torn_pages = 0;
+    for (int trial = 0; trial < trials; ++trial) {
+        common::FlashLog log(log_offset, measurement_log_bytes);
+        log.mount();
+        const uint32_t first = log.end();
+
+        // Lose power somewhere within the next few sectors' worth.
+        host::lose_power_after(std::uniform_int_distribution<uint64_t>(0, 4 * FLASH_SECTOR_SIZE)(random));
+        uint32_t number = first;
+        while (!host::power_lost()) {
+            const auto bytes = payload(number);
+            log.append(time_of(number), bytes);
+            ++number;
+            log.erase_ahead();
+        }
+        host::restore_power();
+
+        common::FlashLog recovered(log_offset, measurement_log_bytes);
+        recovered.mount();
+        torn_pages += recovered.torn_pages();
+        if (check(recovered) < 0) {
+            return 1;
+        }
+        // The index must still lead to each record, torn sectors and all.
+        common::FlashLog::Record oldest;
+        if (recovered.cursor().next(oldest)) {
+            for (int i = 0; i < 10; ++i) {
+                const uint32_t wanted = std::uniform_int_distribution<uint32_t>(oldest.number, recovered.end() - 1)(random);
+                common::FlashLog::Record record;
+                if (!recovered.seek_number(wanted).next(record) || record.number != wanted) {
+                    std::fprintf(stderr, "seek_number(%u) didn't find it\n", unsigned(wanted));
+                    return 1;
+                }
+            }
+        }
+        if (recovered.end() > number || number - recovered.end() > records_per_page + 1) {
+            std::fprintf(stderr, "appended up to %u, but recovered up to %u\n",
+                unsigned(number), unsigned(recovered.end()));
+            return 1;
+        }
+        // Carry on, and check that the records appended now are read too.
+        for (int i = 0; i < 100; ++i) {
+            const uint32_t next = recovered.end();
+            recovered.append(time_of(next), payload(next));
+            recovered.erase_ahead();
+        }
+        const uint32_t end = recovered.end();
+        common::FlashLog remounted(log_offset, measurement_log_bytes);
+        remounted.mount();
+        if (check(remounted) < 0 || end - remounted.end() > records_per_page) {
+            std::fprintf(stderr, "appending after recovery lost records\n");
+            return 1;
+        }
+    }
+    std::printf("power losses:             %d recovered, %u torn pages skipped\n", trials, torn_pages);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && !host::open_flash_image(argv[1])) {
+        return 1;
+    }
+    return measure_write_amplification() || measure_lookup(1000) || measure_partial_lookup(1000) ||
+        lose_power(200);
+}
@@ -0,0 +1,236 @@
+// `coroutines-format-bench` checks that `common::Format` (see
+// <common/format.h>) writes what `snprintf` wrote before it replaced it, and
+// measures how much faster it is.
+//
+//     usage: coroutines-format-bench
+//
+// First, it compares `Fixed<int32_t, 1000, 1>` with `%.1f` applied to
+// `value / 1000.0f`, as the responses used to be written, for every value
+// from -1000 to 1000 in thousandths, which covers every temperature and
+// humidity that a sensor reports. The two may differ only where the value is
+// exactly halfway between two outputs (e.g. 21.450), where `Fixed` rounds away
+// from zero and `printf`'s answer depends on the float's rounding error. Those
+// ties are counted, and checked to have been rounded away from zero.
+//
+// Next, it compares `Fixed<int32_t, 1000, 3>` with `%.3f` applied to
+// `value / 1000.0`, `Decimal` with `%u`, `%hu`, `%d`, and `%lu`, and `Hex`
+// with `%X`, for random values across each type's range, and with widths and
+// flags. A double holds any int32_t in thousandths closely enough that there
+// are no ties to allow for.
+//
+// Then it writes the coroutines project's measurement response both ways, for
+// random measurements, checks that the two agree (ties aside), and reports the
+// time per response of each.
+//
+// It exits with a nonzero status if any comparison fails.
+
+#include <common/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+double nanoseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+// Print the specified `label`, `expected`, and `actual` text if they differ.
+// Return whether they're the same.
+bool same(const char *label, const char *expected, const char *actual) {
+    if (std::strcmp(expected, actual) == 0) {
+        return true;
+    }
+    std::fprintf(stderr, "%s: expected \"%s\" but got \"%s\"\n", label, expected, actual);
+    return false;
+}
+
+// whether the specified thousandths are exactly halfway between two tenths
+bool is_tie(int32_t milli) {
+    return milli % 100 == 50 || milli % 100 == -50;
+}
+
+// Write the specified `milli` value in tenths to the specified `buffer`,
+// rounded away from zero if it's a tie, as `%.1f` would write it if it had no
+// rounding error.
+void write_rounded_away(char (&buffer)[32], int32_t milli) {
+    // The value one thousandth further from zero isn't a tie.
+    const int32_t nudged = milli + (milli < 0 ? -1 : 1);
+    std::snprintf(buffer, sizeof buffer, "%.1f", nudged / 1000.0);
+}
+
+constexpr char tenths_format[] = "%.1f";
+using Tenths = common::Format<tenths_format, common::Fixed<int32_t, 1000, 1>>;
+
+int check_tenths() {
+    unsigned ties = 0;
+    unsigned ties_that_differ = 0;
+    for (int32_t milli = -1000 * 1000; milli <= 1000 * 1000; ++milli) {
+        char expected[32];
+        std::snprintf(expected, sizeof expected, "%.1f", milli / 1000.0f);
+        std::array<char, Tenths::max_length + 1> actual;
+        Tenths::write(actual, milli);
+        if (is_tie(milli)) {
+            ++ties;
+            char away[32];
+            write_rounded_away(away, milli);
+            if (!same("a tie in tenths", away, actual.data())) {
+                return 1;
+            }
+            ties_that_differ += std::strcmp(expected, actual.data()) != 0;
+        } else if (!same("tenths", expected, actual.data())) {
+            return 1;
+        }
+    }
+    std::printf("%%.1f:                     2000001 values, byte for byte but for %u of %u ties\n",
+        ties_that_differ, ties);
+    return 0;
+}
+
+constexpr char thousandths_format[] = "[%.3f] [%9.3f] [%-9.3f] [%09.3f]";
+using Thousandths = common::Format<thousandths_format,
+    common::Fixed<int32_t, 1000, 3>,
+    common::Fixed<int32_t, 1000, 3>,
+    common::Fixed<int32_t, 1000, 3>,
+    common::Fixed<int32_t, 1000, 3>>;
+
+constexpr char integers_format[] = "%u %hu %d %lu %X %x [%10u] [%-6hu] [%08d] [%4X]";
+using Integers = common::Format<integers_format,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Decimal<int>,
+    common::Decimal<unsigned long>,
+    common::Hex<unsigned>,
+    common::Hex<unsigned>,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Decimal<int>,
+    common::Hex<uint16_t>>;
+
+int check_random(int count) {
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<int32_t> int32s(INT32_MIN, INT32_MAX);
+    std::uniform_int_distribution<uint32_t> uint32s(0, UINT32_MAX);
+    std::uniform_int_distribution<uint16_t> uint16s(0, UINT16_MAX);
+    for (int i = 0; i < count; ++i) {
+        // Small values too, so that the leading zeros and signs are tested.
+        const int32_t milli = i % 2 ? int32s(random) : int32s(random) % 2000;
+        char expected[128];
+        std::snprintf(expected, sizeof expected, thousandths_format,
+            milli / 1000.0, milli / 1000.0, milli / 1000.0, milli / 1000.0);
+        std::array<char, Thousandths::max_length + 1> actual;
+        Thousandths::write(actual, milli, milli, milli, milli);
+        if (!same("thousandths", expected, actual.data())) {
+            return 1;
+        }
+
+        const unsigned u = uint32s(random) >> (i % 32);
+        const uint16_t hu = uint16s(random);
+        const int d = int32s(random) >> (i % 32);
+        const unsigned long lu = uint32s(random);
+        std::snprintf(expected, sizeof expected, integers_format, u, hu, d, lu, u, u, u, hu, d, unsigned(hu));
+        std::array<char, Integers::max_length + 1> integers;
+        Integers::write(integers, u, hu, d, lu, u, u, u, hu, d, hu);
+        if (!same("integers", expected, integers.data())) {
+            return 1;
+        }
+    }
+    std::printf("%%.3f, %%u, %%hu, %%d, %%lu, %%X: %d random values each, byte for byte\n", count);
+    return 0;
+}
+
+// the coroutines project's measurement response body (see ../http_server.cpp)
+#define MEASUREMENT_JSON_FORMAT \
+    "{\"sequence_number\": %u," \
+    " \"CO2_ppm\": %hu," \
+    " \"temperature_celsius\": %.1f," \
+    " \"relative_humidity_percent\": %.1f," \
+    " \"free_bytes\": %lu}"
+
+constexpr char measurement_format[] = MEASUREMENT_JSON_FORMAT;
+using MeasurementBody = common::Format<measurement_format,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Decimal<uint32_t>>;
+
+struct Measurement {
+    unsigned sequence_number;
+    uint16_t co2_ppm;
+    int32_t temperature_millicelsius;
+    int32_t relative_humidity_millipercent;
+    uint32_t free_bytes;
+};
+
+int compare_responses(int count) {
+    std::mt19937 random(2024);
+    std::vector<Measurement> measurements(count);
+    for (unsigned i = 0; i < measurements.size(); ++i) {
+        measurements[i] = {
+            .sequence_number = i,
+            .co2_ppm = uint16_t(std::uniform_int_distribution<int>(400, 5000)(random)),
+            .temperature_millicelsius = std::uniform_int_distribution<int32_t>(-10000, 40000)(random),
+            .relative_humidity_millipercent = std::uniform_int_distribution<int32_t>(0, 100000)(random),
+            .free_bytes = std::uniform_int_distribution<uint32_t>(0, 200000)(random)};
+    }
+
+    std::vector<std::array<char, MeasurementBody::max_length + 1>> expected(count);
+    std::vector<std::array<char, MeasurementBody::max_length + 1>> actual(count);
+
+    const auto snprintf_start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        const Measurement& data = measurements[i];
+        std::snprintf(expected[i].data(), expected[i].size(), MEASUREMENT_JSON_FORMAT,
+            data.sequence_number,
+            data.co2_ppm,
+            data.temperature_millicelsius / 1000.0f,
+            data.relative_humidity_millipercent / 1000.0f,
+            (unsigned long) data.free_bytes);
+    }
+    const auto snprintf_time = Clock::now() - snprintf_start;
+
+    const auto format_start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        const Measurement& data = measurements[i];
+        MeasurementBody::write(actual[i],
+            data.sequence_number,
+            data.co2_ppm,
+            data.temperature_millicelsius,
+            data.relative_humidity_millipercent,
+            data.free_bytes);
+    }
+    const auto format_time = Clock::now() - format_start;
+
+    unsigned with_ties = 0;
+    for (int i = 0; i < count; ++i) {
+        const Measurement& data = measurements[i];
+        if (is_tie(data.temperature_millicelsius) || is_tie(data.relative_humidity_millipercent)) {
+            // `check_tenths` covered these.
+            ++with_ties;
+            continue;
+        }
+        if (!same("response", expected[i].data(), actual[i].data())) {
+            return 1;
+        }
+    }
+
+    std::printf("responses:                %d, byte for byte but for %u having ties\n", count, with_ties);
+    std::printf("response time:            %.0f ns with snprintf, %.0f ns with common::Format\n",
+        nanoseconds(snprintf_time) / count, nanoseconds(format_time) / count);
+    return 0;
+}
+
+#undef MEASUREMENT_JSON_FORMAT
+
+} // namespace
+
+int main() {
+    return check_tenths() || check_random(1000 * 1000) || compare_responses(1000 * 1000);
+}
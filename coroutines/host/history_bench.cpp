@@ -0,0 +1,178 @@
+// `coroutines-history-bench` measures how well `MeasurementHistory` (see
+// ../http_server.h) compresses a trace of measurements, and how long it takes
+// to encode and decode them.
+//
+//     usage: coroutines-history-bench [TRACE]
+//
+// TRACE is a file of JSON lines as returned by a board's "/history", e.g.
+//
+//     curl http://pico.local/history > trace.ndjson
+//
+// Without one, a day of measurements every 5 seconds is made up: readings
+// that wander slowly, and a clock that's a second late now and then. The
+// trace is pushed through the same history that the board keeps, and every
+// sample is checked to decode to what was pushed.
+
+#include "../http_server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TIMESTAMP_COUNTER 1
+#endif
+
+using Clock = std::chrono::steady_clock;
+using Sample = MeasurementHistory::Sample;
+
+namespace {
+
+// Return the samples in the specified `/history` output, or an empty vector if
+// it can't be read.
+std::vector<Sample> read_trace(const char *path) {
+    std::vector<Sample> samples;
+    std::FILE *const file = std::fopen(path, "r");
+    if (!file) {
+        std::perror(path);
+        return samples;
+    }
+    char line[256];
+    while (std::fgets(line, sizeof line, file)) {
+        long time, number, co2;
+        double temperature, humidity;
+        if (std::sscanf(line,
+                "{\"time_seconds\": %ld, \"record_number\": %ld, \"CO2_ppm\": %ld,"
+                " \"temperature_celsius\": %lf, \"relative_humidity_percent\": %lf}",
+                &time, &number, &co2, &temperature, &humidity) != 5) {
+            continue;
+        }
+        Sample sample;
+        sample[TIME_SECONDS] = int32_t(time);
+        sample[RECORD_NUMBER] = int32_t(number);
+        sample[CO2_PPM] = int32_t(co2);
+        sample[TEMPERATURE_CENTICELSIUS] = int32_t(temperature * 100 + (temperature < 0 ? -0.5 : 0.5));
+        sample[RELATIVE_HUMIDITY_CENTIPERCENT] = int32_t(humidity * 100 + 0.5);
+        samples.push_back(sample);
+    }
+    std::fclose(file);
+    return samples;
+}
+
+// Return the specified `count` of made-up samples, one every 5 seconds.
+std::vector<Sample> synthesize_trace(std::size_t count) {
+    std::mt19937 random(2024);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> step(-1, 1);
+    std::vector<Sample> samples;
+    int32_t uptime = 10;
+    int32_t co2 = 450;
+    int32_t temperature = 2150;
+    int32_t humidity = 4500;
+    for (std::size_t i = 0; i < count; ++i) {
+        // The SCD4x's 5 second period, measured by a clock whose seconds
+        // don't quite line up with it.
+        uptime += percent(random) < 5 ? 6 : 5;
+        // CO2 is reported to the ppm and is noisy; temperature and humidity
+        // are reported to hundredths but change slowly.
+        co2 += step(random) * (percent(random) < 30 ? 3 : 1);
+        co2 = co2 < 400 ? 400 : co2;
+        if (percent(random) < 40) {
+            temperature += step(random);
+        }
+        if (percent(random) < 60) {
+            humidity += step(random) * 2;
+        }
+        Sample sample;
+        sample[TIME_SECONDS] = uptime;
+        sample[RECORD_NUMBER] = int32_t(i);
+        sample[CO2_PPM] = co2;
+        sample[TEMPERATURE_CENTICELSIUS] = temperature;
+        sample[RELATIVE_HUMIDITY_CENTIPERCENT] = humidity;
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+uint64_t timestamp_counter() {
+#ifdef HAVE_TIMESTAMP_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::vector<Sample> samples =
+        argc > 1 ? read_trace(argv[1]) : synthesize_trace(24 * 3600 / 5);
+    if (samples.empty()) {
+        std::fprintf(stderr, "no samples\n");
+        return 1;
+    }
+
+    // Too big for the stack. On the board, the history is static.
+    auto history = std::make_unique<MeasurementHistory>();
+
+    const auto encode_start = Clock::now();
+    const uint64_t encode_cycles_start = timestamp_counter();
+    for (const Sample& sample : samples) {
+        history->push(sample);
+    }
+    const uint64_t encode_cycles = timestamp_counter() - encode_cycles_start;
+    const auto encode_time = Clock::now() - encode_start;
+
+    const std::size_t kept = history->size();
+    const std::size_t bits = history->bits();
+
+    const auto decode_start = Clock::now();
+    const uint64_t decode_cycles_start = timestamp_counter();
+    std::size_t decoded = 0;
+    std::size_t mismatches = 0;
+    Sample sample;
+    for (auto cursor = history->cursor(); cursor.next(sample); ++decoded) {
+        mismatches += sample != samples[samples.size() - kept + decoded];
+    }
+    const uint64_t decode_cycles = timestamp_counter() - decode_cycles_start;
+    const auto decode_time = Clock::now() - decode_start;
+
+    if (decoded != kept || mismatches) {
+        std::fprintf(stderr, "decoded %zu of %zu samples kept, %zu mismatched\n",
+            decoded, kept, mismatches);
+        return 1;
+    }
+
+    const double bits_per_sample = double(bits) / kept;
+    const double seconds_kept = samples.back()[TIME_SECONDS] - samples[samples.size() - kept][TIME_SECONDS];
+    // A full history holds about this many samples, each block being as full
+    // as this trace's blocks are.
+    const double capacity = history_bytes * 8 / bits_per_sample;
+    const double seconds_per_sample = kept > 1 ? seconds_kept / (kept - 1) : 0;
+    const auto nanoseconds = [](Clock::duration duration, std::size_t count) {
+        return double(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) / count;
+    };
+
+    std::printf("samples:                  %zu pushed, %zu kept\n", samples.size(), kept);
+    std::printf("bits per sample:          %.1f\n", bits_per_sample);
+    std::printf("compression:              %.1fx a packed 10-byte record, %.1fx a %zu-byte Measurement\n",
+        10 * 8 / bits_per_sample, sizeof(Measurement) * 8 / bits_per_sample, sizeof(Measurement));
+    std::printf("history:                  %zu bytes, about %.0f samples, %.1f hours at %.1f s per sample\n",
+        history_bytes, capacity, capacity * seconds_per_sample / 3600, seconds_per_sample);
+    std::printf("encode:                   %.1f ns per sample", nanoseconds(encode_time, samples.size()));
+#ifdef HAVE_TIMESTAMP_COUNTER
+    std::printf(", %.0f cycles", double(encode_cycles) / samples.size());
+#endif
+    std::printf("\ndecode:                   %.1f ns per sample", nanoseconds(decode_time, kept));
+#ifdef HAVE_TIMESTAMP_COUNTER
+    std::printf(", %.0f cycles", double(decode_cycles) / kept);
+#endif
+    std::printf("\n");
+    (void)encode_cycles;
+    (void)decode_cycles;
+}
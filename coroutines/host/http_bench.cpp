@@ -0,0 +1,142 @@
+// `coroutines-http-bench` measures how long `RequestParser` (see
+// <common/http.h>) takes to parse requests like those that the servers get:
+//
+//     usage: coroutines-http-bench
+//
+// - curl's "GET /latest", with three headers,
+// - a browser's "GET /latest", with a dozen headers, most of them skipped,
+// - a WebSocket upgrade, and
+// - a conditional GET, with If-None-Match.
+//
+// Each is parsed whole, as it would arrive in one TCP segment, and a byte at
+// a time, which is the worst case for a parser that's resumed per segment,
+// and through a `RequestReader<256>`, pipelined a hundred at a time. It
+// reports the time per request and per byte, and checks that each request
+// parsed completely.
+
+#include <common/http.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Sample {
+    const char *name;
+    std::string_view request;
+};
+
+const Sample samples[] = {
+    {"curl", "GET /latest HTTP/1.1\r\n"
+             "Host: pico.local\r\n"
+             "User-Agent: curl/8.5.0\r\n"
+             "Accept: */*\r\n"
+             "\r\n"},
+    {"browser", "GET /latest HTTP/1.1\r\n"
+                "Host: pico.local\r\n"
+                "Connection: keep-alive\r\n"
+                "Cache-Control: max-age=0\r\n"
+                "Upgrade-Insecure-Requests: 1\r\n"
+                "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                "Chrome/126.0.0.0 Safari/537.36\r\n"
+                "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                "Accept-Encoding: gzip, deflate\r\n"
+                "Accept-Language: en-US,en;q=0.9\r\n"
+                "DNT: 1\r\n"
+                "Sec-GPC: 1\r\n"
+                "Referer: http://pico.local/\r\n"
+                "\r\n"},
+    {"websocket", "GET /ws HTTP/1.1\r\n"
+                  "Host: pico.local\r\n"
+                  "Upgrade: websocket\r\n"
+                  "Connection: Upgrade\r\n"
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                  "Sec-WebSocket-Version: 13\r\n"
+                  "\r\n"},
+    {"conditional", "GET /latest HTTP/1.1\r\n"
+                    "Host: pico.local\r\n"
+                    "If-None-Match: \"0123ABCD-1F\"\r\n"
+                    "\r\n"},
+};
+
+double nanoseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+// Parse the specified `request` the specified `count` times, handing it to
+// the parser `piece_size` bytes at a time. Return the time taken, or a
+// negative duration if it didn't parse completely.
+Clock::duration parse(std::string_view request, int count, std::size_t piece_size) {
+    common::RequestParser parser;
+    const auto start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        parser.reset();
+        for (std::size_t offset = 0; offset < request.size(); offset += piece_size) {
+            parser.parse(request.substr(offset, piece_size));
+        }
+        if (parser.status() != common::RequestParser::COMPLETE) {
+            return Clock::duration(-1);
+        }
+    }
+    return Clock::now() - start;
+}
+
+// Parse `pipelined` copies of the specified `request`, sent back to back,
+// through a `RequestReader<256>`, the specified `count` times, receiving as
+// much as fits each time, as a server does. Return the time taken per
+// request, or a negative duration if any didn't parse completely.
+Clock::duration read(std::string_view request, int count, int pipelined) {
+    std::string stream;
+    for (int i = 0; i < pipelined; ++i) {
+        stream += request;
+    }
+    const auto start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        common::RequestReader<256> reader;
+        std::size_t received = 0;
+        for (int parsed = 0; parsed < pipelined; ++parsed) {
+            while (!reader.next()) {
+                const std::size_t size = std::min(stream.size() - received, std::size_t(reader.free_size()));
+                std::memcpy(reader.free_space(), stream.data() + received, size);
+                reader.received(int(size));
+                received += size;
+            }
+            if (reader.status() != common::RequestParser::COMPLETE) {
+                return Clock::duration(-1);
+            }
+        }
+    }
+    return (Clock::now() - start) / pipelined;
+}
+
+} // namespace
+
+int main() {
+    const int count = 200 * 1000;
+    const int pipelined = 100;
+    std::printf("%-12s %6s %18s %18s %18s\n", "request", "bytes", "whole", "a byte at a time", "RequestReader");
+    for (const Sample& sample : samples) {
+        const auto whole = parse(sample.request, count, sample.request.size());
+        const auto bytewise = parse(sample.request, count, 1);
+        const auto reader = read(sample.request, count / pipelined, pipelined);
+        if (whole.count() < 0 || bytewise.count() < 0 || reader.count() < 0) {
+            std::fprintf(stderr, "the %s request didn't parse\n", sample.name);
+            return 1;
+        }
+        const double size = double(sample.request.size());
+        const double whole_ns = nanoseconds(whole) / count;
+        const double bytewise_ns = nanoseconds(bytewise) / count;
+        const double reader_ns = nanoseconds(reader) / (count / pipelined);
+        std::printf("%-12s %6zu %7.0f ns %4.2f/B %7.0f ns %4.2f/B %7.0f ns %4.2f/B\n",
+            sample.name, sample.request.size(),
+            whole_ns, whole_ns / size, bytewise_ns, bytewise_ns / size, reader_ns, reader_ns / size);
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+// `coroutines-http-fuzz` is a fuzz target for `RequestParser` and
+// `RequestReader` (see <common/http.h>). For each input, it parses the input
+// as a stream of pipelined requests several ways:
+//
+// - all at once,
+// - one byte at a time,
+// - split at points taken from the input itself, and
+// - through a `RequestReader<256>`, received in pieces of those sizes,
+//
+// and checks that each way finds the same requests, with the same fields,
+// ending at the same offsets: how the bytes arrive mustn't matter. It also
+// checks that the parser never consumes more than it's given, that a request
+// whose line and headers exceed `max_header_bytes` isn't accepted, and that
+// the parsed fields (or the items of a repeated header's) are ones that the
+// input contains. The helpers that the
+// servers apply to parsed fields (`has_token`, `accepts_media_type`,
+// `query_parameter`, `etag_matches`) are run on them too, so that the
+// sanitizers see them.
+//
+// Built with Clang and -DLIBFUZZER=ON, it's a libFuzzer target. Otherwise it
+// has its own driver:
+//
+//     usage: coroutines-http-fuzz [INPUT_FILE...]
+//
+// which runs the given inputs, or, without any, a few hundred thousand inputs
+// made by mutating well-formed requests at random. Build it with sanitizers
+// (-DSANITIZE=address,undefined) to catch out-of-bounds reads and writes. A
+// failed check aborts.
+
+#include <common/http.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// `Parsed` is what the parser made of one request.
+struct Parsed {
+    common::RequestParser::Status status;
+    // offset in the input of the request's end
+    std::size_t end;
+    std::string method;
+    std::string path;
+    std::string query;
+    int minor_version;
+    std::string connection;
+    std::string accept;
+    std::string if_none_match;
+    std::string last_event_id;
+    std::string upgrade;
+    std::string sec_websocket_key;
+    std::string sec_websocket_version;
+    std::uint32_t content_length;
+    bool keep_alive;
+
+    bool operator==(const Parsed&) const = default;
+};
+
+void check(bool condition, const char *what) {
+    if (!condition) {
+        std::fprintf(stderr, "check failed: %s\n", what);
+        std::abort();
+    }
+}
+
+Parsed describe(const common::RequestParser& parser, std::size_t end) {
+    const common::Request& request = parser.request();
+    return {
+        .status = parser.status(),
+        .end = end,
+        .method = std::string(request.method.view()),
+        .path = std::string(request.path.view()),
+        .query = std::string(request.query.view()),
+        .minor_version = request.minor_version,
+        .connection = std::string(request.connection.view()),
+        .accept = std::string(request.accept.view()),
+        .if_none_match = std::string(request.if_none_match.view()),
+        .last_event_id = std::string(request.last_event_id.view()),
+        .upgrade = std::string(request.upgrade.view()),
+        .sec_websocket_key = std::string(request.sec_websocket_key.view()),
+        .sec_websocket_version = std::string(request.sec_websocket_version.view()),
+        .content_length = request.content_length,
+        .keep_alive = request.keep_alive()};
+}
+
+// Check what can be checked of the specified `request`, parsed from the
+// specified `input`.
+void check_request(const Parsed& request, std::string_view input) {
+    if (request.status != common::RequestParser::COMPLETE) {
+        return;
+    }
+    check(!request.method.empty(), "a complete request has a method");
+    check(request.minor_version == 0 || request.minor_version == 1, "the version is HTTP/1.0 or HTTP/1.1");
+    for (const std::string *field : {
+            &request.method, &request.path, &request.query, &request.connection, &request.accept,
+            &request.if_none_match, &request.last_event_id, &request.upgrade,
+            &request.sec_websocket_key, &request.sec_websocket_version}) {
+        // A repeated header's values are joined with commas.
+        for (std::string_view list = *field; !list.empty();) {
+            check(input.find(common::next_list_item(list)) != std::string_view::npos,
+                "each field is in the input");
+        }
+    }
+
+    // The servers do these with the fields.
+    common::has_token(request.connection, "close");
+    common::has_token(request.upgrade, "websocket");
+    common::accepts_media_type(request.accept, "application/cbor");
+    common::accepts_media_type(request.accept, "text/event-stream");
+    common::query_parameter(request.query, "after");
+    common::query_parameter(request.query, "co2_above");
+    common::etag_matches(request.if_none_match, "\"0123ABCD-1F\"");
+}
+
+// Parse the specified `input`, handing it to the parser in pieces whose sizes
+// `piece_size` returns in turn. Return the requests found, up to and
+// including the first that isn't complete.
+template <typename PieceSize>
+std::vector<Parsed> parse_in_pieces(std::string_view input, PieceSize piece_size) {
+    std::vector<Parsed> requests;
+    common::RequestParser parser;
+    std::size_t offset = 0;
+    std::size_t start = 0;
+    while (offset < input.size()) {
+        const std::size_t size = std::min(piece_size(), input.size() - offset);
+        const std::string_view piece = input.substr(offset, size);
+        const std::size_t consumed = parser.parse(piece);
+        check(consumed <= piece.size(), "the parser consumes at most what it's given");
+        offset += consumed;
+        if (parser.status() == common::RequestParser::INCOMPLETE) {
+            check(consumed == piece.size(), "an incomplete request consumes all that it's given");
+            continue;
+        }
+        requests.push_back(describe(parser, offset));
+        check_request(requests.back(), input);
+        if (parser.status() != common::RequestParser::COMPLETE) {
+            return requests;
+        }
+        check(offset - start - parser.request().content_length <= common::RequestParser::max_header_bytes,
+            "a complete request's line and headers fit in max_header_bytes");
+        parser.reset();
+        start = offset;
+    }
+    requests.push_back(describe(parser, offset));
+    return requests;
+}
+
+// Parse the specified `input` with a `RequestReader`, receiving it in pieces
+// whose sizes `piece_size` returns in turn, as a server does.
+template <typename PieceSize>
+std::vector<Parsed> read_in_pieces(std::string_view input, PieceSize piece_size) {
+    std::vector<Parsed> requests;
+    common::RequestReader<256> reader;
+    std::size_t received = 0;
+    for (;;) {
+        while (!reader.next()) {
+            if (received == input.size()) {
+                requests.push_back(describe(reader.parser(), received));
+                return requests;
+            }
+            const std::size_t size = std::min({
+                piece_size(), input.size() - received, std::size_t(reader.free_size())});
+            std::memcpy(reader.free_space(), input.data() + received, size);
+            reader.received(int(size));
+            received += size;
+        }
+        // The reader may have received past this request, so its end isn't
+        // known here. Compare it as though it were at the end of the input.
+        requests.push_back(describe(reader.parser(), input.size()));
+        if (reader.status() != common::RequestParser::COMPLETE) {
+            return requests;
+        }
+    }
+}
+
+// Return `requests` with each end replaced by the end of the input, as
+// `read_in_pieces` reports them.
+std::vector<Parsed> without_ends(std::vector<Parsed> requests, std::size_t end) {
+    for (Parsed& request : requests) {
+        request.end = end;
+    }
+    return requests;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size) {
+    const std::string_view input(reinterpret_cast<const char*>(data), size);
+
+    const std::vector<Parsed> whole = parse_in_pieces(input, [&] { return input.size(); });
+    check(parse_in_pieces(input, [] { return std::size_t(1); }) == whole,
+        "parsing a byte at a time finds the same requests");
+
+    // Split at sizes taken from the input, so that the fuzzer explores them.
+    std::size_t next_size = 0;
+    const auto input_sizes = [&] {
+        const std::size_t result = size ? 1 + std::uint8_t(input[next_size % size]) % 97 : 1;
+        ++next_size;
+        return result;
+    };
+    check(parse_in_pieces(input, input_sizes) == whole,
+        "parsing in pieces finds the same requests");
+
+    next_size = 0;
+    const std::vector<Parsed> expected = without_ends(whole, size);
+    check(read_in_pieces(input, input_sizes) == expected,
+        "a RequestReader finds the same requests");
+    check(read_in_pieces(input, [] { return std::size_t(1); }) == expected,
+        "a RequestReader receiving a byte at a time finds the same requests");
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+namespace {
+
+// well-formed requests, some pipelined, to mutate
+const char *const seeds[] = {
+    "GET /latest HTTP/1.1\r\nHost: pico\r\n\r\n",
+    "GET /latest?after=12 HTTP/1.1\r\nHost: pico\r\nAccept: application/cbor, application/json;q=0.5\r\n\r\n",
+    "GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\nGET /metrics HTTP/1.0\r\n\r\n",
+    "GET /latest HTTP/1.1\r\nIf-None-Match: W/\"0123ABCD-1F\", \"0123ABCD-20\"\r\n\r\n",
+    "GET /stream HTTP/1.1\r\nAccept: text/event-stream\r\nLast-Event-ID: 41\r\n\r\n",
+    "GET /ws HTTP/1.1\r\nHost: pico\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+    "POST /latest HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET /history HTTP/1.1\r\n\r\n",
+    "GET /wait?co2_above=1000 HTTP/1.1\r\nConnection: close\r\nX-Long: aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n\r\n",
+};
+
+// fragments to splice in, so that mutations reach the parser's edge cases
+const char *const fragments[] = {
+    "\r\n", "\n", " ", "\t", ":", "?", "HTTP/1.1", "HTTP/1.0", "HTTP/1.10", "Content-Length: ",
+    "Connection: ", "Accept: ", "If-None-Match: ", "Upgrade: ", "4294967296", "99999", "\r\n\r\n",
+};
+
+std::string mutate(std::string input, std::mt19937& random) {
+    const auto pick = [&](std::size_t bound) {
+        return std::uniform_int_distribution<std::size_t>(0, bound)(random);
+    };
+    for (std::size_t mutations = 1 + pick(7); mutations; --mutations) {
+        const std::size_t at = pick(input.size());
+        switch (pick(5)) {
+        case 0:
+            if (at < input.size()) {
+                input[at] = char(random());
+            }
+            break;
+        case 1:
+            input.insert(at, 1, char(random()));
+            break;
+        case 2:
+            input.erase(at, pick(8));
+            break;
+        case 3:
+            input.insert(at, fragments[pick(std::size(fragments) - 1)]);
+            break;
+        case 4:
+            input.insert(at, std::string(pick(300), char('a' + pick(25))));
+            break;
+        case 5:
+            input.insert(at, seeds[pick(std::size(seeds) - 1)]);
+            break;
+        }
+    }
+    return input;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            std::ifstream file(argv[i], std::ios::binary);
+            if (!file) {
+                std::perror(argv[i]);
+                return 1;
+            }
+            const std::string input{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+            LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+        }
+        std::printf("%d inputs passed\n", argc - 1);
+        return 0;
+    }
+
+    std::mt19937 random(2024);
+    const int runs = 300 * 1000;
+    for (int run = 0; run < runs; ++run) {
+        const std::string input = run < int(std::size(seeds)) ? seeds[run] :
+            mutate(seeds[run % std::size(seeds)], random);
+        LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+    }
+    std::printf("%d inputs passed\n", runs);
+    return 0;
+}
+
+#endif
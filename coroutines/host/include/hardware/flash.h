@@ -0,0 +1,50 @@
+#pragma once
+
+// A stand-in for the Pico SDK's <hardware/flash.h> on Linux. The flash is a
+// memory mapping, either of a file, so that what's written survives a
+// restart, as it does on the board, or, until `open_flash_image` is called, of
+// anonymous memory. Its contents are at `XIP_BASE` (see
+// <hardware/regs/addressmap.h>), as on the board.
+//
+// As with NOR flash, erasing sets a sector's bits, and programming can only
+// clear bits. The stand-in also counts erases and bytes programmed, and can
+// lose power partway through an operation, for testing recovery.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+// the Pico 2 W's, for which the coroutines project is built
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (4 * 1024 * 1024)
+#endif
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+namespace host {
+
+// Map the flash onto the file at the specified `path`, creating it, erased,
+// if need be. Return false if that fails.
+bool open_flash_image(const char *path);
+
+// Return the address at which the flash is mapped.
+uintptr_t flash_address();
+
+// Return how many times each sector has been erased.
+const std::vector<unsigned>& flash_erase_counts();
+
+// Return the number of bytes programmed.
+uint64_t flash_bytes_programmed();
+
+// Lose power once the specified number of `bytes` more have been erased or
+// programmed, partway through whichever operation that is. Until
+// `restore_power` is called, erasing and programming do nothing.
+void lose_power_after(uint64_t bytes);
+void restore_power();
+bool power_lost();
+
+} // namespace host
@@ -0,0 +1,8 @@
+#pragma once
+
+// A stand-in for the Pico SDK's <hardware/regs/addressmap.h> on Linux: where
+// flash is mapped. See <hardware/flash.h>.
+
+#include <hardware/flash.h>
+
+#define XIP_BASE (host::flash_address())
@@ -0,0 +1,12 @@
+#pragma once
+
+// A stand-in for the Pico SDK's <hardware/sync.h> on Linux. There are no
+// interrupts to disable.
+
+#include <cstdint>
+
+inline uint32_t save_and_disable_interrupts() {
+    return 0;
+}
+
+inline void restore_interrupts(uint32_t) {}
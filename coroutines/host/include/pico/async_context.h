@@ -0,0 +1,68 @@
+#pragma once
+
+// A stand-in for the Pico SDK's async_context on Linux. It waits on epoll for
+// sockets to become ready, and on a timer queue for sleeps to finish, and then
+// resumes the coroutines waiting on them. Everything runs on one thread, as
+// on the board.
+//
+// There is one context per process, `host_async_context()`, because
+// `picoro::listen` doesn't take a context; on the board, lwIP is likewise
+// global.
+
+#include <pico/time.h>
+
+#include <coroutine>
+#include <map>
+#include <vector>
+
+namespace host {
+
+// An operation on a socket that couldn't finish right away, e.g. a receive
+// with nothing yet to receive.
+struct Operation {
+    std::coroutine_handle<> waiting;
+
+    // Try again to finish the operation. Return whether it's done, either
+    // successfully or not, in which case `waiting` is resumed.
+    virtual bool attempt() = 0;
+
+ protected:
+    ~Operation() = default;
+};
+
+// What is waiting on a socket. Each socket has one of these, registered with
+// epoll for the lifetime of the socket.
+struct Waiters {
+    Operation *reader = nullptr;
+    Operation *writer = nullptr;
+    // whether the socket has been closed, in which case this object is
+    // deleted after the current batch of events
+    bool closed = false;
+};
+
+} // namespace host
+
+struct async_context_t {
+    int epoll_fd;
+    // coroutines sleeping until the specified time
+    std::multimap<absolute_time_t, std::coroutine_handle<>> timers;
+    // `Waiters` of sockets closed while handling the current batch of events
+    std::vector<host::Waiters*> closed;
+};
+
+async_context_t *host_async_context();
+
+namespace host {
+
+// Watch the specified socket `fd` for readiness, and return its `Waiters`.
+Waiters *watch(async_context_t *ctx, int fd);
+
+// Stop watching the socket whose `Waiters` are the specified `waiters`, and
+// close the specified `fd`.
+void close(async_context_t *ctx, int fd, Waiters *waiters);
+
+// Wait until a socket is ready or a timer expires, and resume whatever was
+// waiting on it.
+void poll(async_context_t *ctx);
+
+} // namespace host
@@ -0,0 +1,11 @@
+#pragma once
+
+// A stand-in for the Pico SDK's <pico/rand.h> on Linux.
+
+#include <cstdint>
+#include <random>
+
+inline uint32_t get_rand_32() {
+    static std::random_device device;
+    return device();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// A stand-in for the Pico SDK's <pico/time.h> on Linux: the parts of it that
+// the HTTP server uses. Time is measured in microseconds since the process
+// started, as on the board it is measured since boot.
+
+#include <cstdint>
+
+typedef uint64_t absolute_time_t;
+
+constexpr absolute_time_t at_the_end_of_time = UINT64_MAX;
+
+absolute_time_t get_absolute_time();
+
+inline uint64_t to_us_since_boot(absolute_time_t time) {
+    return time;
+}
+
+inline absolute_time_t make_timeout_time_ms(uint32_t ms) {
+    return get_absolute_time() + uint64_t(ms) * 1000;
+}
+
+inline bool time_reached(absolute_time_t time) {
+    return get_absolute_time() >= time;
+}
+
+inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return int64_t(to - from);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// A stand-in for picoro's <picoro/debug.h> on Linux. Logging every request
+// would dominate a load test, so messages are printed only if
+// `PICORO_HOST_DEBUG` is defined.
+
+#include <cstdio>
+
+namespace picoro {
+
+template <typename... Args>
+void debug([[maybe_unused]] const char *format, [[maybe_unused]] Args... args) {
+#ifdef PICORO_HOST_DEBUG
+    std::fprintf(stderr, format, args...);
+#endif
+}
+
+} // namespace picoro
@@ -0,0 +1,15 @@
+#pragma once
+
+// A stand-in for picoro's <picoro/event_loop.h> on Linux, built on the host's
+// `async_context_t` (see <pico/async_context.h>).
+
+#include <pico/async_context.h>
+
+// Keep the specified `coroutines` alive, and resume them and everything else
+// as they become ready. Run forever.
+template <typename... Coroutines>
+void run_event_loop(async_context_t *ctx, [[maybe_unused]] Coroutines&&... coroutines) {
+    for (;;) {
+        host::poll(ctx);
+    }
+}
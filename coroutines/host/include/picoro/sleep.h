@@ -0,0 +1,34 @@
+#pragma once
+
+// A stand-in for picoro's <picoro/sleep.h> on Linux, built on the host's
+// `async_context_t` (see <pico/async_context.h>).
+
+#include <pico/async_context.h>
+#include <pico/time.h>
+
+#include <chrono>
+#include <coroutine>
+
+namespace picoro {
+
+class Sleep {
+    async_context_t *ctx;
+    absolute_time_t deadline;
+
+ public:
+    Sleep(async_context_t *ctx, absolute_time_t deadline)
+    : ctx(ctx)
+    , deadline(deadline) {}
+
+    bool await_ready() const { return time_reached(deadline); }
+    void await_suspend(std::coroutine_handle<> waiting) { ctx->timers.emplace(deadline, waiting); }
+    void await_resume() const {}
+};
+
+template <typename Rep, typename Period>
+Sleep sleep_for(async_context_t *ctx, std::chrono::duration<Rep, Period> delay) {
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(delay);
+    return Sleep(ctx, get_absolute_time() + us.count());
+}
+
+} // namespace picoro
@@ -0,0 +1,140 @@
+#pragma once
+
+// A stand-in for picoro's <picoro/tcp.h> on Linux: the same `listen`,
+// `Listener`, and `Connection`, built on nonblocking POSIX sockets and the
+// host's `async_context_t` (see <pico/async_context.h>). Errors are reported
+// with lwIP's codes, as on the board.
+//
+// As with lwIP, a `send` completes once all of its data has been handed to
+// the kernel, and `close` makes any pending `recv` or `send` complete with an
+// error.
+
+#include <pico/async_context.h>
+
+#include <lwip/err.h>
+
+#include <coroutine>
+#include <string_view>
+#include <utility>
+
+namespace picoro {
+
+class Connection {
+    int fd = -1;
+    host::Waiters *waiters = nullptr;
+    bool closed = false;
+
+ public:
+    class Receive;
+    class Send;
+
+    Connection() = default;
+    explicit Connection(int fd);
+    Connection(Connection&& other);
+    Connection& operator=(Connection&& other);
+    Connection(const Connection&) = delete;
+    ~Connection();
+
+    // Receive at most the specified `size` bytes into the specified `buffer`.
+    // `co_await` the result to get the number of bytes received and an error.
+    Receive recv(char *buffer, int size);
+
+    // Send all of the specified `data`. `co_await` the result to get the
+    // number of bytes sent and an error.
+    Send send(std::string_view data);
+
+    // Shut down the connection. Pending and future operations fail.
+    err_t close();
+};
+
+class Connection::Receive : host::Operation {
+    Connection *conn;
+    char *buffer;
+    int size;
+    std::pair<int, err_t> result{0, ERR_OK};
+
+ public:
+    Receive(Connection *conn, char *buffer, int size)
+    : conn(conn)
+    , buffer(buffer)
+    , size(size) {}
+
+    bool attempt() override;
+
+    bool await_ready() { return attempt(); }
+    void await_suspend(std::coroutine_handle<> waiting);
+    std::pair<int, err_t> await_resume() const { return result; }
+};
+
+class Connection::Send : host::Operation {
+    Connection *conn;
+    std::string_view data;
+    int sent = 0;
+    err_t err = ERR_OK;
+
+ public:
+    Send(Connection *conn, std::string_view data)
+    : conn(conn)
+    , data(data) {}
+
+    bool attempt() override;
+
+    bool await_ready() { return attempt(); }
+    void await_suspend(std::coroutine_handle<> waiting);
+    std::pair<int, err_t> await_resume() const { return {sent, err}; }
+};
+
+inline
+Connection::Receive Connection::recv(char *buffer, int size) {
+    return Receive(this, buffer, size);
+}
+
+inline
+Connection::Send Connection::send(std::string_view data) {
+    return Send(this, data);
+}
+
+class Listener {
+    int fd = -1;
+    host::Waiters *waiters = nullptr;
+
+ public:
+    class Accept;
+
+    Listener() = default;
+    explicit Listener(int fd);
+    Listener(Listener&& other);
+    Listener(const Listener&) = delete;
+    ~Listener();
+
+    // `co_await` the result to get the next connection and an error.
+    Accept accept();
+};
+
+class Listener::Accept : host::Operation {
+    Listener *listener;
+    Connection conn;
+    err_t err = ERR_OK;
+
+ public:
+    explicit Accept(Listener *listener)
+    : listener(listener) {}
+
+    bool attempt() override;
+
+    bool await_ready() { return attempt(); }
+    void await_suspend(std::coroutine_handle<> waiting);
+    std::pair<Connection, err_t> await_resume() { return {std::move(conn), err}; }
+};
+
+inline
+Listener::Accept Listener::accept() {
+    return Accept(this);
+}
+
+// Listen for connections on the specified `port` of every interface.
+std::pair<Listener, err_t> listen(int port, int backlog);
+
+const char *lwip_describe(err_t err);
+
+} // namespace picoro
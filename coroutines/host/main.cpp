@@ -0,0 +1,60 @@
+// `coroutines-host` runs the coroutines project's HTTP server on Linux, with
+// made-up measurements in place of the SCD4x sensor's.
+//
+//     usage: coroutines-host [PORT [MEASUREMENT_PERIOD_MS [FLASH_IMAGE]]]
+//
+// By default, it listens on port 8080 and publishes a measurement every five
+// seconds, as the sensor does. The measurements are logged to the flash image
+// file, if one is given, so that they're restored when the server restarts,
+// as they are when the board resets. Otherwise, flash is in memory.
+
+#include <hardware/flash.h>
+#include <pico/async_context.h>
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <picoro/coroutine.h>
+#include <picoro/event_loop.h>
+#include <picoro/sleep.h>
+
+#include "../http_server.h"
+
+// The board's heap is about this large. Admission control compares free heap
+// against its limits, so pretend to have the same heap, less what is in use.
+constexpr uint32_t emulated_heap_bytes = 256 * 1024;
+
+uint32_t get_free_heap() {
+    const struct mallinfo2 m = mallinfo2();
+    return emulated_heap_bytes - std::min<std::size_t>(m.uordblks, emulated_heap_bytes);
+}
+
+// Publish a measurement now, and then one every specified `period`.
+picoro::Coroutine<void> simulate_scd4x(async_context_t *ctx, std::chrono::milliseconds period) {
+    for (unsigned i = 0;; ++i) {
+        publish({
+            .co2_ppm = uint16_t(600 + i % 400),
+            .temperature_millicelsius = 21'000 + int32_t(i % 50) * 100,
+            .relative_humidity_millipercent = 45'000 + int32_t(i % 20) * 500});
+        co_await picoro::sleep_for(ctx, period);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int port = argc > 1 ? std::atoi(argv[1]) : 8080;
+    const auto period = std::chrono::milliseconds(argc > 2 ? std::atoi(argv[2]) : 5000);
+    const int listen_backlog = 128;
+    if (argc > 3 && !host::open_flash_image(argv[3])) {
+        return 1;
+    }
+    restore_history();
+
+    async_context_t *const ctx = host_async_context();
+    std::printf("Serving HTTP on port %d\n", port);
+    std::fflush(stdout);
+    run_event_loop(ctx, simulate_scd4x(ctx, period), serve_http(ctx, port, listen_backlog));
+}
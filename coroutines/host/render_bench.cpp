@@ -0,0 +1,162 @@
+// `coroutines-render-bench` measures what `RenderCache` (see
+// <common/render_cache.h>) saves when several clients are sent each
+// measurement, as streaming clients are.
+//
+//     usage: coroutines-render-bench
+//
+// For each number of subscribers, it publishes measurements, and has every
+// subscriber get each one's text two ways: by formatting it into a buffer of
+// its own, as each client did before the cache, and from a `RenderCache`
+// shared by all of them. It reports the time per publish and the renders per
+// publish of each, and checks that the cache renders each measurement once,
+// that every subscriber gets the same text either way, and that a subscriber
+// that lags behind doesn't evict the text that the others are sending.
+//
+// It exits with a nonzero status if any check fails.
+
+#include <common/format.h>
+#include <common/render_cache.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Measurement {
+    unsigned sequence_number;
+    uint16_t co2_ppm;
+    int32_t temperature_millicelsius;
+    int32_t relative_humidity_millipercent;
+    uint32_t free_bytes;
+};
+
+// the measurement's JSON, as the response and chunk caches hold it (see
+// ../http_server.cpp)
+constexpr char measurement_format[] =
+    "{\"sequence_number\": %u,"
+    " \"CO2_ppm\": %hu,"
+    " \"temperature_celsius\": %.1f,"
+    " \"relative_humidity_percent\": %.1f,"
+    " \"free_bytes\": %lu}\n";
+
+using Body = common::Format<measurement_format,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Fixed<int32_t, 1000, 1>,
+    common::Decimal<uint32_t>>;
+
+using Buffer = std::array<char, Body::max_length + 1>;
+
+int render(Buffer& buffer, const Measurement& data) {
+    return Body::write(buffer, data.sequence_number, data.co2_ppm,
+        data.temperature_millicelsius, data.relative_humidity_millipercent, data.free_bytes);
+}
+
+Measurement measurement(unsigned sequence_number) {
+    return {
+        .sequence_number = sequence_number,
+        .co2_ppm = uint16_t(600 + sequence_number % 400),
+        .temperature_millicelsius = 21'000 + int32_t(sequence_number % 50) * 100,
+        .relative_humidity_millipercent = 45'000 + int32_t(sequence_number % 20) * 500,
+        .free_bytes = 150'000 - sequence_number % 1000};
+}
+
+double nanoseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+// a checksum of what `send` was given, so that formatting isn't optimized away
+unsigned long sent_checksum = 0;
+
+// Stand in for sending the specified `text`.
+void send(std::string_view text) {
+    sent_checksum += text.size() + std::uint8_t(text[text.size() / 2]);
+}
+
+int measure(int subscribers, unsigned publishes) {
+    std::vector<Buffer> buffers(subscribers);
+    const auto own_start = Clock::now();
+    for (unsigned sequence_number = 1; sequence_number <= publishes; ++sequence_number) {
+        const Measurement data = measurement(sequence_number);
+        for (Buffer& buffer : buffers) {
+            const int length = render(buffer, data);
+            send(std::string_view(buffer.data(), length));
+        }
+    }
+    const auto own_time = Clock::now() - own_start;
+
+    common::RenderCache<Body::max_length + 1> cache;
+    std::vector<std::shared_ptr<const common::Rendered<Body::max_length + 1>>> held(subscribers);
+    const auto cache_start = Clock::now();
+    for (unsigned sequence_number = 1; sequence_number <= publishes; ++sequence_number) {
+        const Measurement data = measurement(sequence_number);
+        // Each subscriber holds its text until it gets the next, as it would
+        // across `co_await conn.send(...)`.
+        for (auto& text : held) {
+            text = cache.get(sequence_number, [&](Buffer& buffer) { return render(buffer, data); });
+            send(text->text());
+        }
+    }
+    const auto cache_time = Clock::now() - cache_start;
+
+    if (cache.renders() != publishes) {
+        std::fprintf(stderr, "%d subscribers: %u renders for %u publishes\n",
+            subscribers, cache.renders(), publishes);
+        return 1;
+    }
+    Buffer expected;
+    const int expected_length = render(expected, measurement(publishes));
+    for (const auto& text : held) {
+        if (text->text() != std::string_view(expected.data(), expected_length)) {
+            std::fprintf(stderr, "%d subscribers: the cached text differs\n", subscribers);
+            return 1;
+        }
+    }
+
+    std::printf("%11d %10.0f ns %5.1f %10.0f ns %5.1f %8.1fx\n",
+        subscribers,
+        nanoseconds(own_time) / publishes, double(subscribers),
+        nanoseconds(cache_time) / publishes, double(cache.renders()) / publishes,
+        nanoseconds(own_time) / nanoseconds(cache_time));
+    return 0;
+}
+
+// Check that a subscriber asking for an older measurement gets its text
+// without evicting the latest.
+int check_lagging() {
+    common::RenderCache<Body::max_length + 1> cache;
+    const auto get = [&](unsigned sequence_number) {
+        return cache.get(sequence_number, [&](Buffer& buffer) { return render(buffer, measurement(sequence_number)); });
+    };
+    const auto newest = get(10);
+    const auto older = get(9);
+    const auto again = get(10);
+    if (older->sequence_number != 9 || again != newest || cache.renders() != 2) {
+        std::fprintf(stderr, "a lagging subscriber evicted the latest text\n");
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main() {
+    const unsigned publishes = 200 * 1000;
+    std::printf("%11s %13s %5s %13s %5s %9s\n",
+        "subscribers", "own buffers", "rend.", "RenderCache", "rend.", "speedup");
+    for (const int subscribers : {1, 2, 4, 8, 16, 32}) {
+        if (measure(subscribers, publishes)) {
+            return 1;
+        }
+    }
+    std::printf("(time per publish; checksum %lu)\n", sent_checksum);
+    return check_lagging();
+}
@@ -0,0 +1,198 @@
+#include <picoro/tcp.h>
+
+#include <pico/async_context.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <utility>
+
+namespace picoro {
+namespace {
+
+// Return the lwIP error code closest to the specified `errno` value.
+err_t from_errno(int error) {
+    switch (error) {
+    case EAGAIN: return ERR_WOULDBLOCK;
+    case EADDRINUSE: return ERR_USE;
+    case ECONNRESET: return ERR_RST;
+    case ECONNABORTED: return ERR_ABRT;
+    case EPIPE:
+    case ENOTCONN:
+    case ESHUTDOWN: return ERR_CLSD;
+    case ENOMEM:
+    case ENOBUFS:
+    case EMFILE:
+    case ENFILE: return ERR_MEM;
+    case ETIMEDOUT: return ERR_TIMEOUT;
+    case EINVAL: return ERR_ARG;
+    }
+    return ERR_CONN;
+}
+
+} // namespace
+
+Connection::Connection(int fd)
+: fd(fd)
+, waiters(host::watch(host_async_context(), fd)) {
+    // Responses are sent whole, so don't wait to coalesce them.
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+}
+
+Connection::Connection(Connection&& other)
+: fd(std::exchange(other.fd, -1))
+, waiters(std::exchange(other.waiters, nullptr))
+, closed(other.closed) {}
+
+Connection& Connection::operator=(Connection&& other) {
+    Connection doomed(std::move(*this));
+    fd = std::exchange(other.fd, -1);
+    waiters = std::exchange(other.waiters, nullptr);
+    closed = other.closed;
+    return *this;
+}
+
+Connection::~Connection() {
+    if (fd != -1) {
+        host::close(host_async_context(), fd, waiters);
+    }
+}
+
+err_t Connection::close() {
+    if (fd == -1) {
+        return ERR_CLSD;
+    }
+    closed = true;
+    // The resulting hangup wakes up pending operations, which then fail.
+    ::shutdown(fd, SHUT_RDWR);
+    return ERR_OK;
+}
+
+bool Connection::Receive::attempt() {
+    if (conn->closed) {
+        result = {0, ERR_CLSD};
+        return true;
+    }
+    const ssize_t rc = ::recv(conn->fd, buffer, size, 0);
+    if (rc > 0) {
+        result = {int(rc), ERR_OK};
+    } else if (rc == 0) {
+        // The client closed its end.
+        result = {0, ERR_CLSD};
+    } else if (errno == EAGAIN || errno == EINTR) {
+        return false;
+    } else {
+        result = {0, from_errno(errno)};
+    }
+    return true;
+}
+
+void Connection::Receive::await_suspend(std::coroutine_handle<> waiting) {
+    this->waiting = waiting;
+    conn->waiters->reader = this;
+}
+
+bool Connection::Send::attempt() {
+    while (sent < int(data.size())) {
+        if (conn->closed) {
+            err = ERR_CLSD;
+            return true;
+        }
+        const ssize_t rc = ::send(conn->fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (rc >= 0) {
+            sent += rc;
+        } else if (errno == EAGAIN || errno == EINTR) {
+            return false;
+        } else {
+            err = from_errno(errno);
+            return true;
+        }
+    }
+    return true;
+}
+
+void Connection::Send::await_suspend(std::coroutine_handle<> waiting) {
+    this->waiting = waiting;
+    conn->waiters->writer = this;
+}
+
+Listener::Listener(int fd)
+: fd(fd)
+, waiters(host::watch(host_async_context(), fd)) {}
+
+Listener::Listener(Listener&& other)
+: fd(std::exchange(other.fd, -1))
+, waiters(std::exchange(other.waiters, nullptr)) {}
+
+Listener::~Listener() {
+    if (fd != -1) {
+        host::close(host_async_context(), fd, waiters);
+    }
+}
+
+bool Listener::Accept::attempt() {
+    const int client = ::accept4(listener->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client != -1) {
+        conn = Connection(client);
+        return true;
+    }
+    if (errno == EAGAIN || errno == EINTR) {
+        return false;
+    }
+    err = from_errno(errno);
+    return true;
+}
+
+void Listener::Accept::await_suspend(std::coroutine_handle<> waiting) {
+    this->waiting = waiting;
+    listener->waiters->reader = this;
+}
+
+std::pair<Listener, err_t> listen(int port, int backlog) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return {Listener(), from_errno(errno)};
+    }
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address) || ::listen(fd, backlog)) {
+        const err_t err = from_errno(errno);
+        ::close(fd);
+        return {Listener(), err};
+    }
+    return {Listener(fd), ERR_OK};
+}
+
+const char *lwip_describe(err_t err) {
+    switch (err) {
+    case ERR_OK: return "[ERR_OK] No error, everything OK";
+    case ERR_MEM: return "[ERR_MEM] Out of memory error";
+    case ERR_BUF: return "[ERR_BUF] Buffer error";
+    case ERR_TIMEOUT: return "[ERR_TIMEOUT] Timeout";
+    case ERR_RTE: return "[ERR_RTE] Routing problem";
+    case ERR_INPROGRESS: return "[ERR_INPROGRESS] Operation in progress";
+    case ERR_VAL: return "[ERR_VAL] Illegal value";
+    case ERR_WOULDBLOCK: return "[ERR_WOULDBLOCK] Operation would block";
+    case ERR_USE: return "[ERR_USE] Address in use";
+    case ERR_ALREADY: return "[ERR_ALREADY] Already connecting";
+    case ERR_ISCONN: return "[ERR_ISCONN] Conn already established";
+    case ERR_CONN: return "[ERR_CONN] Not connected";
+    case ERR_IF: return "[ERR_IF] Low-level netif error";
+    case ERR_ABRT: return "[ERR_ABRT] Connection aborted";
+    case ERR_RST: return "[ERR_RST] Connection reset";
+    case ERR_CLSD: return "[ERR_CLSD] Connection closed";
+    case ERR_ARG: return "[ERR_ARG] Illegal argument";
+    }
+    return "Unknown lwIP error code";
+}
+
+} // namespace picoro
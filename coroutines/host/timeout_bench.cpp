@@ -0,0 +1,185 @@
+// `coroutines-timeout-bench` checks that `IdleTimeout` (see
+// <common/idle_timeout.h>) frees the coroutines of connections whose deadlines
+// pass, and measures how long after the deadline that happens.
+//
+//     usage: coroutines-timeout-bench
+//
+// It starts handlers on connections whose other ends are held by the bench
+// itself, each arming a watch as the servers' handlers do:
+//
+// - some wait to receive from a peer that never sends,
+// - some send more than the peer, which never reads, has room for, and
+// - some wait to receive from a peer that sends before the deadline.
+//
+// The reaper closes the first two kinds, which relies on closing a connection
+// completing its pending `recv` or `send` with an error. The bench checks that
+// each such handler then returns, with an error, and its frame is destroyed;
+// that each is closed no earlier than its deadline and no later than a reaper
+// period after it; that the timeouts are counted under the right phases; and
+// that the third kind isn't closed at all. It reports how late the closes
+// were.
+//
+// It exits with a nonzero status if any check fails.
+
+#include <common/idle_timeout.h>
+
+#include <pico/async_context.h>
+#include <pico/time.h>
+
+#include <picoro/coroutine.h>
+#include <picoro/sleep.h>
+#include <picoro/tcp.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const auto reaper_period = std::chrono::milliseconds(100);
+const auto timeout = std::chrono::milliseconds(300);
+// how late past one reaper period a close may be, for scheduling noise
+const auto slack = std::chrono::milliseconds(50);
+
+// the number of handler frames not yet destroyed
+int live_handlers = 0;
+
+struct Live {
+    Live() { ++live_handlers; }
+    ~Live() { --live_handlers; }
+};
+
+// How one handler finished.
+struct Outcome {
+    bool finished = false;
+    err_t err = ERR_OK;
+    // microseconds from the deadline until the handler was resumed
+    int64_t lateness_us = 0;
+};
+
+// Return a connected pair of nonblocking sockets: the handler's end and the
+// peer's.
+std::pair<int, int> connected_pair() {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds)) {
+        std::perror("socketpair");
+        std::exit(1);
+    }
+    return {fds[0], fds[1]};
+}
+
+picoro::Coroutine<void> wait_for_request(common::IdleTimeout& timeouts, picoro::Connection conn, Outcome& outcome) {
+    Live live;
+    common::IdleTimeout::Watch watch(timeouts, conn);
+    const absolute_time_t deadline = make_timeout_time_ms(timeout.count());
+    watch.expire_at(deadline, common::IdleTimeout::IDLE);
+    char buffer[256];
+    const auto [count, err] = co_await conn.recv(buffer, sizeof buffer);
+    watch.cancel();
+    outcome = {.finished = true, .err = err, .lateness_us = absolute_time_diff_us(deadline, get_absolute_time())};
+}
+
+picoro::Coroutine<void> send_response(common::IdleTimeout& timeouts, picoro::Connection conn, Outcome& outcome) {
+    Live live;
+    common::IdleTimeout::Watch watch(timeouts, conn);
+    // far more than the socket buffers hold, so that the send stalls
+    const std::string response(16 * 1024 * 1024, 'x');
+    const absolute_time_t deadline = make_timeout_time_ms(timeout.count());
+    watch.expire_at(deadline, common::IdleTimeout::WRITE);
+    const auto [count, err] = co_await conn.send(response);
+    watch.cancel();
+    outcome = {.finished = true, .err = err, .lateness_us = absolute_time_diff_us(deadline, get_absolute_time())};
+}
+
+// Send a byte on the specified `peer` socket after a third of the timeout.
+picoro::Coroutine<void> send_soon(async_context_t *ctx, int peer) {
+    co_await picoro::sleep_for(ctx, timeout / 3);
+    if (::write(peer, "x", 1) != 1) {
+        std::perror("write");
+    }
+}
+
+int fail(const char *what) {
+    std::fprintf(stderr, "%s\n", what);
+    return 1;
+}
+
+} // namespace
+
+int main() {
+    async_context_t *const ctx = host_async_context();
+    common::IdleTimeout timeouts;
+    timeouts.run(ctx, reaper_period).detach();
+
+    const int per_kind = 20;
+    std::vector<Outcome> idle(per_kind), stalled(per_kind), active(per_kind);
+    std::vector<int> peers;
+    for (int i = 0; i < per_kind; ++i) {
+        auto [ours, peer] = connected_pair();
+        peers.push_back(peer);
+        wait_for_request(timeouts, picoro::Connection(ours), idle[i]).detach();
+
+        std::tie(ours, peer) = connected_pair();
+        peers.push_back(peer);
+        send_response(timeouts, picoro::Connection(ours), stalled[i]).detach();
+
+        std::tie(ours, peer) = connected_pair();
+        peers.push_back(peer);
+        send_soon(ctx, peer).detach();
+        wait_for_request(timeouts, picoro::Connection(ours), active[i]).detach();
+    }
+
+    const absolute_time_t give_up = make_timeout_time_ms(5000);
+    while (live_handlers && !time_reached(give_up)) {
+        host::poll(ctx);
+    }
+    for (const int peer : peers) {
+        ::close(peer);
+    }
+
+    if (live_handlers) {
+        std::fprintf(stderr, "%d handlers were never resumed\n", live_handlers);
+        return 1;
+    }
+    const int64_t max_late_us = std::chrono::microseconds(reaper_period + slack).count();
+    std::vector<int64_t> lateness;
+    for (const std::vector<Outcome> *closed : {&idle, &stalled}) {
+        for (const Outcome& outcome : *closed) {
+            if (!outcome.finished || outcome.err == ERR_OK) {
+                return fail("a timed out handler didn't finish with an error");
+            }
+            if (outcome.lateness_us < 0 || outcome.lateness_us > max_late_us) {
+                std::fprintf(stderr, "a connection was closed %lld us after its deadline\n",
+                    (long long) outcome.lateness_us);
+                return 1;
+            }
+            lateness.push_back(outcome.lateness_us);
+        }
+    }
+    for (const Outcome& outcome : active) {
+        if (!outcome.finished || outcome.err != ERR_OK || outcome.lateness_us >= 0) {
+            return fail("a handler whose peer sent in time was closed");
+        }
+    }
+    if (timeouts.timeouts(common::IdleTimeout::IDLE) != unsigned(per_kind) ||
+        timeouts.timeouts(common::IdleTimeout::WRITE) != unsigned(per_kind)) {
+        return fail("the timeouts weren't counted under their phases");
+    }
+
+    std::sort(lateness.begin(), lateness.end());
+    std::printf("%d idle and %d stalled connections closed, %d active ones left open\n",
+        per_kind, per_kind, per_kind);
+    std::printf("closed after the deadline (us): min %lld, p50 %lld, max %lld (reaper period %lld ms)\n",
+        (long long) lateness.front(), (long long) lateness[lateness.size() / 2], (long long) lateness.back(),
+        (long long) reaper_period.count());
+    return 0;
+}
@@ -0,0 +1,382 @@
+// `coroutines-ws-bench` measures how many measurements per second an HTTP
+// server pushes to WebSocket clients at /ws, and how long it takes to answer
+// a ping meanwhile.
+//
+//     usage: coroutines-ws-bench [HOST [PORT [CONNECTIONS [SECONDS]]]]
+//
+// The defaults are 127.0.0.1, 8080, 4 connections, and 10 seconds. Run the
+// server with a short measurement period, e.g. `coroutines-host 8080 10`, or
+// there's little to measure. Each connection has its own thread. It upgrades
+// to a WebSocket, checking the handshake's Sec-WebSocket-Accept, and then
+// receives the binary frames, each a 16-byte record (see `format_record_frame`
+// in ../http_server.cpp), and counts the frames and bytes. Every 100 ms, it
+// sends a masked ping, as a client must mask its frames, and times the pong.
+// At the end, it sends a close, and waits for the server's.
+//
+// It checks that each connection's sequence numbers increase (the server may
+// skip measurements that a slow client missed, but mustn't repeat or reorder
+// them), that each record's reserved bytes are zero, that each pong echoes
+// its ping, and that the server answers the close. It exits with a nonzero
+// status if any check fails, if a connection fails, or if no frames arrived.
+// Connections that admission control refuses, beyond the server's limit, are
+// only counted.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    const char *host = "127.0.0.1";
+    int port = 8080;
+    int connections = 4;
+    int seconds = 10;
+};
+
+struct Results {
+    // binary frames received
+    unsigned frames = 0;
+    // bytes received after the handshake, frame headers and all
+    uint64_t bytes = 0;
+    // measurements that the server skipped, judging by the sequence numbers
+    unsigned skipped = 0;
+    // microseconds from sending each ping to receiving its pong
+    std::vector<int64_t> pong_latencies;
+    // failed checks, each described on stderr
+    unsigned failures = 0;
+    // connections that failed, or that the server closed unasked
+    unsigned errors = 0;
+    // connections that admission control refused with a 503
+    unsigned refused = 0;
+};
+
+// what the server must answer to the key that `run_client` sends, per RFC 6455
+constexpr std::string_view websocket_key = "dGhlIHNhbXBsZSBub25jZQ==";
+constexpr std::string_view websocket_accept = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+constexpr std::size_t record_length = 16;
+
+enum Opcode : uint8_t { BINARY = 0x2, CLOSE = 0x8, PING = 0x9, PONG = 0xA };
+
+int connect_to(const Options& options) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    inet_pton(AF_INET, options.host, &address.sin_addr);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address)) {
+        ::close(fd);
+        return -1;
+    }
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    // Wake up now and then to send pings, even if no frame arrives.
+    const timeval timeout = {.tv_sec = 0, .tv_usec = 10 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    return fd;
+}
+
+// Send a frame having the specified `opcode` and `payload` on the specified
+// `fd`, masked with a key from `random`, as a client's frames must be. Return
+// whether it was sent.
+bool send_frame(int fd, Opcode opcode, std::string_view payload, std::mt19937& random) {
+    // Control frames, which are all that a client sends here, are short.
+    std::string frame;
+    frame += char(0x80 | opcode);
+    frame += char(0x80 | payload.size());
+    const uint32_t key = random();
+    for (int i = 0; i < 4; ++i) {
+        frame += char(key >> (8 * i));
+    }
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        frame += char(payload[i] ^ frame[2 + i % 4]);
+    }
+    return ::send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) == ssize_t(frame.size());
+}
+
+uint32_t little_endian(std::string_view bytes) {
+    uint32_t value = 0;
+    for (std::size_t i = bytes.size(); i--;) {
+        value = value << 8 | uint8_t(bytes[i]);
+    }
+    return value;
+}
+
+// A `Connection` is one client's WebSocket: what it has received but not yet
+// parsed, and what it has seen so far.
+struct Connection {
+    int fd;
+    Results& results;
+    std::string received = {};
+    // the sequence number of the last record received, or 0 if none has been
+    unsigned last_sequence_number = 0;
+    // the payload of the ping awaiting its pong, if any, and when it was sent
+    std::string ping = {};
+    Clock::time_point ping_sent = {};
+    bool close_received = false;
+
+    void fail(const char *what) {
+        std::fprintf(stderr, "%s\n", what);
+        ++results.failures;
+    }
+
+    // Receive whatever has arrived, if anything, and handle the complete
+    // frames, including any received before. Return false if the connection
+    // failed or was closed.
+    bool receive();
+    void handle(uint8_t opcode, std::string_view payload);
+};
+
+bool Connection::receive() {
+    char buffer[4096];
+    const ssize_t count = ::recv(fd, buffer, sizeof buffer, 0);
+    if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+    if (count > 0) {
+        results.bytes += count;
+        received.append(buffer, count);
+    }
+
+    std::size_t offset = 0;
+    for (;;) {
+        const std::string_view rest = std::string_view(received).substr(offset);
+        if (rest.size() < 2) {
+            break;
+        }
+        const uint8_t first = rest[0];
+        const uint8_t second = rest[1];
+        if ((first & 0x70) || !(first & 0x80) || (second & 0x80)) {
+            fail("the server sent a fragment, a masked frame, or reserved bits");
+            return false;
+        }
+        std::size_t header_length = 2;
+        uint64_t payload_length = second & 0x7F;
+        if (payload_length == 126 || payload_length == 127) {
+            header_length += payload_length == 126 ? 2 : 8;
+            if (rest.size() < header_length) {
+                break;
+            }
+            payload_length = 0;
+            for (std::size_t i = 2; i < header_length; ++i) {
+                payload_length = payload_length << 8 | uint8_t(rest[i]);
+            }
+        }
+        if (rest.size() < header_length + payload_length) {
+            break;
+        }
+        handle(first & 0x0F, rest.substr(header_length, payload_length));
+        offset += header_length + payload_length;
+    }
+    received.erase(0, offset);
+    return true;
+}
+
+void Connection::handle(uint8_t opcode, std::string_view payload) {
+    switch (opcode) {
+    case BINARY: {
+        ++results.frames;
+        if (payload.size() != record_length) {
+            fail("a record isn't 16 bytes");
+            return;
+        }
+        const unsigned sequence_number = little_endian(payload.substr(0, 4));
+        if (sequence_number <= last_sequence_number) {
+            fail("the sequence numbers don't increase");
+        } else if (last_sequence_number != 0) {
+            results.skipped += sequence_number - last_sequence_number - 1;
+        }
+        last_sequence_number = sequence_number;
+        if (little_endian(payload.substr(14, 2)) != 0) {
+            fail("a record's reserved bytes aren't zero");
+        }
+        break;
+    }
+    case PONG:
+        if (ping.empty() || payload != ping) {
+            fail("a pong doesn't echo the ping");
+        } else {
+            results.pong_latencies.push_back(
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - ping_sent).count());
+        }
+        ping.clear();
+        break;
+    case CLOSE:
+        close_received = true;
+        break;
+    default:
+        fail("the server sent an unexpected opcode");
+        break;
+    }
+}
+
+// `Upgrade` is how the server answered a request to upgrade to a WebSocket.
+enum class Upgrade { UPGRADED, REFUSED, WRONG_ACCEPT, FAILED };
+
+// Ask to upgrade the specified `fd` to a WebSocket, and return how the server
+// answered. A 503, from admission control, is a refusal. Anything received
+// after the handshake is left in the specified `received`.
+Upgrade upgrade(int fd, const Options& options, std::string& received) {
+    std::string request = "GET /ws HTTP/1.1\r\nHost: ";
+    request += options.host;
+    request += "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ";
+    request += websocket_key;
+    request += "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size())) {
+        return Upgrade::FAILED;
+    }
+
+    const auto deadline = Clock::now() + std::chrono::seconds(5);
+    std::size_t headers_end;
+    while ((headers_end = received.find("\r\n\r\n")) == std::string::npos) {
+        char buffer[1024];
+        const ssize_t count = ::recv(fd, buffer, sizeof buffer, 0);
+        if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || Clock::now() > deadline) {
+            return Upgrade::FAILED;
+        }
+        if (count > 0) {
+            received.append(buffer, count);
+        }
+    }
+    const std::string_view headers = std::string_view(received).substr(0, headers_end);
+    std::string accept = "\r\nSec-WebSocket-Accept: ";
+    accept += websocket_accept;
+    accept += "\r\n";
+    const bool upgraded = headers.starts_with("HTTP/1.1 101 ");
+    const bool accepted = (std::string(headers) + "\r\n").find(accept) != std::string::npos;
+    const bool refused = headers.starts_with("HTTP/1.1 503 ");
+    received.erase(0, headers_end + 4);
+    return upgraded ? (accepted ? Upgrade::UPGRADED : Upgrade::WRONG_ACCEPT) :
+        refused ? Upgrade::REFUSED : Upgrade::FAILED;
+}
+
+// Receive measurements on a WebSocket until `deadline`, pinging now and then,
+// and then close it.
+void run_client(const Options& options, Clock::time_point deadline, Results& results, unsigned seed) {
+    std::mt19937 random(seed);
+    Connection conn = {.fd = connect_to(options), .results = results};
+    if (conn.fd == -1) {
+        ++results.errors;
+        return;
+    }
+    switch (upgrade(conn.fd, options, conn.received)) {
+    case Upgrade::UPGRADED:
+        break;
+    case Upgrade::REFUSED:
+        ++results.refused;
+        ::close(conn.fd);
+        return;
+    case Upgrade::WRONG_ACCEPT:
+        conn.fail("the server sent the wrong Sec-WebSocket-Accept");
+        ::close(conn.fd);
+        return;
+    case Upgrade::FAILED:
+        conn.fail("the server didn't upgrade to a WebSocket");
+        ::close(conn.fd);
+        return;
+    }
+    // Count what came with the handshake as received.
+    results.bytes += conn.received.size();
+
+    const auto ping_period = std::chrono::milliseconds(100);
+    auto next_ping = Clock::now() + ping_period;
+    unsigned pings = 0;
+    bool ok = true;
+    while (ok && !conn.close_received && Clock::now() < deadline) {
+        if (conn.ping.empty() && Clock::now() >= next_ping) {
+            conn.ping = "ping " + std::to_string(++pings);
+            conn.ping_sent = Clock::now();
+            ok = send_frame(conn.fd, PING, conn.ping, random);
+            next_ping = conn.ping_sent + ping_period;
+        }
+        ok = ok && conn.receive();
+    }
+    if (!ok || conn.close_received) {
+        ++results.errors;
+        ::close(conn.fd);
+        return;
+    }
+
+    // status code 1000: normal closure
+    ok = send_frame(conn.fd, CLOSE, std::string_view("\x03\xE8", 2), random);
+    const auto close_deadline = Clock::now() + std::chrono::seconds(5);
+    while (ok && !conn.close_received && Clock::now() < close_deadline) {
+        ok = conn.receive();
+    }
+    if (!conn.close_received) {
+        conn.fail("the server didn't answer the close");
+    }
+    ::close(conn.fd);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (argc > 1) options.host = argv[1];
+    if (argc > 2) options.port = std::atoi(argv[2]);
+    if (argc > 3) options.connections = std::atoi(argv[3]);
+    if (argc > 4) options.seconds = std::atoi(argv[4]);
+
+    std::printf("%d WebSocket connections to %s:%d/ws for %d seconds\n",
+        options.connections, options.host, options.port, options.seconds);
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::seconds(options.seconds);
+    std::vector<Results> results(options.connections);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < results.size(); ++i) {
+        threads.emplace_back(run_client, std::cref(options), deadline, std::ref(results[i]), 2024 + i);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Results total;
+    for (const Results& result : results) {
+        total.frames += result.frames;
+        total.bytes += result.bytes;
+        total.skipped += result.skipped;
+        total.pong_latencies.insert(total.pong_latencies.end(), result.pong_latencies.begin(), result.pong_latencies.end());
+        total.failures += result.failures;
+        total.errors += result.errors;
+        total.refused += result.refused;
+    }
+    std::sort(total.pong_latencies.begin(), total.pong_latencies.end());
+    const auto percentile = [&](double p) -> long long {
+        if (total.pong_latencies.empty()) {
+            return 0;
+        }
+        return total.pong_latencies[std::size_t(p / 100 * (total.pong_latencies.size() - 1))];
+    };
+
+    const unsigned upgraded = std::max(options.connections - int(total.refused), 1);
+    std::printf("frames: %u (%.0f per second, %.0f per second per upgraded connection)\n",
+        total.frames, total.frames / elapsed, total.frames / elapsed / upgraded);
+    std::printf("received: %.0f bytes per second\n", total.bytes / elapsed);
+    std::printf("measurements skipped: %u\n", total.skipped);
+    std::printf("pongs: %zu, latency (us): p50 %lld, p90 %lld, p99 %lld, max %lld\n",
+        total.pong_latencies.size(), percentile(50), percentile(90), percentile(99), percentile(100));
+    std::printf("failed checks: %u\n", total.failures);
+    std::printf("connection errors: %u\n", total.errors);
+    std::printf("connections refused: %u\n", total.refused);
+    return total.frames == 0 || total.failures != 0 || total.errors != 0;
+}
@@ -0,0 +1,1728 @@
+#include "http_server.h"
+
+#include "pico/rand.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include <picoro/broadcaster.h>
+#include <picoro/coroutine.h>
+#include <picoro/debug.h>
+#include <picoro/sleep.h>
+#include <picoro/tcp.h>
+
+#include <common/admission.h>
+#include <common/cbor.h>
+#include <common/flash_log.h>
+#include <common/format.h>
+#include <common/http.h>
+#include <common/idle_timeout.h>
+#include <common/intrusive_list.h>
+#include <common/metrics.h>
+#include <common/render_cache.h>
+#include <common/routes.h>
+#include <common/websocket.h>
+
+Measurement latest;
+
+// A streaming client that falls behind catches up by being sent, in one go,
+// the measurements it missed, as long as they are among the most recent
+// `max_batch_size` measurements (see `stream_measurements`).
+constexpr unsigned max_batch_size = 4;
+
+// `recent[sequence_number % max_batch_size]` is the measurement having that
+// sequence number, if it's recent enough.
+std::array<Measurement, max_batch_size> recent;
+
+MeasurementHistory& history() {
+    static MeasurementHistory instance;
+    return instance;
+}
+
+MeasurementRollup& rollups() {
+    static MeasurementRollup instance;
+    return instance;
+}
+
+common::FlashLog& measurement_log() {
+    static common::FlashLog instance(PICO_FLASH_SIZE_BYTES - measurement_log_bytes, measurement_log_bytes);
+    return instance;
+}
+
+// Erase the log's next sector ahead of time, so that `publish`, in appending
+// to the log, only ever programs a page. This is its own coroutine, woken by
+// a timer rather than by `broadcaster`, because a broadcaster resumes its
+// waiters from within `publish`. Half a sector holds over a hundred
+// measurements, so checking once a second is plenty.
+picoro::Coroutine<void> erase_log_ahead(async_context_t *ctx) {
+    for (;;) {
+        co_await picoro::sleep_for(ctx, std::chrono::seconds(1));
+        if (measurement_log().erase_ahead()) {
+            picoro::debug("http_server: Erased the measurement log's next sector. %u late erases.\n",
+                measurement_log().late_erases());
+        }
+    }
+}
+
+// a measurement's payload in `measurement_log()`
+struct [[gnu::packed]] LoggedMeasurement {
+    uint16_t co2_ppm;
+    int16_t temperature_centicelsius;
+    uint16_t relative_humidity_centipercent;
+};
+
+// `history_time_base` plus the uptime is the history's time (see
+// `HistoryChannel`). It's set by `restore_history`, to just after the newest
+// measurement in flash.
+uint32_t history_time_base = 0;
+
+uint32_t history_time() {
+    return history_time_base + uint32_t(to_us_since_boot(get_absolute_time()) / 1'000'000);
+}
+
+// `boot_record_number` is the number in `measurement_log()` of this boot's
+// first measurement. `publish` appends each measurement to the log, so the one
+// having sequence number n has record number `boot_record_number + n - 1`.
+// It's set by `restore_history`.
+uint32_t boot_record_number = 0;
+
+// Return the specified `milli` value (e.g. millicelsius) in hundredths,
+// rounded to the nearest.
+int32_t to_centi(int32_t milli) {
+    return (milli + (milli < 0 ? -5 : 5)) / 10;
+}
+
+// `boot_id` distinguishes this boot's ETags from those of previous boots, when
+// sequence numbers started over.
+uint32_t boot_id() {
+    static const uint32_t id = get_rand_32();
+    return id;
+}
+
+// If we haven't made a measurement yet, respond with an error telling the
+// client to try again in a few seconds.
+constexpr char unavailable_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 5\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+// `MEASUREMENT_JSON_FORMAT` is how a `Measurement` is formatted, and
+// `MEASUREMENT_JSON_FIELDS` describes the format's conversions. The
+// temperature and humidity are formatted from integers, without floating point.
+#define MEASUREMENT_JSON_FORMAT \
+    "{\"sequence_number\": %u," \
+    " \"CO2_ppm\": %hu," \
+    " \"temperature_celsius\": %.1f," \
+    " \"relative_humidity_percent\": %.1f," \
+    " \"free_bytes\": %lu}"
+#define MEASUREMENT_JSON_FIELDS \
+    common::Decimal<unsigned>, \
+    common::Decimal<uint16_t>, \
+    common::Fixed<int32_t, 1000, 1>, \
+    common::Fixed<int32_t, 1000, 1>, \
+    common::Decimal<uint32_t>
+
+constexpr char response_body_format[] = MEASUREMENT_JSON_FORMAT;
+
+using ResponseBody = common::Format<response_body_format, MEASUREMENT_JSON_FIELDS>;
+
+// Responses have a Content-Length, so that the client can send another request
+// on the same connection. They have an ETag, so that a client polling for the
+// latest measurement can ask for it only if it has changed (If-None-Match).
+// They vary with the Accept header, which can ask for CBOR instead.
+constexpr char response_header_format[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Vary: Accept\r\n"
+    "ETag: " COMMON_HTTP_ETAG_FORMAT "\r\n"
+    "Content-Length: %d\r\n"
+    "\r\n";
+
+using ResponseHeader = common::Format<response_header_format,
+    COMMON_HTTP_ETAG_FIELDS,
+    common::Decimal<int, 0, int(ResponseBody::max_length)>>;
+
+constexpr std::size_t max_response_length = std::max(
+    sizeof unavailable_response - 1,
+    ResponseHeader::max_length + ResponseBody::max_length);
+
+constexpr char chunked_response_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/x-ndjson\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Vary: Accept\r\n"
+    "\r\n";
+
+constexpr char chunk_body_format[] =
+    MEASUREMENT_JSON_FORMAT
+    "\n";
+
+using ChunkBody = common::Format<chunk_body_format, MEASUREMENT_JSON_FIELDS>;
+
+constexpr char chunk_prefix_format[] = "%X\r\n";
+
+// A chunk contains one measurement, or a batch of them.
+using ChunkPrefix = common::Format<chunk_prefix_format,
+    common::Hex<int, int(ChunkBody::max_length * max_batch_size)>>;
+
+constexpr char chunk_suffix[] = "\r\n";
+
+constexpr std::size_t max_chunk_length =
+    ChunkPrefix::max_length + ChunkBody::max_length + sizeof chunk_suffix - 1;
+
+constexpr std::size_t max_batch_chunk_length =
+    ChunkPrefix::max_length + ChunkBody::max_length * max_batch_size + sizeof chunk_suffix - 1;
+
+// Server-sent events are for browsers' `EventSource`. Each event's id is the
+// measurement's sequence number, so that a reconnecting browser tells us
+// (Last-Event-ID) which measurement it saw last. The response has no length,
+// and lasts as long as the connection.
+constexpr char event_stream_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n"
+    // Have the browser wait five seconds before reconnecting.
+    "retry: 5000\n"
+    "\n";
+
+constexpr char event_format[] =
+    "id: %u\n"
+    "data: " MEASUREMENT_JSON_FORMAT "\n"
+    "\n";
+
+using Event = common::Format<event_format,
+    common::Decimal<unsigned>,
+    MEASUREMENT_JSON_FIELDS>;
+
+// A reconnecting client whose Last-Event-ID is older than `history()` gets a
+// "gap" event saying how many measurements it missed, before the ones that
+// are still there. It has no id, so that the client's last event id stays
+// that of the last measurement it saw.
+constexpr char gap_event_format[] =
+    "event: gap\n"
+    "data: {\"missed\": %u}\n"
+    "\n";
+
+using GapEvent = common::Format<gap_event_format, common::Decimal<unsigned>>;
+
+constexpr std::size_t max_event_length = Event::max_length;
+
+constexpr std::size_t max_batch_events_length = Event::max_length * max_batch_size;
+
+#undef MEASUREMENT_JSON_FIELDS
+#undef MEASUREMENT_JSON_FORMAT
+
+// Responses used to go into a 512-byte buffer that I sized by guessing.
+static_assert(max_response_length < 512);
+static_assert(max_chunk_length < 512);
+static_assert(max_event_length < 512);
+
+int format_response(
+    // +1 for the null terminator
+    std::array<char, max_response_length + 1>& buffer,
+    const Measurement& data) {
+    if (data.sequence_number == 0) {
+        std::memcpy(buffer.data(), unavailable_response, sizeof unavailable_response);
+        return sizeof unavailable_response - 1;
+    }
+
+    // Format the body first, so that we know its length, and then insert the
+    // header in front of it.
+    char *const response = buffer.data();
+    const int body_length = ResponseBody::write(
+        response,
+        data.sequence_number,
+        data.co2_ppm,
+        data.temperature_millicelsius,
+        data.relative_humidity_millipercent,
+        get_free_heap());
+    const int header_length = common::insert_length_prefix<ResponseHeader>(
+        response, body_length, boot_id(), data.sequence_number);
+    response[header_length + body_length] = '\0';
+
+    return header_length + body_length;
+}
+
+// Write to the specified `chunk` a chunk containing a line for each of the
+// specified `measurements`. Return the length of the chunk.
+int write_chunk(char *chunk, std::span<const Measurement> measurements) {
+    // Format the body first, so that we know its length, and then insert the
+    // length prefix in front of it.
+    int body_length = 0;
+    for (const Measurement& data : measurements) {
+        body_length += ChunkBody::write(
+            chunk + body_length,
+            data.sequence_number,
+            data.co2_ppm,
+            data.temperature_millicelsius,
+            data.relative_humidity_millipercent,
+            get_free_heap());
+    }
+    const int prefix_length = common::insert_length_prefix<ChunkPrefix>(chunk, body_length);
+    // Copy the suffix's null terminator, too.
+    std::memcpy(chunk + prefix_length + body_length, chunk_suffix, sizeof chunk_suffix);
+
+    return prefix_length + body_length + sizeof chunk_suffix - 1;
+}
+
+int format_response_chunk(
+    // +1 for the null terminator
+    std::array<char, max_chunk_length + 1>& buffer,
+    const Measurement& data) {
+    return write_chunk(buffer.data(), std::span(&data, 1));
+}
+
+int format_response_chunk_batch(
+    // +1 for the null terminator
+    std::array<char, max_batch_chunk_length + 1>& buffer,
+    std::span<const Measurement> batch) {
+    return write_chunk(buffer.data(), batch);
+}
+
+// Write to the specified `output` an event for each of the specified
+// `measurements`. Return the length of the events.
+int write_events(char *output, std::span<const Measurement> measurements) {
+    int length = 0;
+    for (const Measurement& data : measurements) {
+        length += Event::write(
+            output + length,
+            data.sequence_number,
+            data.sequence_number,
+            data.co2_ppm,
+            data.temperature_millicelsius,
+            data.relative_humidity_millipercent,
+            get_free_heap());
+    }
+    return length;
+}
+
+int format_event(
+    // +1 for the null terminator
+    std::array<char, max_event_length + 1>& buffer,
+    const Measurement& data) {
+    return write_events(buffer.data(), std::span(&data, 1));
+}
+
+int format_event_batch(
+    // +1 for the null terminator
+    std::array<char, max_batch_events_length + 1>& buffer,
+    std::span<const Measurement> batch) {
+    return write_events(buffer.data(), batch);
+}
+
+// WebSocket clients get each measurement as a binary frame whose payload is a
+// 16-byte little-endian record:
+//
+//     offset  size  field
+//     0       4     sequence_number (unsigned)
+//     4       4     temperature_millicelsius (signed)
+//     8       4     relative_humidity_millipercent (signed)
+//     12      2     co2_ppm (unsigned)
+//     14      2     reserved (zero)
+constexpr std::size_t measurement_record_length = 16;
+
+constexpr std::size_t max_record_frame_length = 2 + measurement_record_length;
+
+int format_record_frame(
+    // +1 to match the other caches; records are not null terminated
+    std::array<char, max_record_frame_length + 1>& buffer,
+    const Measurement& data) {
+    char *const frame = buffer.data();
+    const int header_length = common::write_websocket_frame_header(
+        frame, common::WebSocketOpcode::BINARY, measurement_record_length);
+    char *const record = frame + header_length;
+    const auto put = [record](int offset, uint32_t value, int size) {
+        for (int i = 0; i < size; ++i) {
+            record[offset + i] = char(value >> (8 * i));
+        }
+    };
+    put(0, data.sequence_number, 4);
+    put(4, uint32_t(data.temperature_millicelsius), 4);
+    put(8, uint32_t(data.relative_humidity_millipercent), 4);
+    put(12, data.co2_ppm, 2);
+    put(14, 0, 2);
+    return header_length + measurement_record_length;
+}
+
+// Clients that accept CBOR (see `wants_cbor`) get each measurement as a CBOR
+// map instead of a JSON object. Its values are integers:
+//
+//     key     value
+//     "rh"    relative_humidity_millipercent
+//     "co2"   co2_ppm
+//     "seq"   sequence_number
+//     "heap"  free_bytes
+//     "temp"  temperature_millicelsius
+//
+// The keys are short, and in the deterministic order, so that the same
+// measurement is always encoded the same way, in about a third of the JSON's
+// length.
+constexpr std::string_view cbor_keys[] = {"rh", "co2", "seq", "heap", "temp"};
+
+static_assert(common::cbor_keys_are_deterministic(cbor_keys));
+
+constexpr std::size_t max_cbor_measurement_length = [] {
+    std::size_t length = common::cbor_head_length(std::size(cbor_keys));
+    for (const std::string_view key : cbor_keys) {
+        length += common::cbor_text_length(key) + common::cbor_max_integer_length;
+    }
+    return length;
+}();
+
+// Write to the specified `output` the CBOR encoding of the specified `data`.
+// Return a pointer to the character after the last one written.
+char *write_cbor_measurement(char *output, const Measurement& data) {
+    common::CborWriter cbor(output);
+    cbor.map(std::size(cbor_keys))
+        .text(cbor_keys[0]).integer(data.relative_humidity_millipercent)
+        .text(cbor_keys[1]).unsigned_integer(data.co2_ppm)
+        .text(cbor_keys[2]).unsigned_integer(data.sequence_number)
+        .text(cbor_keys[3]).unsigned_integer(get_free_heap())
+        .text(cbor_keys[4]).integer(data.temperature_millicelsius);
+    return cbor.end();
+}
+
+constexpr char cbor_response_header_format[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/cbor\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Vary: Accept\r\n"
+    "Content-Length: %d\r\n"
+    "\r\n";
+
+using CborResponseHeader = common::Format<cbor_response_header_format,
+    common::Decimal<int, 0, int(max_cbor_measurement_length)>>;
+
+constexpr std::size_t max_cbor_response_length = std::max(
+    sizeof unavailable_response - 1,
+    CborResponseHeader::max_length + max_cbor_measurement_length);
+
+// A CBOR response has no ETag, because it would need to differ from the JSON
+// response's, and CBOR clients are expected to stream rather than poll.
+int format_cbor_response(
+    // +1 to match the other caches; CBOR is not null terminated
+    std::array<char, max_cbor_response_length + 1>& buffer,
+    const Measurement& data) {
+    if (data.sequence_number == 0) {
+        std::memcpy(buffer.data(), unavailable_response, sizeof unavailable_response - 1);
+        return sizeof unavailable_response - 1;
+    }
+    char *const response = buffer.data();
+    const int body_length = write_cbor_measurement(response, data) - response;
+    const int header_length = common::insert_length_prefix<CborResponseHeader>(response, body_length);
+    return header_length + body_length;
+}
+
+// A CBOR stream is a chunked CBOR sequence (RFC 8742): each chunk contains one
+// or more measurements, one after another.
+constexpr char cbor_chunked_response_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/cbor-seq\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Vary: Accept\r\n"
+    "\r\n";
+
+using CborChunkPrefix = common::Format<chunk_prefix_format,
+    common::Hex<int, int(max_cbor_measurement_length * max_batch_size)>>;
+
+constexpr std::size_t max_cbor_chunk_length =
+    CborChunkPrefix::max_length + max_cbor_measurement_length + sizeof chunk_suffix - 1;
+
+constexpr std::size_t max_cbor_batch_chunk_length =
+    CborChunkPrefix::max_length + max_cbor_measurement_length * max_batch_size + sizeof chunk_suffix - 1;
+
+// Write to the specified `chunk` a chunk containing the CBOR encoding of each
+// of the specified `measurements`. Return the length of the chunk.
+int write_cbor_chunk(char *chunk, std::span<const Measurement> measurements) {
+    char *end = chunk;
+    for (const Measurement& data : measurements) {
+        end = write_cbor_measurement(end, data);
+    }
+    const int body_length = end - chunk;
+    const int prefix_length = common::insert_length_prefix<CborChunkPrefix>(chunk, body_length);
+    std::memcpy(chunk + prefix_length + body_length, chunk_suffix, sizeof chunk_suffix - 1);
+    return prefix_length + body_length + sizeof chunk_suffix - 1;
+}
+
+int format_cbor_chunk(
+    // +1 to match the other caches; CBOR is not null terminated
+    std::array<char, max_cbor_chunk_length + 1>& buffer,
+    const Measurement& data) {
+    return write_cbor_chunk(buffer.data(), std::span(&data, 1));
+}
+
+int format_cbor_chunk_batch(
+    // +1 to match the other caches; CBOR is not null terminated
+    std::array<char, max_cbor_batch_chunk_length + 1>& buffer,
+    std::span<const Measurement> batch) {
+    return write_cbor_chunk(buffer.data(), batch);
+}
+
+picoro::Broadcaster<Measurement>& broadcaster() {
+    static picoro::Broadcaster<Measurement> instance;
+    return instance;
+}
+
+// A long poll ("GET /latest?after=N") waits at most this long for a new
+// measurement. It's shorter than the 30 seconds after which many proxies and
+// clients give up on a response.
+constexpr auto long_poll_timeout = std::chrono::seconds(25);
+
+// Long polls and WebSocket pushers wait on `long_poll_wakeup` rather than on
+// `broadcaster`, because a coroutine can't stop waiting on a broadcaster
+// before it publishes. It is published with the latest sequence number
+// whenever there's a new measurement, and also once a second by
+// `tick_long_polls`, so that the long polls can notice their deadlines. A
+// closing WebSocket publishes it too, so that its pusher notices at once.
+picoro::Broadcaster<unsigned>& long_poll_wakeup() {
+    static picoro::Broadcaster<unsigned> instance;
+    return instance;
+}
+
+picoro::Coroutine<void> tick_long_polls(async_context_t *ctx) {
+    for (;;) {
+        co_await picoro::sleep_for(ctx, std::chrono::seconds(1));
+        long_poll_wakeup().publish(latest.sequence_number);
+    }
+}
+
+// Wait until there's a measurement other than the one having the specified
+// `sequence_number`, or until `long_poll_timeout` has elapsed. Return whether
+// there's another measurement.
+picoro::Coroutine<bool> wait_for_measurement_after(unsigned sequence_number) {
+    const absolute_time_t deadline = make_timeout_time_ms(
+        std::chrono::duration_cast<std::chrono::milliseconds>(long_poll_timeout).count());
+    while (latest.sequence_number == sequence_number) {
+        if (time_reached(deadline)) {
+            co_return false;
+        }
+        co_await long_poll_wakeup().next();
+    }
+    co_return true;
+}
+
+// A long poll or an alert that times out gets this, and may then poll again.
+constexpr char no_new_measurement_response[] =
+    "HTTP/1.1 204 No Content\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+// Each measurement is formatted at most once as a response, at most once as a
+// chunk, at most once as an event, at most once as a WebSocket record, and
+// at most once each as a CBOR response and chunk, no matter how many clients
+// are connected. The "free_bytes" field therefore reflects the heap at the
+// time the measurement was first formatted.
+common::RenderCache<max_response_length + 1>& response_cache() {
+    static common::RenderCache<max_response_length + 1> instance;
+    return instance;
+}
+
+common::RenderCache<max_chunk_length + 1>& chunk_cache() {
+    static common::RenderCache<max_chunk_length + 1> instance;
+    return instance;
+}
+
+common::RenderCache<max_event_length + 1>& event_cache() {
+    static common::RenderCache<max_event_length + 1> instance;
+    return instance;
+}
+
+common::RenderCache<max_record_frame_length + 1>& record_cache() {
+    static common::RenderCache<max_record_frame_length + 1> instance;
+    return instance;
+}
+
+common::RenderCache<max_cbor_response_length + 1>& cbor_response_cache() {
+    static common::RenderCache<max_cbor_response_length + 1> instance;
+    return instance;
+}
+
+common::RenderCache<max_cbor_chunk_length + 1>& cbor_chunk_cache() {
+    static common::RenderCache<max_cbor_chunk_length + 1> instance;
+    return instance;
+}
+
+// Connections are kept open between requests, but are closed if the client
+// sends nothing for `idle`. A client also has a limited time to send each
+// request, whether or not it keeps sending something.
+constexpr common::RequestTimeouts request_timeouts = {
+    .idle = std::chrono::seconds(10),
+    .headers = std::chrono::seconds(5),
+    .body = std::chrono::seconds(5)};
+
+// A connection is closed if the client accepts none of a response for this
+// long, e.g. after a WiFi drop left the connection half-open.
+constexpr auto write_timeout = std::chrono::seconds(15);
+
+common::IdleTimeout& idle_timeout() {
+    static common::IdleTimeout instance;
+    return instance;
+}
+
+// `history_bytes` (see http_server.h) leaves room on the heap for these
+// limits.
+common::AdmissionControl& admission() {
+    static common::AdmissionControl instance({
+        .max_connections = 8,
+        .max_refusing = 4,
+        .reserve_bytes = 16 * 1024,
+        .connection_bytes = 4 * 1024});
+    return instance;
+}
+
+enum class Endpoint {
+    LATEST,
+    MEASUREMENTS,
+    EVENTS,
+    WEBSOCKET,
+    METRICS,
+    WAIT,
+    HISTORY,
+    ROLLUPS
+};
+
+// GET /
+// GET /latest
+//     Return the most recent measurement immediately. Then handle the next
+//     request on the connection, if any.
+//
+// GET /latest?after=<sequence number>
+//     Return the most recent measurement as soon as there's one other than
+//     the specified one, which may be immediately. If there isn't one within
+//     `long_poll_timeout`, return 204 No Content instead.
+//
+// GET /measurements
+//     Stream future measurements as JSON lines in a single chunked response.
+//     The connection is not used for any further requests.
+//
+// Both return CBOR instead of JSON if the client's Accept header asks for it
+// (see `wants_cbor`): "application/cbor" for the latest measurement, and
+// "application/cbor-seq" (or "application/cbor") for the stream.
+//
+// GET /events
+//     Stream measurements as server-sent events, starting with the most
+//     recent one, or, if the client's Last-Event-ID names a measurement from
+//     this boot, with the ones after it. Those older than the ones kept for
+//     catching up are decoded from `history()`, and if some are gone from
+//     there too, a "gap" event says how many (see `send_missed_events`).
+//     The connection is not used for any further requests.
+//
+// GET /wait?co2_above=<ppm>&hysteresis=<ppm>
+// GET /wait?co2_below=<ppm>&hysteresis=<ppm>
+//     Return the most recent measurement when the CO2 concentration crosses
+//     the threshold (see `Co2Alert`). The hysteresis is optional. Only a
+//     crossing fires the alert: if the concentration is already past the
+//     threshold when the alert is made, the alert waits for it to come back
+//     and cross again. (A client that wants to know where the concentration
+//     is now asks GET /latest.) If the alert doesn't fire within
+//     `long_poll_timeout`, return 204 No Content instead. The alert lasts as
+//     long as the connection, so a client that asks again on the same
+//     connection isn't told twice about the same crossing.
+//
+// The streams take an optional "policy" query parameter, which says what to
+// do when the client falls behind (see `StreamPolicy`), e.g.
+// "GET /measurements?policy=latest".
+//
+// GET /ws
+//     Switch to the WebSocket protocol, and push the latest measurement and
+//     then each future one as a binary frame (see `format_record_frame`).
+//     Answer pings with pongs. There are no subscriptions to multiplex:
+//     measurements are the only stream, and every client gets all of them.
+//     Text and binary frames from the client are ignored.
+//
+// GET /metrics
+//     Return the latest measurement and the server's own statistics in the
+//     Prometheus text format. Then handle the next request on the connection,
+//     if any.
+//
+// GET /history
+// GET /history?hours=<hours>
+//     Return the measurements kept in `history()` as JSON lines, oldest
+//     first: all of them, or those from the last so many hours. Each has the
+//     time at which it was published, in seconds of uptime since the history
+//     began, its number in the log in flash, and its temperature and humidity
+//     to hundredths. Measurements from before a reset are included. Then
+//     close the connection.
+//
+// GET /rollups?minutes=<1, 5, or 60>
+//     Return the windows of that many minutes kept in `rollups()` as JSON
+//     lines, oldest first, the last being the window in progress. Each has
+//     the time at which it begins, as in "/history", the number of
+//     measurements in it, and the minimum, maximum, and mean of each reading.
+//     Then close the connection. Without a valid number of minutes, return a
+//     400 response instead.
+//
+// Any other path gets a 404 response.
+constexpr auto routes = common::make_route_table<Endpoint>({
+    {"GET", "/", Endpoint::LATEST},
+    {"GET", "/latest", Endpoint::LATEST},
+    {"GET", "/measurements", Endpoint::MEASUREMENTS},
+    {"GET", "/events", Endpoint::EVENTS},
+    {"GET", "/ws", Endpoint::WEBSOCKET},
+    {"GET", "/metrics", Endpoint::METRICS},
+    {"GET", "/wait", Endpoint::WAIT},
+    {"GET", "/history", Endpoint::HISTORY},
+    {"GET", "/rollups", Endpoint::ROLLUPS}});
+
+// Return the sequence number in the specified `request`'s Last-Event-ID
+// header, or zero if there isn't one.
+unsigned last_event_id(const common::Request& request) {
+    const std::string_view id = request.last_event_id.view();
+    unsigned sequence_number = 0;
+    std::from_chars(id.data(), id.data() + id.size(), sequence_number);
+    return sequence_number;
+}
+
+// Return whether the specified `request` for the specified `endpoint` asks
+// for CBOR rather than JSON.
+bool wants_cbor(const common::Request& request, Endpoint endpoint) {
+    const std::string_view accept = request.accept.view();
+    return common::accepts_media_type(accept, "application/cbor") ||
+        (endpoint == Endpoint::MEASUREMENTS && common::accepts_media_type(accept, "application/cbor-seq"));
+}
+
+// Return the number in the specified `request`'s query parameter having the
+// specified `name`, or `std::nullopt` if there isn't one.
+std::optional<unsigned> number_parameter(const common::Request& request, std::string_view name) {
+    const std::string_view text = common::query_parameter(request.query.view(), name);
+    unsigned number;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+// `Co2Alert` fires when the CO2 concentration crosses a threshold: when it
+// rises above `threshold` (`ABOVE`), or falls below it (`BELOW`). The first
+// measurement evaluated only says which side of the threshold the
+// concentration starts on, so the alert fires on a measurement past the
+// threshold only if the one before it wasn't. Having fired, it doesn't fire
+// again until the concentration has gone back past the threshold by at least
+// `hysteresis`, so that readings hovering around the threshold fire it once
+// rather than at every crossing.
+struct Co2Alert {
+    enum Direction {
+        ABOVE,
+        BELOW
+    };
+
+    Direction direction;
+    uint16_t threshold;
+    uint16_t hysteresis;
+    // whether the next measurement past the threshold fires the alert
+    bool armed = false;
+    // whether a measurement has been evaluated, which arms the alert unless
+    // it's already past the threshold
+    bool started = false;
+    // the sequence number of the last measurement evaluated, or zero. A new
+    // alert is given the one before the latest.
+    unsigned evaluated = 0;
+
+    // Return whether the specified `other` alert has the same condition.
+    bool same_condition(const Co2Alert& other) const {
+        return direction == other.direction && threshold == other.threshold && hysteresis == other.hysteresis;
+    }
+
+    // Evaluate the alert for a measurement of the specified `co2_ppm`. Return
+    // whether it fires.
+    bool update(int co2_ppm) {
+        const int past = direction == ABOVE ? co2_ppm - threshold : threshold - co2_ppm;
+        if (!std::exchange(started, true)) {
+            armed = past <= 0;
+            return false;
+        }
+        if (past > 0) {
+            return std::exchange(armed, false);
+        }
+        if (-past >= hysteresis) {
+            armed = true;
+        }
+        return false;
+    }
+};
+
+// Return the alert that the specified `request` asks for with its "co2_above"
+// or "co2_below" query parameter, and its optional "hysteresis" parameter, or
+// `std::nullopt` if the request doesn't specify exactly one valid alert.
+std::optional<Co2Alert> co2_alert(const common::Request& request) {
+    const auto above = number_parameter(request, "co2_above");
+    const auto below = number_parameter(request, "co2_below");
+    const auto hysteresis = common::query_parameter(request.query.view(), "hysteresis").empty()
+        ? std::optional<unsigned>(0) : number_parameter(request, "hysteresis");
+    if (bool(above) == bool(below) || !hysteresis) {
+        return std::nullopt;
+    }
+    const unsigned threshold = above ? *above : *below;
+    if (threshold > UINT16_MAX || *hysteresis > UINT16_MAX) {
+        return std::nullopt;
+    }
+    return Co2Alert{
+        .direction = above ? Co2Alert::ABOVE : Co2Alert::BELOW,
+        .threshold = uint16_t(threshold),
+        .hysteresis = uint16_t(*hysteresis)};
+}
+
+// a response for a request whose query parameters aren't valid, e.g. a
+// "/wait" request that doesn't specify an alert
+constexpr char bad_request_response[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+// Wait until the specified `alert` fires, evaluating it for each measurement
+// since the one it last evaluated (as many as are still in `recent`), or until
+// `long_poll_timeout` has elapsed. Return whether it fired.
+picoro::Coroutine<bool> wait_for_alert(Co2Alert& alert) {
+    const absolute_time_t deadline = make_timeout_time_ms(
+        std::chrono::duration_cast<std::chrono::milliseconds>(long_poll_timeout).count());
+    for (;;) {
+        const unsigned newest = latest.sequence_number;
+        unsigned next = alert.evaluated + 1;
+        if (newest >= max_batch_size && next < newest - max_batch_size + 1) {
+            next = newest - max_batch_size + 1;
+        }
+        bool fired = false;
+        for (; next <= newest; ++next) {
+            fired = alert.update(recent[next % max_batch_size].co2_ppm) || fired;
+        }
+        alert.evaluated = newest;
+        if (fired) {
+            co_return true;
+        }
+        if (time_reached(deadline)) {
+            co_return false;
+        }
+        co_await long_poll_wakeup().next();
+    }
+}
+
+enum class StreamPolicy {
+    // Send the measurements that the client missed while it was busy
+    // receiving, in one batch.
+    BATCH,
+    // Send only the latest measurement, dropping any that the client missed.
+    KEEP_LATEST
+};
+
+// Return the policy that the specified `request` asks for with its "policy"
+// query parameter: "batch" (the default) or "latest".
+StreamPolicy stream_policy(const common::Request& request) {
+    if (common::query_parameter(request.query.view(), "policy") == "latest") {
+        return StreamPolicy::KEEP_LATEST;
+    }
+    return StreamPolicy::BATCH;
+}
+
+// `Subscriber` is the state of one client's stream of measurements.
+// Subscribers are listed in `subscribers()`, so that how far behind they are,
+// and how many measurements they missed, can be reported.
+struct Subscriber : common::IntrusiveList<Subscriber>::Node {
+    StreamPolicy policy;
+    // the sequence number of the most recent measurement sent
+    unsigned last_sent;
+    // how many measurements were never sent, because the client fell too far
+    // behind (or, with `KEEP_LATEST`, behind at all)
+    unsigned dropped = 0;
+    // how many measurements were sent as part of a batch
+    unsigned batched = 0;
+
+    Subscriber(StreamPolicy policy, unsigned last_sent);
+
+    // Return how many measurements the client is behind.
+    unsigned lag() const { return latest.sequence_number - last_sent; }
+};
+
+common::IntrusiveList<Subscriber>& subscribers() {
+    static common::IntrusiveList<Subscriber> instance;
+    return instance;
+}
+
+Subscriber::Subscriber(StreamPolicy policy, unsigned last_sent)
+: Node(subscribers())
+, policy(policy)
+, last_sent(last_sent) {}
+
+// Metrics about the latest measurement are left out until there is one, so
+// that they aren't mistaken for readings of zero.
+constexpr char sensor_metrics_format[] =
+    COMMON_METRIC_FAMILY("scd4x_co2_ppm", "gauge",
+        "CO2 concentration, in parts per million.")
+    "scd4x_co2_ppm %hu\n"
+    COMMON_METRIC_FAMILY("scd4x_temperature_celsius", "gauge",
+        "Temperature.")
+    "scd4x_temperature_celsius %.3f\n"
+    COMMON_METRIC_FAMILY("scd4x_relative_humidity_percent", "gauge",
+        "Relative humidity.")
+    "scd4x_relative_humidity_percent %.3f\n";
+
+using SensorMetrics = common::Format<sensor_metrics_format,
+    common::Decimal<uint16_t>,
+    common::Fixed<int32_t, 1000, 3>,
+    common::Fixed<int32_t, 1000, 3>>;
+
+constexpr char stream_metrics_format[] =
+    COMMON_METRIC_FAMILY("scd4x_measurements_total", "counter",
+        "Measurements read from the sensor.")
+    "scd4x_measurements_total %u\n"
+    COMMON_METRIC_FAMILY("http_stream_clients", "gauge",
+        "Clients receiving a stream of measurements.")
+    "http_stream_clients %u\n"
+    COMMON_METRIC_FAMILY("http_stream_lag_max", "gauge",
+        "Measurements not yet sent to the streaming client furthest behind.")
+    "http_stream_lag_max %u\n"
+    COMMON_METRIC_FAMILY("http_stream_dropped", "gauge",
+        "Measurements that the current streaming clients missed by falling behind.")
+    "http_stream_dropped %u\n";
+
+using StreamMetrics = common::Format<stream_metrics_format,
+    common::Decimal<unsigned>,
+    common::Decimal<std::size_t>,
+    common::Decimal<unsigned>,
+    common::Decimal<unsigned>>;
+
+constexpr std::size_t max_metrics_body_length =
+    SensorMetrics::max_length + StreamMetrics::max_length + common::ServerMetrics::max_length;
+
+using MetricsHeader = common::MetricsResponseHeader<max_metrics_body_length>;
+
+constexpr std::size_t max_metrics_response_length = MetricsHeader::max_length + max_metrics_body_length;
+
+int format_metrics(
+    // +1 for the null terminator
+    std::array<char, max_metrics_response_length + 1>& buffer) {
+    char *const body = buffer.data();
+    int body_length = 0;
+    if (latest.sequence_number != 0) {
+        body_length += SensorMetrics::write(body,
+            latest.co2_ppm,
+            latest.temperature_millicelsius,
+            latest.relative_humidity_millipercent);
+    }
+
+    unsigned lag_max = 0;
+    unsigned dropped = 0;
+    for (const Subscriber& subscriber : subscribers()) {
+        lag_max = std::max(lag_max, subscriber.lag());
+        dropped += subscriber.dropped;
+    }
+    body_length += StreamMetrics::write(body + body_length,
+        latest.sequence_number,
+        subscribers().size(),
+        lag_max,
+        dropped);
+
+    const uint32_t uptime_seconds = to_us_since_boot(get_absolute_time()) / 1'000'000;
+    body_length += common::write_server_metrics(body + body_length,
+        admission(), idle_timeout(), get_free_heap(), uptime_seconds);
+
+    const int header_length = common::insert_length_prefix<MetricsHeader>(body, body_length);
+    body[header_length + body_length] = '\0';
+    return header_length + body_length;
+}
+
+// The history is sent as JSON lines, oldest first. There's no Content-Length,
+// because each line's length varies; instead, the response ends when the
+// connection is closed.
+constexpr char history_response_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/x-ndjson\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+constexpr char history_line_format[] =
+    "{\"time_seconds\": %ld,"
+    " \"record_number\": %ld,"
+    " \"CO2_ppm\": %ld,"
+    " \"temperature_celsius\": %.2f,"
+    " \"relative_humidity_percent\": %.2f}\n";
+
+using HistoryLine = common::Format<history_line_format,
+    common::Decimal<int32_t>,
+    common::Decimal<int32_t>,
+    common::Decimal<int32_t>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>>;
+
+// Send the samples in `history()` from the last specified number of `hours`,
+// or all of them, a few lines per send. The samples are decoded one at a
+// time, and the lines are rendered in this coroutine's frame. Samples pushed
+// while a send is in progress are sent too, and samples replaced meanwhile
+// are skipped.
+picoro::Coroutine<void> send_history(
+    picoro::Connection& conn,
+    common::IdleTimeout::Watch& watch,
+    std::optional<unsigned> hours) {
+    constexpr int lines_per_send = 8;
+    std::array<char, HistoryLine::max_length * lines_per_send + 1> lines;
+
+    const auto [count, err] = co_await conn.send(history_response_header);
+    if (err) {
+        co_return;
+    }
+
+    uint32_t since = 0;
+    if (hours) {
+        const uint32_t now = history_time();
+        since = *hours < now / 3600 ? now - *hours * 3600 : 0;
+    }
+
+    auto cursor = history().cursor();
+    MeasurementHistory::Sample sample;
+    bool more = cursor.next(sample);
+    while (more) {
+        int length = 0;
+        for (int i = 0; i < lines_per_send && more; more = cursor.next(sample)) {
+            if (uint32_t(sample[TIME_SECONDS]) < since) {
+                continue;
+            }
+            length += HistoryLine::write(lines.data() + length,
+                sample[TIME_SECONDS],
+                sample[RECORD_NUMBER],
+                sample[CO2_PPM],
+                sample[TEMPERATURE_CENTICELSIUS],
+                sample[RELATIVE_HUMIDITY_CENTIPERCENT]);
+            ++i;
+        }
+        if (length == 0) {
+            continue;
+        }
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        const auto [count, err] = co_await conn.send(std::string_view(lines.data(), length));
+        if (err) {
+            co_return;
+        }
+        // Samples may have been pushed during the send.
+        more = more || cursor.next(sample);
+    }
+}
+
+// Send events for the measurements after the one having the specified
+// sequence number `last_seen`, decoding them from `history()`, a few per send,
+// as `send_history` does. Their readings are the history's, which are in
+// hundredths. Where measurements are missing from the history, because they
+// were replaced before they could be sent, send a "gap" event saying how
+// many. Return the sequence number of the last measurement sent,
+// which is the latest unless a send failed, in which case return zero.
+picoro::Coroutine<unsigned> send_missed_events(
+    picoro::Connection& conn,
+    common::IdleTimeout::Watch& watch,
+    unsigned last_seen) {
+    std::array<char, GapEvent::max_length + max_batch_events_length + 1> events;
+    std::array<Measurement, max_batch_size> batch;
+    unsigned sent = last_seen;
+
+    auto cursor = history().cursor();
+    MeasurementHistory::Sample sample;
+    bool more = cursor.next(sample);
+    while (more) {
+        int length = 0;
+        unsigned count = 0;
+        for (; count < max_batch_size && more; more = cursor.next(sample)) {
+            // Samples restored from flash are from earlier boots.
+            const uint32_t record_number = sample[RECORD_NUMBER];
+            if (record_number < boot_record_number) {
+                continue;
+            }
+            const unsigned sequence_number = record_number - boot_record_number + 1;
+            if (sequence_number <= sent) {
+                continue;
+            }
+            if (sequence_number != sent + 1) {
+                // Send what's batched, so that the gap comes between the
+                // measurements on either side of it.
+                if (count != 0) {
+                    break;
+                }
+                length += GapEvent::write(events.data() + length, sequence_number - sent - 1);
+            }
+            batch[count++] = {
+                .sequence_number = sequence_number,
+                .co2_ppm = uint16_t(sample[CO2_PPM]),
+                .temperature_millicelsius = sample[TEMPERATURE_CENTICELSIUS] * 10,
+                .relative_humidity_millipercent = sample[RELATIVE_HUMIDITY_CENTIPERCENT] * 10};
+            sent = sequence_number;
+        }
+        length += write_events(events.data() + length, std::span(batch.data(), count));
+        if (length == 0) {
+            continue;
+        }
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        const auto [sent_count, err] = co_await conn.send(std::string_view(events.data(), length));
+        watch.cancel();
+        if (err) {
+            co_return 0;
+        }
+        // Samples may have been pushed during the send.
+        more = more || cursor.next(sample);
+    }
+    co_return sent;
+}
+
+#define ROLLUP_READING_FORMAT(name, conversion) \
+    " \"" name "\": {\"min\": " conversion ", \"max\": " conversion ", \"mean\": " conversion "}"
+
+constexpr char rollup_line_format[] =
+    "{\"time_seconds\": %lu,"
+    " \"count\": %lu,"
+    ROLLUP_READING_FORMAT("CO2_ppm", "%ld") ","
+    ROLLUP_READING_FORMAT("temperature_celsius", "%.2f") ","
+    ROLLUP_READING_FORMAT("relative_humidity_percent", "%.2f")
+    "}\n";
+
+#undef ROLLUP_READING_FORMAT
+
+using RollupLine = common::Format<rollup_line_format,
+    common::Decimal<uint32_t>,
+    common::Decimal<uint32_t>,
+    common::Decimal<int32_t>,
+    common::Decimal<int32_t>,
+    common::Decimal<int32_t>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>,
+    common::Fixed<int32_t, 100, 2>>;
+
+// Send the windows in `rollups()` at the specified `resolution`. A few
+// windows at a time are copied into this coroutine's frame, rendered, and
+// sent. Each copy resumes after the start of the last window sent, so windows
+// begun during a send are sent too, and windows replaced meanwhile are
+// skipped.
+picoro::Coroutine<void> send_rollups(
+    picoro::Connection& conn,
+    common::IdleTimeout::Watch& watch,
+    common::RollupResolution resolution) {
+    constexpr int windows_per_send = 4;
+    std::array<MeasurementRollup::Window, windows_per_send> windows;
+    std::array<char, RollupLine::max_length * windows_per_send + 1> lines;
+
+    const auto [count, err] = co_await conn.send(history_response_header);
+    if (err) {
+        co_return;
+    }
+
+    uint32_t since = 0;
+    for (;;) {
+        const std::size_t copied = rollups().copy(resolution, since, windows);
+        if (copied == 0) {
+            co_return;
+        }
+        int length = 0;
+        for (std::size_t i = 0; i < copied; ++i) {
+            const MeasurementRollup::Window& window = windows[i];
+            length += RollupLine::write(lines.data() + length,
+                window.start,
+                window.count,
+                window.min[ROLLUP_CO2_PPM],
+                window.max[ROLLUP_CO2_PPM],
+                window.mean(ROLLUP_CO2_PPM),
+                window.min[ROLLUP_TEMPERATURE_CENTICELSIUS],
+                window.max[ROLLUP_TEMPERATURE_CENTICELSIUS],
+                window.mean(ROLLUP_TEMPERATURE_CENTICELSIUS),
+                window.min[ROLLUP_RELATIVE_HUMIDITY_CENTIPERCENT],
+                window.max[ROLLUP_RELATIVE_HUMIDITY_CENTIPERCENT],
+                window.mean(ROLLUP_RELATIVE_HUMIDITY_CENTIPERCENT));
+        }
+        since = windows[copied - 1].start + 1;
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        const auto [count, err] = co_await conn.send(std::string_view(lines.data(), length));
+        if (err) {
+            co_return;
+        }
+    }
+}
+
+// Send the specified complete `response` to the specified `request`, with the
+// Connection header that the request calls for, if any (see
+// `common::connection_header`). Responses are shared by all connections, e.g.
+// in the render caches, so the header isn't part of them. Instead, it's sent
+// with a copy of the status line, and then the rest of the response is sent
+// from where it is.
+picoro::Coroutine<err_t> send_response(
+    picoro::Connection& conn, const common::Request& request, std::string_view response) {
+    const std::string_view connection = common::connection_header(request);
+    if (connection.empty()) {
+        const auto [count, err] = co_await conn.send(response);
+        co_return err;
+    }
+    const std::size_t status_length = response.find("\r\n") + 2;
+    char head[64];
+    if (status_length + connection.size() > sizeof head) {
+        // Not for any of our responses, whose status lines are short.
+        co_return ERR_VAL;
+    }
+    std::memcpy(head, response.data(), status_length);
+    std::memcpy(head + status_length, connection.data(), connection.size());
+    const auto [count, err] = co_await conn.send(std::string_view(head, status_length + connection.size()));
+    if (err) {
+        co_return err;
+    }
+    const auto [rest_count, rest_err] = co_await conn.send(response.substr(status_length));
+    co_return rest_err;
+}
+
+// Send the metrics in response to the specified `request`. They're rendered in
+// this coroutine's frame, so that the buffer takes up heap only while a scrape
+// is being answered.
+picoro::Coroutine<err_t> send_metrics(picoro::Connection& conn, const common::Request& request) {
+    std::array<char, max_metrics_response_length + 1> response;
+    const int length = format_metrics(response);
+    co_return co_await send_response(conn, request, std::string_view(response.data(), length));
+}
+
+// Send the measurements after `subscriber.last_sent`, and then each one
+// published from now on, until sending fails.
+//
+// While a send is in progress, the client isn't waiting on the broadcaster,
+// so measurements published meanwhile pass it by. When the send completes,
+// the client catches up according to its policy: either with the missed
+// measurements formatted by `format_batch` into one send (as many as are
+// still in `recent`), or with just the latest. Single measurements are
+// formatted by `format` and shared with other clients through `cache`. A batch
+// is formatted on the heap, and held only while it's being sent, so that
+// clients that keep up don't carry room for one in their frames. Either way,
+// a slow client costs a bounded amount of memory, and no other client waits
+// for it.
+template <std::size_t capacity, std::size_t batch_capacity>
+picoro::Coroutine<void> stream_measurements(
+    picoro::Connection& conn,
+    common::IdleTimeout::Watch& watch,
+    Subscriber& subscriber,
+    common::RenderCache<capacity>& cache,
+    int (*format)(std::array<char, capacity>&, const Measurement&),
+    int (*format_batch)(std::array<char, batch_capacity>&, std::span<const Measurement>)) {
+    std::unique_ptr<std::array<char, batch_capacity>> batch;
+    // Waiting for the next measurement doesn't count against the client.
+    watch.cancel();
+    for (;;) {
+        if (subscriber.last_sent == latest.sequence_number) {
+            co_await broadcaster().next();
+        }
+
+        const unsigned newest = latest.sequence_number;
+        unsigned first = subscriber.last_sent + 1;
+        const unsigned oldest_allowed = subscriber.policy == StreamPolicy::KEEP_LATEST ? newest
+            : newest < max_batch_size ? 1 : newest - max_batch_size + 1;
+        if (first < oldest_allowed) {
+            picoro::debug("stream_measurements(...), client is %u behind. Dropping %u.\n",
+                newest - subscriber.last_sent, oldest_allowed - first);
+            subscriber.dropped += oldest_allowed - first;
+            first = oldest_allowed;
+        }
+
+        std::shared_ptr<const common::Rendered<capacity>> single;
+        std::string_view text;
+        if (first == newest) {
+            const Measurement current = latest;
+            single = cache.get(current.sequence_number, [&](auto& buffer) {
+                return format(buffer, current);
+            });
+            text = single->text();
+        } else {
+            std::array<Measurement, max_batch_size> missed;
+            const unsigned count = newest - first + 1;
+            for (unsigned i = 0; i < count; ++i) {
+                missed[i] = recent[(first + i) % max_batch_size];
+            }
+            batch = std::make_unique<std::array<char, batch_capacity>>();
+            text = std::string_view(batch->data(), format_batch(*batch, std::span(missed.data(), count)));
+            subscriber.batched += count;
+        }
+        subscriber.last_sent = newest;
+
+        picoro::debug("stream_measurements(...), about to send() through measurement %u.\n", newest);
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        const auto [count, err] = co_await conn.send(text);
+        watch.cancel();
+        batch.reset();
+        if (err) {
+            picoro::debug("stream_measurements(...), send() had an error: %s\n", picoro::lwip_describe(err));
+            co_return;
+        }
+    }
+}
+
+// A WebSocket connection has two coroutines: `handle_websocket` receives the
+// client's frames and answers them, while `push_measurements` sends each
+// measurement. `WebSocketSession` makes sure that only one of them sends at a
+// time. A frame that becomes ready while the other coroutine is sending is
+// left pending, and the other coroutine sends it when it's done.
+struct WebSocketSession {
+    picoro::Connection& conn;
+    // armed only while sending, because a WebSocket client has no reason to
+    // send anything
+    common::IdleTimeout::Watch& watch;
+    // whether a coroutine is in `flush`
+    bool sending = false;
+    // whether `handle_websocket` is done with the connection
+    bool closing = false;
+    std::shared_ptr<const common::Rendered<max_record_frame_length + 1>> pending_record;
+    char pending_control[common::max_websocket_frame_header_length + common::max_websocket_control_payload];
+    int pending_control_length = 0;
+
+    WebSocketSession(picoro::Connection& conn, common::IdleTimeout::Watch& watch)
+    : conn(conn)
+    , watch(watch) {}
+
+    // Replace any pending control frame with one having the specified
+    // `opcode` and `payload`.
+    void queue_control(common::WebSocketOpcode opcode, std::string_view payload) {
+        const int header_length = common::write_websocket_frame_header(pending_control, opcode, payload.size());
+        std::memcpy(pending_control + header_length, payload.data(), payload.size());
+        pending_control_length = header_length + payload.size();
+    }
+
+    // Send the pending frames, unless another coroutine is already doing so.
+    // Return the error, if any, from sending.
+    picoro::Coroutine<err_t> flush();
+};
+
+picoro::Coroutine<err_t> WebSocketSession::flush() {
+    if (sending) {
+        co_return ERR_OK;
+    }
+    sending = true;
+    watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+    err_t err = ERR_OK;
+    while (!err && (pending_control_length || pending_record)) {
+        // Take the frame out of the session before sending it, because the
+        // other coroutine might queue another frame meanwhile.
+        if (pending_control_length) {
+            char frame[sizeof pending_control];
+            const int length = pending_control_length;
+            std::memcpy(frame, pending_control, length);
+            pending_control_length = 0;
+            std::tie(std::ignore, err) = co_await conn.send(std::string_view(frame, length));
+        } else {
+            const auto record = std::move(pending_record);
+            pending_record.reset();
+            std::tie(std::ignore, err) = co_await conn.send(record->text());
+        }
+    }
+    watch.cancel();
+    sending = false;
+    co_return err;
+}
+
+// Send the latest measurement, and then each one published from now on, until
+// sending fails or the session is closing. Measurements published while a
+// frame is being sent are dropped, except for the latest.
+picoro::Coroutine<void> push_measurements(WebSocketSession& session) {
+    Subscriber subscriber(StreamPolicy::KEEP_LATEST, 0);
+    for (;;) {
+        while (subscriber.last_sent == latest.sequence_number && !session.closing) {
+            co_await long_poll_wakeup().next();
+        }
+        if (session.closing) {
+            co_return;
+        }
+        const Measurement current = latest;
+        if (subscriber.last_sent != 0) {
+            subscriber.dropped += current.sequence_number - subscriber.last_sent - 1;
+        }
+        subscriber.last_sent = current.sequence_number;
+        session.pending_record = record_cache().get(current.sequence_number, [&](auto& buffer) {
+            return format_record_frame(buffer, current);
+        });
+        if (const err_t err = co_await session.flush()) {
+            picoro::debug("push_measurements(...), send() had an error: %s\n", picoro::lwip_describe(err));
+            // Wake up `handle_websocket`, which is waiting to receive.
+            session.conn.close();
+            co_return;
+        }
+    }
+}
+
+// Answer the client's frames until the client closes the WebSocket or the
+// connection fails. Meanwhile, push measurements to the client.
+picoro::Coroutine<void> handle_websocket(picoro::Connection& conn, common::IdleTimeout::Watch& watch) {
+    watch.cancel();
+    WebSocketSession session(conn, watch);
+    auto pusher = push_measurements(session);
+    common::WebSocketReader<128> frames;
+
+    bool open = true;
+    while (open) {
+        while (open && !frames.next()) {
+            const auto [count, err] = co_await conn.recv(frames.free_space(), frames.free_size());
+            if (err) {
+                picoro::debug("handle_websocket(...), recv() had an error: %s\n", picoro::lwip_describe(err));
+                open = false;
+            } else {
+                frames.received(count);
+            }
+        }
+        if (!open) {
+            break;
+        }
+
+        const common::WebSocketFrameParser& frame = frames.parser();
+        if (frames.status() != common::WebSocketFrameParser::COMPLETE) {
+            // status code 1002: protocol error
+            session.pending_record.reset();
+            session.queue_control(common::WebSocketOpcode::CLOSE, std::string_view("\x03\xEA", 2));
+            co_await session.flush();
+            break;
+        }
+        switch (frame.opcode()) {
+        case common::WebSocketOpcode::PING:
+            session.queue_control(common::WebSocketOpcode::PONG, frame.payload());
+            open = !co_await session.flush();
+            break;
+        case common::WebSocketOpcode::CLOSE:
+            // Echo the client's status code, if any, and then we're done.
+            session.pending_record.reset();
+            session.queue_control(common::WebSocketOpcode::CLOSE, frame.payload().substr(0, 2));
+            co_await session.flush();
+            open = false;
+            break;
+        default:
+            // Clients have nothing to say other than ping and close.
+            break;
+        }
+    }
+
+    session.closing = true;
+    // `pusher` refers to `session`, so wait for it to finish. If it's waiting
+    // for a measurement, wake it, rather than holding the connection until
+    // the sensor's next one. If it's sending, it finishes when the send does.
+    long_poll_wakeup().publish(latest.sequence_number);
+    co_await std::move(pusher);
+}
+
+picoro::Coroutine<void> handle_client(picoro::Connection conn, common::AdmissionControl::Ticket ticket) {
+    // `ticket` counts this connection as live until we return.
+    (void) ticket;
+    common::IdleTimeout::Watch watch(idle_timeout(), conn);
+    // Requests are parsed as they arrive, so this buffer limits only how much
+    // is received at a time, not how large a request can be.
+    common::RequestReader<256> requests;
+    // the alert that the client most recently waited on, if any
+    std::optional<Co2Alert> alert;
+
+    for (;;) {
+        while (!requests.next()) {
+            picoro::debug("in handle_client(...), about to await recv()\n");
+            watch.expect_request(requests.parser(), request_timeouts);
+            const auto [count, err] = co_await conn.recv(requests.free_space(), requests.free_size());
+            watch.cancel();
+            picoro::debug("in handle_client(...), received %d bytes with error %s\n", count, picoro::lwip_describe(err));
+            if (err) {
+                picoro::debug("in handle_client(...), since there was an error, I'm closing the connection and returning.\n");
+                co_return;
+            }
+            requests.received(count);
+        }
+
+        // The response is sent in one or a few sends, which together must not
+        // take longer than `write_timeout`. Streams rearm the watch per send.
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+
+        if (requests.status() != common::RequestParser::COMPLETE) {
+            picoro::debug("in handle_client(...), malformed request. Closing the connection.\n");
+            co_await conn.send(common::error_response(requests.status()));
+            co_return;
+        }
+
+        const common::Request& request = requests.request();
+        const bool keep_alive = request.keep_alive();
+        const auto route = routes.find(request.method.view(), request.path.view());
+        if (route.status != common::RouteStatus::FOUND) {
+            const err_t err = co_await send_response(conn, request,
+                route.status == common::RouteStatus::NOT_FOUND ? common::not_found_response : common::get_only_response);
+            if (err || !keep_alive) {
+                co_return;
+            }
+            continue;
+        }
+
+        picoro::debug("in handle_client(...), about to format response and await send()\n");
+        const bool cbor = wants_cbor(request, route.endpoint);
+        // Chunked transfer encoding is HTTP/1.1 only, so HTTP/1.0 clients get
+        // the latest measurement instead of a stream.
+        if (route.endpoint == Endpoint::MEASUREMENTS && request.minor_version == 1) {
+            const err_t err = co_await send_response(
+                conn, request, cbor ? cbor_chunked_response_header : chunked_response_header);
+            if (err) {
+                picoro::debug("Error sending headers: %s\n", picoro::lwip_describe(err));
+                co_return;
+            }
+            Subscriber subscriber(stream_policy(request), latest.sequence_number);
+            if (cbor) {
+                co_await stream_measurements(
+                    conn, watch, subscriber, cbor_chunk_cache(), format_cbor_chunk, format_cbor_chunk_batch);
+            } else {
+                co_await stream_measurements(
+                    conn, watch, subscriber, chunk_cache(), format_response_chunk, format_response_chunk_batch);
+            }
+            co_return;
+        }
+
+        if (route.endpoint == Endpoint::WEBSOCKET) {
+            if (!common::is_websocket_upgrade(request)) {
+                const err_t err = co_await send_response(conn, request, common::websocket_upgrade_required_response);
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+            char handshake[common::websocket_handshake_length];
+            const int length = common::write_websocket_handshake(handshake, request);
+            const auto [count, err] = co_await conn.send(std::string_view(handshake, length));
+            if (err) {
+                picoro::debug("Error sending WebSocket handshake: %s\n", picoro::lwip_describe(err));
+                co_return;
+            }
+            co_await handle_websocket(conn, watch);
+            co_return;
+        }
+
+        if (route.endpoint == Endpoint::EVENTS) {
+            const auto [count, err] = co_await conn.send(event_stream_header);
+            if (err) {
+                picoro::debug("Error sending headers: %s\n", picoro::lwip_describe(err));
+                co_return;
+            }
+            // Start with the latest measurement, unless the client is
+            // reconnecting, in which case start after the last one it saw.
+            // An id that's newer than the latest is from an earlier boot.
+            const unsigned newest = latest.sequence_number;
+            const unsigned last_seen = last_event_id(request);
+            unsigned start = last_seen != 0 && last_seen <= newest ? last_seen
+                : newest != 0 ? newest - 1 : 0;
+            const StreamPolicy policy = stream_policy(request);
+            if (policy == StreamPolicy::BATCH && newest >= max_batch_size && start < newest - max_batch_size) {
+                // Too far behind to catch up from `recent`.
+                start = co_await send_missed_events(conn, watch, start);
+                if (start == 0) {
+                    co_return;
+                }
+            }
+            Subscriber subscriber(policy, start);
+            co_await stream_measurements(
+                conn, watch, subscriber, event_cache(), format_event, format_event_batch);
+            co_return;
+        }
+
+        if (route.endpoint == Endpoint::HISTORY) {
+            co_await send_history(conn, watch, number_parameter(request, "hours"));
+            co_return;
+        }
+
+        if (route.endpoint == Endpoint::ROLLUPS) {
+            const auto minutes = number_parameter(request, "minutes");
+            const auto resolution = minutes ? common::rollup_resolution(*minutes) : std::nullopt;
+            if (!resolution) {
+                const err_t err = co_await send_response(conn, request, bad_request_response);
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+            co_await send_rollups(conn, watch, *resolution);
+            co_return;
+        }
+
+        if (route.endpoint == Endpoint::METRICS) {
+            const err_t err = co_await send_metrics(conn, request);
+            if (err || !keep_alive) {
+                co_return;
+            }
+            continue;
+        }
+
+        // A client that already has the latest measurement waits for the next
+        // one. The wait doesn't count against it, but then the response does.
+        // Sequence numbers start over at boot, so any other number means that
+        // the client doesn't have the latest measurement.
+        if (const auto after = number_parameter(request, "after");
+                route.endpoint == Endpoint::LATEST && after && *after == latest.sequence_number) {
+            watch.cancel();
+            const bool found = co_await wait_for_measurement_after(*after);
+            watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+            if (!found) {
+                const err_t err = co_await send_response(conn, request, no_new_measurement_response);
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+        }
+
+        if (route.endpoint == Endpoint::WAIT) {
+            const auto requested = co2_alert(request);
+            if (!requested) {
+                const err_t err = co_await send_response(conn, request, bad_request_response);
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+            if (!alert || !alert->same_condition(*requested)) {
+                alert = requested;
+                // Start from the latest measurement, so that the alert fires
+                // on a crossing after it, not on one that's already past.
+                alert->evaluated = latest.sequence_number == 0 ? 0 : latest.sequence_number - 1;
+            }
+            watch.cancel();
+            const bool fired = co_await wait_for_alert(*alert);
+            watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+            if (!fired) {
+                const err_t err = co_await send_response(conn, request, no_new_measurement_response);
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+        }
+
+        if (cbor) {
+            const auto response = cbor_response_cache().get(latest.sequence_number, [](auto& buffer) {
+                return format_cbor_response(buffer, latest);
+            });
+            const err_t err = co_await send_response(conn, request, response->text());
+            if (err || !keep_alive) {
+                co_return;
+            }
+            continue;
+        }
+
+        if (latest.sequence_number != 0) {
+            char not_modified[common::NotModified::max_length + 1];
+            const int length = common::write_not_modified(not_modified, request, boot_id(), latest.sequence_number);
+            if (length) {
+                const err_t err = co_await send_response(conn, request, std::string_view(not_modified, length));
+                if (err || !keep_alive) {
+                    co_return;
+                }
+                continue;
+            }
+        }
+
+        const auto response = response_cache().get(latest.sequence_number, [](auto& buffer) {
+            return format_response(buffer, latest);
+        });
+        const err_t err = co_await send_response(conn, request, response->text());
+        picoro::debug("handle_client(...), finished send() with error %s.\n", picoro::lwip_describe(err));
+        if (err || !keep_alive) {
+            co_return;
+        }
+    }
+}
+
+picoro::Coroutine<void> http_server(int port, int listen_backlog) {
+    picoro::debug("http_server: Starting server on port %d\n", port);
+    auto [listener, err] = picoro::listen(port, listen_backlog);
+    if (err) {
+        picoro::debug("http_server: Error starting server: %s\n", picoro::lwip_describe(err));
+        co_return;
+    }
+    picoro::debug("http_server: server started\n");
+
+    for (;;) {
+        picoro::debug("http_server: about to await accept()\n");
+        auto [conn, err] = co_await listener.accept();
+        if (err) {
+            picoro::debug("http_server: Error accepting connection: %s\n", picoro::lwip_describe(err));
+            continue;
+        }
+        picoro::debug("http_server: accept()ed a connection\n");
+        switch (admission().decide(get_free_heap())) {
+        case common::AdmissionControl::ADMIT:
+            handle_client(std::move(conn), admission().admit()).detach();
+            break;
+        case common::AdmissionControl::REFUSE:
+            picoro::debug("http_server: Too busy. Refusing a connection.\n");
+            common::refuse(std::move(conn), admission().refuse()).detach();
+            break;
+        case common::AdmissionControl::DROP:
+            picoro::debug("http_server: Much too busy. Dropping a connection.\n");
+            admission().drop();
+            break;
+        }
+    }
+}
+
+MeasurementHistory::Sample history_sample(
+    const Measurement& measurement, uint32_t time_seconds, uint32_t record_number) {
+    MeasurementHistory::Sample sample;
+    sample[TIME_SECONDS] = time_seconds;
+    sample[RECORD_NUMBER] = record_number;
+    sample[CO2_PPM] = measurement.co2_ppm;
+    sample[TEMPERATURE_CENTICELSIUS] = to_centi(measurement.temperature_millicelsius);
+    sample[RELATIVE_HUMIDITY_CENTIPERCENT] = to_centi(measurement.relative_humidity_millipercent);
+    return sample;
+}
+
+void publish(Measurement measurement) {
+    measurement.sequence_number = latest.sequence_number + 1;
+    latest = measurement;
+    recent[latest.sequence_number % max_batch_size] = latest;
+    const uint32_t time = history_time();
+    const uint32_t record_number = measurement_log().end();
+    history().push(history_sample(latest, time, record_number));
+    rollups().add(time, {
+        latest.co2_ppm,
+        to_centi(latest.temperature_millicelsius),
+        to_centi(latest.relative_humidity_millipercent)});
+    const LoggedMeasurement logged = {
+        .co2_ppm = latest.co2_ppm,
+        .temperature_centicelsius = int16_t(to_centi(latest.temperature_millicelsius)),
+        .relative_humidity_centipercent = uint16_t(to_centi(latest.relative_humidity_millipercent))};
+    measurement_log().append(time, {reinterpret_cast<const uint8_t*>(&logged), sizeof logged});
+    broadcaster().publish(latest);
+    long_poll_wakeup().publish(latest.sequence_number);
+}
+
+void restore_history() {
+    common::FlashLog& log = measurement_log();
+    log.mount();
+    common::FlashLog::Record record;
+    for (auto cursor = log.cursor(); cursor.next(record);) {
+        LoggedMeasurement logged;
+        if (record.payload.size() != sizeof logged) {
+            continue;
+        }
+        std::memcpy(&logged, record.payload.data(), sizeof logged);
+        MeasurementHistory::Sample sample;
+        sample[TIME_SECONDS] = record.time;
+        sample[RECORD_NUMBER] = record.number;
+        sample[CO2_PPM] = logged.co2_ppm;
+        sample[TEMPERATURE_CENTICELSIUS] = logged.temperature_centicelsius;
+        sample[RELATIVE_HUMIDITY_CENTIPERCENT] = logged.relative_humidity_centipercent;
+        history().push(sample);
+        rollups().add(record.time, {
+            logged.co2_ppm,
+            logged.temperature_centicelsius,
+            logged.relative_humidity_centipercent});
+    }
+    // The time spent resetting isn't known, so count it as a second.
+    history_time_base = log.empty() ? 0 : log.last_time() + 1;
+    boot_record_number = log.end();
+    picoro::debug("http_server: Restored %u measurements from flash, up to number %u. %u torn pages.\n",
+        unsigned(history().size()), unsigned(log.end()), log.torn_pages());
+}
+
+picoro::Coroutine<void> serve_http(async_context_t *ctx, int port, int listen_backlog) {
+    idle_timeout().run(ctx, std::chrono::seconds(1)).detach();
+    tick_long_polls(ctx).detach();
+    erase_log_ahead(ctx).detach();
+    co_await http_server(port, listen_backlog);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// The HTTP server, apart from the board: it serves whatever measurements are
+// published to it. It uses only picoro's coroutines and TCP, and the Pico
+// SDK's time and random number functions, so that it builds both for the
+// Pico W (see coroutines.cpp) and for Linux (see host/).
+
+#include <pico/async_context.h>
+
+#include <picoro/coroutine.h>
+
+#include <common/compressed_history.h>
+#include <common/rollup.h>
+
+#include <cstddef>
+#include <cstdint>
+
+struct Measurement {
+    unsigned sequence_number = 0;
+    uint16_t co2_ppm = 0;
+    int32_t temperature_millicelsius = 0;
+    int32_t relative_humidity_millipercent = 0;
+};
+
+// Every measurement is also kept in `history()` (see "/history"), compressed,
+// for as long as there's room. Each sample has these channels. Samples are
+// taken at a regular interval, so the time and record number are coded as
+// differences of differences, which are usually zero. The readings are coded
+// as differences, in hundredths.
+//
+// The time is in seconds of uptime, added up over the boots since the history
+// began, and the record number is the measurement's number in the log in
+// flash, so that both carry on across resets (see `restore_history`).
+enum HistoryChannel {
+    TIME_SECONDS,
+    RECORD_NUMBER,
+    CO2_PPM,
+    TEMPERATURE_CENTICELSIUS,
+    RELATIVE_HUMIDITY_CENTIPERCENT
+};
+
+// The history is reserved statically, so it comes out of what would otherwise
+// be heap, and what's left must still cover the server's admission limits: 8
+// connections of 4 KiB, and a 16 KiB reserve. host/history_bench.cpp reports
+// how many hours of measurements fit.
+constexpr std::size_t history_bytes = 48 * 1024;
+constexpr std::size_t history_block_bytes = 256;
+
+using MeasurementHistory = common::CompressedHistory<
+    history_block_bytes,
+    history_bytes / sizeof(common::CompressedBlock<history_block_bytes>),
+    common::DeltaCoding::DELTA_OF_DELTA,  // TIME_SECONDS
+    common::DeltaCoding::DELTA_OF_DELTA,  // RECORD_NUMBER
+    common::DeltaCoding::DELTA,           // CO2_PPM
+    common::DeltaCoding::DELTA,           // TEMPERATURE_CENTICELSIUS
+    common::DeltaCoding::DELTA>;          // RELATIVE_HUMIDITY_CENTIPERCENT
+
+// Return the history sample for the specified `measurement`, published at the
+// specified `time_seconds` and logged as the specified `record_number`.
+MeasurementHistory::Sample history_sample(
+    const Measurement& measurement, uint32_t time_seconds, uint32_t record_number);
+
+// Every measurement is also summarized in `rollups()` (see "/rollups"): the
+// minimum, maximum, and mean of each reading over each minute of the last
+// hour, each five minutes of the last 6 hours, and each hour of the last 2
+// days. The channels are CO2 in ppm, and temperature and humidity in
+// hundredths, and the time is as in `HistoryChannel`.
+enum RollupChannel {
+    ROLLUP_CO2_PPM,
+    ROLLUP_TEMPERATURE_CENTICELSIUS,
+    ROLLUP_RELATIVE_HUMIDITY_CENTIPERCENT
+};
+
+using MeasurementRollup = common::Rollup<3, 60, 72, 48>;
+
+// Measurements are also saved in an append-only log (see <common/flash_log.h>)
+// in the last `measurement_log_bytes` of flash, which the program is far from
+// reaching. At 16 bytes a measurement, this is about 3.7 days of them.
+constexpr uint32_t measurement_log_bytes = 1024 * 1024;
+
+// Read the measurements saved in flash into `history()` and `rollups()`, and
+// continue the log after them. Call once, before the first `publish`.
+void restore_history();
+
+// Make the specified `measurement` the latest, numbering it after the previous
+// one, and send it to the streaming clients.
+void publish(Measurement measurement);
+
+// Accept connections on the specified `port` and handle them, forever.
+picoro::Coroutine<void> serve_http(async_context_t *ctx, int port, int listen_backlog);
+
+// Return the number of bytes of heap not in use. This depends on the platform,
+// so it is defined alongside `main`.
+uint32_t get_free_heap();
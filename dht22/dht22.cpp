@@ -7,6 +7,7 @@
 
 #include <pico/async_context_poll.h>
 #include <pico/cyw43_arch.h>
+#include <pico/rand.h>
 #include <pico/stdio.h>
 
 #include <hardware/watchdog.h>
@@ -14,10 +15,24 @@
 #include <malloc.h>
 #include <tusb.h>
 
+#include <common/admission.h>
+#include <common/format.h>
+#include <common/history.h>
+#include <common/http.h>
+#include <common/idle_timeout.h>
+#include <common/metrics.h>
+#include <common/rollup.h>
+#include <common/routes.h>
+
 #include "secrets.h" // `wifi_password`
 
 #include <cassert>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <string_view>
 
 // Work around `-Werror=unused-variable` in release builds.
 #define ASSERT(WHAT) \
@@ -38,8 +53,8 @@ uint32_t get_free_heap() {
 
 struct Measurement {
   int sequence_number = 0;
-  float celsius = 0;
-  float humidity_percent = 0;
+  int32_t millicelsius = 0;
+  int32_t humidity_millipercent = 0;
   int timeouts = 0;
   int failed_checksums = 0;
 };
@@ -52,45 +67,175 @@ struct {
   Measurement sht30_top;
 } most_recent;
 
-int format_response(char (&buffer)[2048]) {
-  return std::snprintf(buffer, sizeof buffer,
-    "HTTP/1.1 200 OK\r\n"
-    "Connection: close\r\n"
-    "Content-Type: application/json\r\n"
-    "\r\n"
-    "{\"top\": {\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d},"
-    " \"middle\": {\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d},"
-    " \"bottom\": {\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d},"
-    " \"sht30_topper\": {\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d},"
-    " \"sht30_top\": {\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d},"
-    " \"free_heap_bytes\": %lu"
-    "}",
+// Once a minute, `record_history` keeps the most recent reading of every
+// sensor in `history()`, compactly, for as long as there's room.
+struct [[gnu::packed]] SensorRecord {
+  int16_t centicelsius;
+  uint16_t humidity_centipercent;
+};
+
+struct [[gnu::packed]] HistoryRecord {
+  uint32_t uptime_seconds;
+  // in the same order as the members of `most_recent`
+  SensorRecord sensors[5];
+};
+
+static_assert(sizeof(HistoryRecord) == 24);
+
+// 32 KiB of history is about 22 hours at one record a minute. It's reserved
+// statically, so it comes out of what would otherwise be heap, and what's
+// left must still cover `admission()`'s limits.
+constexpr std::size_t history_bytes = 32 * 1024;
+
+using SensorHistory =
+  common::History<HistoryRecord, common::history_capacity<HistoryRecord>(history_bytes)>;
+
+SensorHistory& history() {
+  static SensorHistory instance;
+  return instance;
+}
+
+// Every reading of every sensor is also summarized in `rollups`, in windows
+// of a minute, five minutes, and an hour, for "/rollups". Each sensor keeps a
+// quarter hour of minutes, two hours of five minutes, and a day of hours, in
+// about 2.5 KiB.
+enum SensorRollupChannel {
+  ROLLUP_CENTICELSIUS,
+  ROLLUP_HUMIDITY_CENTIPERCENT
+};
+
+using SensorRollup = common::Rollup<2, 15, 24, 24>;
+
+struct {
+  SensorRollup top;
+  SensorRollup middle;
+  SensorRollup bottom;
+  SensorRollup sht30_topper;
+  SensorRollup sht30_top;
+} rollups;
+
+// Return the specified `milli` value (e.g. millicelsius) in hundredths,
+// rounded to the nearest.
+int32_t to_centi(int32_t milli) {
+  return (milli + (milli < 0 ? -5 : 5)) / 10;
+}
+
+// Add the reading in the specified `latest` to the specified `rollup`, at the
+// time since boot.
+void add_to_rollup(SensorRollup *rollup, const Measurement& latest) {
+  const uint32_t uptime_seconds = to_us_since_boot(get_absolute_time()) / 1'000'000;
+  rollup->add(uptime_seconds, {to_centi(latest.millicelsius), to_centi(latest.humidity_millipercent)});
+}
+
+// Return a number that increases whenever any sensor in `most_recent` has a
+// new reading or a new error. It versions the response, for its ETag.
+uint32_t most_recent_version() {
+  uint32_t version = 0;
+  for (const Measurement *sensor : {&most_recent.top, &most_recent.middle, &most_recent.bottom,
+                                     &most_recent.sht30_topper, &most_recent.sht30_top}) {
+    version += sensor->sequence_number + sensor->timeouts + sensor->failed_checksums;
+  }
+  return version;
+}
+
+// `boot_id` distinguishes this boot's ETags from those of previous boots, when
+// the counters started over.
+uint32_t boot_id() {
+  static const uint32_t id = get_rand_32();
+  return id;
+}
+
+// `SENSOR_JSON_FORMAT` is how a `Measurement` is formatted, and
+// `SENSOR_JSON_FIELDS` describes the format's conversions. The temperature and
+// humidity are formatted from integers, without floating point.
+#define SENSOR_JSON_FORMAT \
+  "{\"sequence_number\": %d, \"celsius\": %.1f, \"humidity_percent\": %.1f, \"timeouts\": %d, \"failed_checksums\": %d}"
+#define SENSOR_JSON_FIELDS \
+  common::Decimal<int>, \
+  common::Fixed<int32_t, 1000, 1>, \
+  common::Fixed<int32_t, 1000, 1>, \
+  common::Decimal<int>, \
+  common::Decimal<int>
+
+constexpr char response_body_format[] =
+  "{\"top\": " SENSOR_JSON_FORMAT ","
+  " \"middle\": " SENSOR_JSON_FORMAT ","
+  " \"bottom\": " SENSOR_JSON_FORMAT ","
+  " \"sht30_topper\": " SENSOR_JSON_FORMAT ","
+  " \"sht30_top\": " SENSOR_JSON_FORMAT ","
+  " \"free_heap_bytes\": %lu"
+  "}";
+
+using ResponseBody = common::Format<response_body_format,
+  SENSOR_JSON_FIELDS,
+  SENSOR_JSON_FIELDS,
+  SENSOR_JSON_FIELDS,
+  SENSOR_JSON_FIELDS,
+  SENSOR_JSON_FIELDS,
+  common::Decimal<uint32_t>>;
+
+#undef SENSOR_JSON_FIELDS
+#undef SENSOR_JSON_FORMAT
+
+// Responses have a Content-Length, so that the client can send another request
+// on the same connection. They have an ETag, so that a polling client can ask
+// for the readings only if they have changed (If-None-Match).
+constexpr char response_header_format[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/json\r\n"
+  "Cache-Control: no-cache\r\n"
+  "ETag: " COMMON_HTTP_ETAG_FORMAT "\r\n"
+  "Content-Length: %d\r\n"
+  "\r\n";
+
+using ResponseHeader = common::Format<response_header_format,
+  COMMON_HTTP_ETAG_FIELDS,
+  common::Decimal<int, 0, int(ResponseBody::max_length)>>;
+
+constexpr std::size_t max_response_length =
+  ResponseHeader::max_length + ResponseBody::max_length;
+
+// Convert the specified floating point `value` to thousandths, e.g. degrees
+// Celsius to millicelsius. This happens once per sensor reading, so that
+// responses can be formatted without floating point.
+int32_t to_milli(float value) {
+  return std::lround(value * 1000);
+}
+
+int format_response(char (&buffer)[max_response_length + 1]) {
+  // Format the body first, so that we know its length, and then insert the
+  // header in front of it.
+  const int body_length = ResponseBody::write(buffer,
     most_recent.top.sequence_number,
-    most_recent.top.celsius,
-    most_recent.top.humidity_percent,
+    most_recent.top.millicelsius,
+    most_recent.top.humidity_millipercent,
     most_recent.top.timeouts,
     most_recent.top.failed_checksums,
     most_recent.middle.sequence_number,
-    most_recent.middle.celsius,
-    most_recent.middle.humidity_percent,
+    most_recent.middle.millicelsius,
+    most_recent.middle.humidity_millipercent,
     most_recent.middle.timeouts,
     most_recent.middle.failed_checksums,
     most_recent.bottom.sequence_number,
-    most_recent.bottom.celsius,
-    most_recent.bottom.humidity_percent,
+    most_recent.bottom.millicelsius,
+    most_recent.bottom.humidity_millipercent,
     most_recent.bottom.timeouts,
     most_recent.bottom.failed_checksums,
     most_recent.sht30_topper.sequence_number,
-    most_recent.sht30_topper.celsius,
-    most_recent.sht30_topper.humidity_percent,
+    most_recent.sht30_topper.millicelsius,
+    most_recent.sht30_topper.humidity_millipercent,
     most_recent.sht30_topper.timeouts,
     most_recent.sht30_topper.failed_checksums,
     most_recent.sht30_top.sequence_number,
-    most_recent.sht30_top.celsius,
-    most_recent.sht30_top.humidity_percent,
+    most_recent.sht30_top.millicelsius,
+    most_recent.sht30_top.humidity_millipercent,
     most_recent.sht30_top.timeouts,
     most_recent.sht30_top.failed_checksums,
     get_free_heap());
+  const int header_length = common::insert_length_prefix<ResponseHeader>(
+    buffer, body_length, boot_id(), most_recent_version());
+  buffer[header_length + body_length] = '\0';
+  return header_length + body_length;
 }
 
 const char *pico_describe(int error) {
@@ -172,20 +317,441 @@ picoro::Coroutine<void> wifi_connect(async_context_t *ctx, const char *SSID, con
     std::printf("Connected to WiFi.\n");
 }
 
-picoro::Coroutine<void> handle_client(picoro::Connection conn) {
-    std::printf("Handling client connection.\n");
-    char buffer[2048];
-    // Read the request (ought to be less than 2K in size), and ignore it.
-    auto [count, err] = co_await conn.recv(buffer, sizeof buffer);
+// Connections are kept open between requests, but are closed if the client
+// sends nothing for `idle`. A client also has a limited time to send each
+// request, whether or not it keeps sending something.
+constexpr common::RequestTimeouts request_timeouts = {
+    .idle = std::chrono::seconds(10),
+    .headers = std::chrono::seconds(5),
+    .body = std::chrono::seconds(5)};
+
+// A connection is closed if the client accepts none of a response for this
+// long.
+constexpr auto write_timeout = std::chrono::seconds(15);
+
+common::IdleTimeout& idle_timeout() {
+    static common::IdleTimeout instance;
+    return instance;
+}
+
+enum class Endpoint {
+    SENSORS,
+    METRICS,
+    HISTORY,
+    ROLLUPS
+};
+
+// GET /
+// GET /latest
+//     Return the most recent reading of every sensor.
+//
+// GET /metrics
+//     Return the most recent reading and error counts of every sensor, and the
+//     server's own statistics, in the Prometheus text format.
+//
+// GET /history
+//     Return the readings kept in `history()` as JSON lines, oldest first,
+//     each with the time since boot at which it was recorded. Then close the
+//     connection.
+//
+// GET /rollups?minutes=<1, 5, or 60>
+//     Return the windows of that many minutes kept in `rollups` as JSON
+//     lines, sensor by sensor, oldest first, the last of each sensor's being
+//     the window in progress. Each has the time since boot at which it
+//     begins, the number of readings in it, and their minimum, maximum, and
+//     mean. Then close the connection. Without a valid number of minutes,
+//     return a 400 response instead.
+//
+// Any other path gets a 404 response.
+constexpr auto routes = common::make_route_table<Endpoint>({
+    {"GET", "/", Endpoint::SENSORS},
+    {"GET", "/latest", Endpoint::SENSORS},
+    {"GET", "/metrics", Endpoint::METRICS},
+    {"GET", "/history", Endpoint::HISTORY},
+    {"GET", "/rollups", Endpoint::ROLLUPS}});
+
+// Fewer connections than the other servers allow, because `history()` and
+// `rollups` take up much of what would otherwise be heap.
+common::AdmissionControl& admission() {
+    static common::AdmissionControl instance({
+        .max_connections = 4,
+        .max_refusing = 2,
+        .reserve_bytes = 16 * 1024,
+        .connection_bytes = 4 * 1024});
+    return instance;
+}
+
+// `SENSOR_METRIC_FAMILY` is the text of a metric family having a sample for
+// each sensor, in the order of `most_recent`'s members. A sensor that hasn't
+// been read yet has a temperature and humidity of zero, and a
+// `sensor_readings_total` of zero.
+#define SENSOR_METRIC_FAMILY(name, type, help, conversion) \
+  COMMON_METRIC_FAMILY(name, type, help) \
+  name "{sensor=\"top\"} " conversion "\n" \
+  name "{sensor=\"middle\"} " conversion "\n" \
+  name "{sensor=\"bottom\"} " conversion "\n" \
+  name "{sensor=\"sht30_topper\"} " conversion "\n" \
+  name "{sensor=\"sht30_top\"} " conversion "\n"
+
+constexpr char temperature_metrics_format[] =
+  SENSOR_METRIC_FAMILY("temperature_celsius", "gauge", "Temperature.", "%.3f");
+constexpr char humidity_metrics_format[] =
+  SENSOR_METRIC_FAMILY("relative_humidity_percent", "gauge", "Relative humidity.", "%.3f");
+constexpr char readings_metrics_format[] =
+  SENSOR_METRIC_FAMILY("sensor_readings_total", "counter", "Successful readings.", "%d");
+constexpr char timeouts_metrics_format[] =
+  SENSOR_METRIC_FAMILY("sensor_timeouts_total", "counter", "Readings that timed out.", "%d");
+constexpr char checksums_metrics_format[] =
+  SENSOR_METRIC_FAMILY("sensor_failed_checksums_total", "counter", "Readings that failed their checksum.", "%d");
+
+#undef SENSOR_METRIC_FAMILY
+
+template <const char *format, typename Field>
+using SensorMetricFamily = common::Format<format, Field, Field, Field, Field, Field>;
+
+using TemperatureMetrics = SensorMetricFamily<temperature_metrics_format, common::Fixed<int32_t, 1000, 3>>;
+using HumidityMetrics = SensorMetricFamily<humidity_metrics_format, common::Fixed<int32_t, 1000, 3>>;
+using ReadingsMetrics = SensorMetricFamily<readings_metrics_format, common::Decimal<int>>;
+using TimeoutsMetrics = SensorMetricFamily<timeouts_metrics_format, common::Decimal<int>>;
+using ChecksumsMetrics = SensorMetricFamily<checksums_metrics_format, common::Decimal<int>>;
+
+// Write to the specified `output` the specified metric `Family`, taking each
+// sensor's value from its `Measurement` using the specified `member`. Return
+// the length of the text.
+template <typename Family, typename Value>
+int write_sensor_metrics(char *output, Value Measurement::*member) {
+  return Family::write(output,
+    most_recent.top.*member,
+    most_recent.middle.*member,
+    most_recent.bottom.*member,
+    most_recent.sht30_topper.*member,
+    most_recent.sht30_top.*member);
+}
+
+constexpr std::size_t max_metrics_body_length =
+  TemperatureMetrics::max_length +
+  HumidityMetrics::max_length +
+  ReadingsMetrics::max_length +
+  TimeoutsMetrics::max_length +
+  ChecksumsMetrics::max_length +
+  common::ServerMetrics::max_length;
+
+using MetricsHeader = common::MetricsResponseHeader<max_metrics_body_length>;
+
+constexpr std::size_t max_metrics_response_length = MetricsHeader::max_length + max_metrics_body_length;
+
+int format_metrics(char (&buffer)[max_metrics_response_length + 1]) {
+  int body_length = 0;
+  body_length += write_sensor_metrics<TemperatureMetrics>(buffer + body_length, &Measurement::millicelsius);
+  body_length += write_sensor_metrics<HumidityMetrics>(buffer + body_length, &Measurement::humidity_millipercent);
+  body_length += write_sensor_metrics<ReadingsMetrics>(buffer + body_length, &Measurement::sequence_number);
+  body_length += write_sensor_metrics<TimeoutsMetrics>(buffer + body_length, &Measurement::timeouts);
+  body_length += write_sensor_metrics<ChecksumsMetrics>(buffer + body_length, &Measurement::failed_checksums);
+  const uint32_t uptime_seconds = to_us_since_boot(get_absolute_time()) / 1'000'000;
+  body_length += common::write_server_metrics(buffer + body_length,
+    admission(), idle_timeout(), get_free_heap(), uptime_seconds);
+  const int header_length = common::insert_length_prefix<MetricsHeader>(buffer, body_length);
+  buffer[header_length + body_length] = '\0';
+  return header_length + body_length;
+}
+
+// Send the specified complete `response` to the specified `request`, with the
+// Connection header that the request calls for, if any (see
+// `common::connection_header`), after a copy of the status line.
+picoro::Coroutine<err_t> send_response(
+  picoro::Connection& conn, const common::Request& request, std::string_view response) {
+  const std::string_view connection = common::connection_header(request);
+  if (connection.empty()) {
+    const auto [count, err] = co_await conn.send(response);
+    co_return err;
+  }
+  const std::size_t status_length = response.find("\r\n") + 2;
+  char head[64];
+  if (status_length + connection.size() > sizeof head) {
+    // Not for any of our responses, whose status lines are short.
+    co_return ERR_VAL;
+  }
+  std::memcpy(head, response.data(), status_length);
+  std::memcpy(head + status_length, connection.data(), connection.size());
+  const auto [count, err] = co_await conn.send(std::string_view(head, status_length + connection.size()));
+  if (err) {
+    co_return err;
+  }
+  const auto [rest_count, rest_err] = co_await conn.send(response.substr(status_length));
+  co_return rest_err;
+}
+
+// Send the metrics in response to the specified `request`. They're rendered in
+// this coroutine's frame, so that the buffer takes up heap only while a scrape
+// is being answered.
+picoro::Coroutine<err_t> send_metrics(picoro::Connection& conn, const common::Request& request) {
+  char response[max_metrics_response_length + 1];
+  const int length = format_metrics(response);
+  co_return co_await send_response(conn, request, std::string_view(response, length));
+}
+
+// The history is sent as JSON lines, oldest first. There's no Content-Length,
+// because each line's length varies; instead, the response ends when the
+// connection is closed.
+constexpr char history_response_header[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/x-ndjson\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+#define SENSOR_HISTORY_FORMAT \
+  "{\"celsius\": %.2f, \"humidity_percent\": %.2f}"
+#define SENSOR_HISTORY_FIELDS \
+  common::Fixed<int16_t, 100, 2>, \
+  common::Fixed<uint16_t, 100, 2>
+
+constexpr char history_line_format[] =
+  "{\"uptime_seconds\": %lu,"
+  " \"top\": " SENSOR_HISTORY_FORMAT ","
+  " \"middle\": " SENSOR_HISTORY_FORMAT ","
+  " \"bottom\": " SENSOR_HISTORY_FORMAT ","
+  " \"sht30_topper\": " SENSOR_HISTORY_FORMAT ","
+  " \"sht30_top\": " SENSOR_HISTORY_FORMAT
+  "}\n";
+
+using HistoryLine = common::Format<history_line_format,
+  common::Decimal<uint32_t>,
+  SENSOR_HISTORY_FIELDS,
+  SENSOR_HISTORY_FIELDS,
+  SENSOR_HISTORY_FIELDS,
+  SENSOR_HISTORY_FIELDS,
+  SENSOR_HISTORY_FIELDS>;
+
+#undef SENSOR_HISTORY_FIELDS
+#undef SENSOR_HISTORY_FORMAT
+
+// Send the records in `history()`, a few lines per send. The lines are
+// rendered in this coroutine's frame. Records pushed while a send is in
+// progress are sent too, and records replaced meanwhile are skipped.
+picoro::Coroutine<void> send_history(picoro::Connection& conn, common::IdleTimeout::Watch& watch) {
+  constexpr int lines_per_send = 4;
+  char lines[HistoryLine::max_length * lines_per_send + 1];
+
+  const auto [count, err] = co_await conn.send(history_response_header);
+  if (err) {
+    co_return;
+  }
+
+  const SensorHistory& records = history();
+  for (uint32_t number = records.first(); number != records.end();) {
+    if (number < records.first()) {
+      number = records.first();
+    }
+    int length = 0;
+    for (int i = 0; i < lines_per_send && number != records.end(); ++i, ++number) {
+      const HistoryRecord& record = records.at(number);
+      const SensorRecord (&sensors)[5] = record.sensors;
+      length += HistoryLine::write(lines + length,
+        record.uptime_seconds,
+        sensors[0].centicelsius, sensors[0].humidity_centipercent,
+        sensors[1].centicelsius, sensors[1].humidity_centipercent,
+        sensors[2].centicelsius, sensors[2].humidity_centipercent,
+        sensors[3].centicelsius, sensors[3].humidity_centipercent,
+        sensors[4].centicelsius, sensors[4].humidity_centipercent);
+    }
+    watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+    const auto [count, err] = co_await conn.send(std::string_view(lines, length));
     if (err) {
       co_return;
     }
-    count = format_response(buffer);
-    std::tie(count, err) = co_await conn.send(std::string_view(buffer, count));
-    if (err) {
-        std::printf("handle_client: Error on send: %s\n", picoro::lwip_describe(err));
+  }
+}
+
+#define ROLLUP_READING_FORMAT(name) \
+  " \"" name "\": {\"min\": %.2f, \"max\": %.2f, \"mean\": %.2f}"
+
+// Each line of "/rollups" is one of these prefixes, naming the sensor,
+// followed by a `RollupLine`.
+constexpr std::string_view rollup_sensor_prefixes[] = {
+  "{\"sensor\": \"top\",",
+  "{\"sensor\": \"middle\",",
+  "{\"sensor\": \"bottom\",",
+  "{\"sensor\": \"sht30_topper\",",
+  "{\"sensor\": \"sht30_top\","
+};
+
+constexpr std::size_t max_rollup_sensor_prefix_length = rollup_sensor_prefixes[3].size();
+
+constexpr char rollup_line_format[] =
+  " \"uptime_seconds\": %lu,"
+  " \"count\": %lu,"
+  ROLLUP_READING_FORMAT("celsius") ","
+  ROLLUP_READING_FORMAT("humidity_percent")
+  "}\n";
+
+#undef ROLLUP_READING_FORMAT
+
+using RollupLine = common::Format<rollup_line_format,
+  common::Decimal<uint32_t>,
+  common::Decimal<uint32_t>,
+  common::Fixed<int32_t, 100, 2>,
+  common::Fixed<int32_t, 100, 2>,
+  common::Fixed<int32_t, 100, 2>,
+  common::Fixed<int32_t, 100, 2>,
+  common::Fixed<int32_t, 100, 2>,
+  common::Fixed<int32_t, 100, 2>>;
+
+// Send every sensor's windows in `rollups` at the specified `resolution`. A
+// few windows at a time are copied into this coroutine's frame, rendered, and
+// sent. Each copy resumes after the start of the last window sent, so windows
+// begun during a send are sent too, and windows replaced meanwhile are
+// skipped.
+picoro::Coroutine<void> send_rollups(
+    picoro::Connection& conn,
+    common::IdleTimeout::Watch& watch,
+    common::RollupResolution resolution) {
+  constexpr int windows_per_send = 4;
+  SensorRollup::Window windows[windows_per_send];
+  char lines[(max_rollup_sensor_prefix_length + RollupLine::max_length) * windows_per_send + 1];
+
+  const auto [count, err] = co_await conn.send(history_response_header);
+  if (err) {
+    co_return;
+  }
+
+  // in the same order as `rollup_sensor_prefixes`
+  const SensorRollup *const sensors[] = {
+    &rollups.top, &rollups.middle, &rollups.bottom, &rollups.sht30_topper, &rollups.sht30_top};
+  for (std::size_t sensor = 0; sensor < std::size(sensors); ++sensor) {
+    const std::string_view prefix = rollup_sensor_prefixes[sensor];
+    uint32_t since = 0;
+    while (const std::size_t copied = sensors[sensor]->copy(resolution, since, windows)) {
+      int length = 0;
+      for (std::size_t i = 0; i < copied; ++i) {
+        const SensorRollup::Window& window = windows[i];
+        length += prefix.copy(lines + length, prefix.size());
+        length += RollupLine::write(lines + length,
+          window.start,
+          window.count,
+          window.min[ROLLUP_CENTICELSIUS],
+          window.max[ROLLUP_CENTICELSIUS],
+          window.mean(ROLLUP_CENTICELSIUS),
+          window.min[ROLLUP_HUMIDITY_CENTIPERCENT],
+          window.max[ROLLUP_HUMIDITY_CENTIPERCENT],
+          window.mean(ROLLUP_HUMIDITY_CENTIPERCENT));
+      }
+      since = windows[copied - 1].start + 1;
+      watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+      const auto [count, err] = co_await conn.send(std::string_view(lines, length));
+      if (err) {
+        co_return;
+      }
+    }
+  }
+}
+
+constexpr char bad_request_response[] =
+  "HTTP/1.1 400 Bad Request\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n";
+
+// Return the resolution named by the specified `request`'s "minutes" query
+// parameter, or `std::nullopt` if it doesn't name one.
+std::optional<common::RollupResolution> requested_resolution(const common::Request& request) {
+  const std::string_view text = common::query_parameter(request.query.view(), "minutes");
+  unsigned minutes;
+  const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), minutes);
+  if (error != std::errc() || end != text.data() + text.size()) {
+    return std::nullopt;
+  }
+  return common::rollup_resolution(minutes);
+}
+
+picoro::Coroutine<void> handle_client(picoro::Connection conn, common::AdmissionControl::Ticket ticket) {
+    // `ticket` counts this connection as live until we return.
+    (void) ticket;
+    std::printf("Handling client connection.\n");
+    common::IdleTimeout::Watch watch(idle_timeout(), conn);
+    // Requests are parsed as they arrive.
+    common::RequestReader<256> requests;
+    char response[max_response_length + 1];
+    char not_modified[common::NotModified::max_length + 1];
+    for (;;) {
+        while (!requests.next()) {
+            watch.expect_request(requests.parser(), request_timeouts);
+            const auto [count, err] = co_await conn.recv(requests.free_space(), requests.free_size());
+            watch.cancel();
+            if (err) {
+                std::printf("Finished handling client connection.\n");
+                co_return;
+            }
+            requests.received(count);
+        }
+
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        if (requests.status() != common::RequestParser::COMPLETE) {
+            std::printf("handle_client: Malformed request.\n");
+            co_await conn.send(common::error_response(requests.status()));
+            co_return;
+        }
+
+        const common::Request& request = requests.request();
+        const bool keep_alive = request.keep_alive();
+        const auto route = routes.find(request.method.view(), request.path.view());
+        if (route.status == common::RouteStatus::FOUND && route.endpoint == Endpoint::HISTORY) {
+            co_await send_history(conn, watch);
+            std::printf("Finished handling client connection.\n");
+            co_return;
+        }
+
+        if (route.status == common::RouteStatus::FOUND && route.endpoint == Endpoint::ROLLUPS) {
+            const auto resolution = requested_resolution(request);
+            if (!resolution) {
+                const err_t err = co_await send_response(conn, request, bad_request_response);
+                if (err || !keep_alive) {
+                    std::printf("Finished handling client connection.\n");
+                    co_return;
+                }
+                continue;
+            }
+            co_await send_rollups(conn, watch, *resolution);
+            std::printf("Finished handling client connection.\n");
+            co_return;
+        }
+
+        if (route.status == common::RouteStatus::FOUND && route.endpoint == Endpoint::METRICS) {
+            const err_t err = co_await send_metrics(conn, request);
+            if (err) {
+                std::printf("handle_client: Error on send: %s\n", picoro::lwip_describe(err));
+            }
+            if (err || !keep_alive) {
+                std::printf("Finished handling client connection.\n");
+                co_return;
+            }
+            continue;
+        }
+
+        std::string_view reply;
+        switch (route.status) {
+        case common::RouteStatus::FOUND:
+            if (const int length = common::write_not_modified(not_modified, request, boot_id(), most_recent_version())) {
+                reply = std::string_view(not_modified, length);
+            } else {
+                reply = std::string_view(response, format_response(response));
+            }
+            break;
+        case common::RouteStatus::NOT_FOUND:
+            reply = common::not_found_response;
+            break;
+        case common::RouteStatus::METHOD_NOT_ALLOWED:
+            reply = common::get_only_response;
+            break;
+        }
+        const err_t err = co_await send_response(conn, request, reply);
+        if (err) {
+            std::printf("handle_client: Error on send: %s\n", picoro::lwip_describe(err));
+        }
+        if (err || !keep_alive) {
+            std::printf("Finished handling client connection.\n");
+            co_return;
+        }
     }
-    std::printf("Finished handling client connection.\n");
 }
 
 picoro::Coroutine<void> http_server(int port, int listen_backlog) {
@@ -202,7 +768,19 @@ picoro::Coroutine<void> http_server(int port, int listen_backlog) {
             std::printf("http_server: Error accepting connection: %s\n", picoro::lwip_describe(err));
             continue;
         }
-        handle_client(std::move(conn)).detach();
+        switch (admission().decide(get_free_heap())) {
+        case common::AdmissionControl::ADMIT:
+            handle_client(std::move(conn), admission().admit()).detach();
+            break;
+        case common::AdmissionControl::REFUSE:
+            std::printf("http_server: Too busy. Refusing a connection.\n");
+            common::refuse(std::move(conn), admission().refuse()).detach();
+            break;
+        case common::AdmissionControl::DROP:
+            std::printf("http_server: Much too busy. Dropping a connection.\n");
+            admission().drop();
+            break;
+        }
     }
 }
 
@@ -210,6 +788,7 @@ picoro::Coroutine<void> networking(async_context_t *ctx) {
     co_await wifi_connect(ctx, "Annoying Saxophone", wifi_password);
     const int port = 80;
     const int listen_backlog = 1;
+    idle_timeout().run(ctx, std::chrono::seconds(1)).detach();
     co_await http_server(port, listen_backlog);
 }
 
@@ -234,7 +813,8 @@ picoro::Coroutine<void> monitor_dht22(
     PIO pio,
     uint8_t data_pin,
     uint8_t power_pin,
-    Measurement *latest) {
+    Measurement *latest,
+    SensorRollup *rollup) {
   // Rather than connecting each sensor's power directly to 3.3V, I connect
   // each to its own GPIO pin. The GPIO pin can provide more than enough
   // current for the sensor, and can be set low at will to power cycle the
@@ -253,8 +833,9 @@ picoro::Coroutine<void> monitor_dht22(
     switch (rc) {
     case Sensor::OK:
       ++latest->sequence_number;
-      latest->celsius = celsius;
-      latest->humidity_percent = humidity_percent;
+      latest->millicelsius = to_milli(celsius);
+      latest->humidity_millipercent = to_milli(humidity_percent);
+      add_to_rollup(rollup, *latest);
       std::printf("{"
         "\"dht22_power_pin\": %d, "
         "\"celsius\": %.1f, "
@@ -306,15 +887,16 @@ picoro::Coroutine<void> monitor_sht30s(async_context_t *ctx) {
   i2c.init();
 
   // Each sensor is identified by which GPIO is powering it, and each is
-  // associated with a `Measurement` output.
+  // associated with a `Measurement` output and a `SensorRollup`.
   // There will be only one `SHT3x` sensor object, because it can't tell the
   // difference between different sensors connected to the same bus.
   struct Sensor {
     uint8_t power_pin;
     Measurement *data;
+    SensorRollup *rollup;
   } sensors[] = {
-    {.power_pin = 28, .data = &most_recent.sht30_topper},
-    {.power_pin = 8, .data = &most_recent.sht30_top}
+    {.power_pin = 28, .data = &most_recent.sht30_topper, .rollup = &rollups.sht30_topper},
+    {.power_pin = 8, .data = &most_recent.sht30_top, .rollup = &rollups.sht30_top}
   };
   const Sensor *enabled = &sensors[0];
   for (const auto& sensor : sensors) {
@@ -365,8 +947,25 @@ picoro::Coroutine<void> monitor_sht30s(async_context_t *ctx) {
       "\"humidity_percent\": %.1f"
       "}\n", (int)enabled->power_pin, celsius, percent);
     ++enabled->data->sequence_number;
-    enabled->data->celsius = celsius;
-    enabled->data->humidity_percent = percent;
+    enabled->data->millicelsius = to_milli(celsius);
+    enabled->data->humidity_millipercent = to_milli(percent);
+    add_to_rollup(enabled->rollup, *enabled->data);
+  }
+}
+
+picoro::Coroutine<void> record_history(async_context_t *ctx) {
+  for (;;) {
+    co_await picoro::sleep_for(ctx, std::chrono::minutes(1));
+    HistoryRecord record;
+    record.uptime_seconds = to_us_since_boot(get_absolute_time()) / 1'000'000;
+    int i = 0;
+    for (const Measurement *sensor : {&most_recent.top, &most_recent.middle, &most_recent.bottom,
+                                       &most_recent.sht30_topper, &most_recent.sht30_top}) {
+      record.sensors[i++] = SensorRecord{
+        .centicelsius = int16_t(to_centi(sensor->millicelsius)),
+        .humidity_centipercent = uint16_t(to_centi(sensor->humidity_millipercent))};
+    }
+    history().push(record);
   }
 }
 
@@ -375,15 +974,17 @@ picoro::Coroutine<void> sensors_main(async_context_t *ctx, picoro::dht22::Driver
     uint data_pin;
     uint power_pin;
     Measurement *data;
+    SensorRollup *rollup;
   } sensors[] = {
-    {.data_pin = 16, .power_pin = 13, .data = &most_recent.top},
-    {.data_pin = 15, .power_pin = 0, .data = &most_recent.middle},
-    {.data_pin = 22, .power_pin = 6, .data = &most_recent.bottom}
+    {.data_pin = 16, .power_pin = 13, .data = &most_recent.top, .rollup = &rollups.top},
+    {.data_pin = 15, .power_pin = 0, .data = &most_recent.middle, .rollup = &rollups.middle},
+    {.data_pin = 22, .power_pin = 6, .data = &most_recent.bottom, .rollup = &rollups.bottom}
   };
 
-  for (const auto [data_pin, power_pin, data] : sensors) {
-    monitor_dht22(ctx, driver, pio0, data_pin, power_pin, data).detach();
+  for (const auto [data_pin, power_pin, data, rollup] : sensors) {
+    monitor_dht22(ctx, driver, pio0, data_pin, power_pin, data, rollup).detach();
   }
+  record_history(ctx).detach();
 
   co_await monitor_sht30s(ctx);
 }
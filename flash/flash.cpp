@@ -1,11 +1,18 @@
 #include <algorithm>
+#include <cinttypes>
 #include <cstdint>
+#include <functional>
 
-// #include <hardware/flash.h>
+#include <common/flash_log.h>
+#include <hardware/flash.h>
 #include <hardware/regs/addressmap.h>
 #include <pico/stdlib.h>
 #include <tusb.h>
 
+// where the coroutines project keeps its measurement log: the last megabyte
+constexpr std::uint32_t log_bytes = 1024 * 1024;
+constexpr std::uint32_t log_offset = PICO_FLASH_SIZE_BYTES - log_bytes;
+
 const std::uint32_t sequence[] = {
   1,
   1,
@@ -56,4 +63,45 @@ int main() {
   auto main_addr = reinterpret_cast<const char*>(&main);
   auto flash_addr = reinterpret_cast<const char *>(flash_begin);
   printf("For comparison, &main is %d bytes from the beginning of flash.\n", main_addr - flash_addr);
+
+  // Searching is no way to find stored data, though. The measurement log's
+  // sector headers are an index: find the record from halfway through the
+  // log by time, both by the index and by searching for its header.
+  common::FlashLog log(log_offset, log_bytes);
+  log.mount();
+  common::FlashLog::Record oldest;
+  if (!log.cursor().next(oldest)) {
+    printf("The measurement log is empty.\n");
+    return 0;
+  }
+  const std::uint32_t time = oldest.time + (log.last_time() - oldest.time) / 2;
+
+  std::uint64_t before = time_us_64();
+  common::FlashLog::Record record;
+  const bool found_record = log.seek_time(time).next(record);
+  const std::uint64_t index_us = time_us_64() - before;
+  if (!found_record) {
+    printf("No record at or after time %" PRIu32 ".\n", time);
+    return 0;
+  }
+  printf("Record %" PRIu32 " has time %" PRIu32 ". The index found it in %" PRIu64 " microseconds.\n",
+         record.number, record.time, index_us);
+
+  // the record's time and length, as in its header
+  const std::uint8_t header[] = {
+    std::uint8_t(record.time),
+    std::uint8_t(record.time >> 8),
+    std::uint8_t(record.time >> 16),
+    std::uint8_t(record.time >> 24),
+    std::uint8_t(record.payload.size()),
+    std::uint8_t(record.payload.size() >> 8)
+  };
+  const auto log_begin = reinterpret_cast<const std::uint8_t*>(XIP_BASE + log_offset);
+  const auto log_end = log_begin + log_bytes;
+  before = time_us_64();
+  auto header_searcher = std::boyer_moore_horspool_searcher(std::begin(header), std::end(header));
+  const auto match = std::search(log_begin, log_end, header_searcher);
+  const std::uint64_t search_us = time_us_64() - before;
+  printf("Searching the log for its header %s in %" PRIu64 " microseconds.\n",
+         match == log_end ? "failed" : "succeeded", search_us);
 }
@@ -9,6 +9,7 @@
 #include <chrono>
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
 
 #include <hardware/watchdog.h>
 
@@ -19,6 +20,13 @@
 #include <picoro/sleep.h>
 #include <picoro/tcp.h>
 
+#include <common/admission.h>
+#include <common/format.h>
+#include <common/http.h>
+#include <common/idle_timeout.h>
+#include <common/render_cache.h>
+#include <common/routes.h>
+
 #include "secrets.h"
 
 const char *cyw43_describe(int status) {
@@ -57,8 +65,51 @@ struct Measurement {
     int32_t relative_humidity_millipercent = 0;
 } latest;
 
-// TODO: Need to recalculate this. For now I fudge it up to 511.
-constexpr std::size_t max_response_length = 511;
+// `MEASUREMENT_JSON_FORMAT` is how a `Measurement` is formatted, and
+// `MEASUREMENT_JSON_FIELDS` describes the format's conversions. The
+// temperature and humidity are formatted from integers, without floating point.
+#define MEASUREMENT_JSON_FORMAT \
+    "{\"sequence_number\": %u," \
+    " \"CO2_ppm\": %hu," \
+    " \"temperature_celsius\": %.1f," \
+    " \"relative_humidity_percent\": %.1f," \
+    " \"free_bytes\": %lu}"
+#define MEASUREMENT_JSON_FIELDS \
+    common::Decimal<unsigned>, \
+    common::Decimal<uint16_t>, \
+    common::Fixed<int32_t, 1000, 1>, \
+    common::Fixed<int32_t, 1000, 1>, \
+    common::Decimal<uint32_t>
+
+constexpr char chunked_response_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/x-ndjson\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n";
+
+constexpr char chunk_body_format[] =
+    MEASUREMENT_JSON_FORMAT
+    "\n";
+
+using ChunkBody = common::Format<chunk_body_format, MEASUREMENT_JSON_FIELDS>;
+
+constexpr char chunk_prefix_format[] = "%X\r\n";
+
+using ChunkPrefix = common::Format<chunk_prefix_format,
+    common::Hex<int, int(ChunkBody::max_length)>>;
+
+constexpr char chunk_suffix[] = "\r\n";
+
+constexpr std::size_t max_chunk_length =
+    ChunkPrefix::max_length + ChunkBody::max_length + sizeof chunk_suffix - 1;
+
+#undef MEASUREMENT_JSON_FIELDS
+#undef MEASUREMENT_JSON_FORMAT
+
+// Chunks used to go into a 512-byte buffer that I sized by guessing.
+static_assert(max_chunk_length < 512);
 
 uint32_t get_total_heap() {
    extern char __StackLimit, __bss_end__;
@@ -70,105 +121,26 @@ uint32_t get_free_heap() {
    return get_total_heap() - m.uordblks;
 }
 
-int format_response(
-    // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer,
-    const Measurement& data) {
-
-    // If we haven't made a measurement yet, respond with an error telling the
-    // client to try again in a few seconds.
-    if (data.sequence_number == 0) {
-        constexpr char response[] =
-            "HTTP/1.1 503 Service Unavailable\r\n"
-            "Connection: close\r\n"
-            "Retry-After: 5\r\n"
-            "\r\n";
-        return std::snprintf(buffer.data(), buffer.size(), "%s", response);
-    }
-
-    constexpr char response_format[] =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: close\r\n"
-        "Content-Type: application/json\r\n"
-        "\r\n"
-        "{\"sequence_number\": %u,"
-        " \"CO2_ppm\": %hu,"
-        " \"temperature_celsius\": %.1f,"
-        " \"relative_humidity_percent\": %.1f,"
-        " \"free_bytes\": %lu}";
-
-    const uint32_t free_bytes = get_free_heap();
-
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
-}
-
-int format_chunked_response_header(
-    // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer) {
-    constexpr char response_format[] =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: keep-alive\r\n"
-        "Content-Type: application/x-ndjson\r\n"
-        "Transfer-Encoding: chunked\r\n"
-        "Cache-Control: no-cache\r\n"
-        "\r\n";
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format);
-}
-
 int format_response_chunk(
     // +1 for the null terminator
-    std::array<char, max_response_length + 1>& buffer,
+    std::array<char, max_chunk_length + 1>& buffer,
     const Measurement& data) {
-    #define LENGTH_PREFIX_FORMAT \
-        "%X\r\n"
-    #define CHUNK_FORMAT \
-        "{\"sequence_number\": %u," \
-        " \"CO2_ppm\": %hu," \
-        " \"temperature_celsius\": %.1f," \
-        " \"relative_humidity_percent\": %.1f," \
-        " \"free_bytes\": %lu}" \
-        "\n"
-    constexpr char response_format[] =
-        LENGTH_PREFIX_FORMAT \
-        CHUNK_FORMAT \
-        "\r\n";
-
-    const uint32_t free_bytes = get_free_heap();
-
-    const int chunk_size = std::snprintf(
-        nullptr,
-        0,
-        CHUNK_FORMAT,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
-
-    return std::snprintf(
-        buffer.data(),
-        buffer.size(),
-        response_format,
-        chunk_size,
+    // Format the body first, so that we know its length, and then insert the
+    // length prefix in front of it.
+    char *const chunk = buffer.data();
+    const int body_length = ChunkBody::write(
+        chunk,
         data.sequence_number,
         data.co2_ppm,
-        data.temperature_millicelsius / 1000.0f,
-        data.relative_humidity_millipercent / 1000.0f,
-        free_bytes);
+        data.temperature_millicelsius,
+        data.relative_humidity_millipercent,
+        get_free_heap());
 
-    #undef CHUNK_FORMAT
-    #undef LENGTH_PREFIX_FORMAT
+    const int prefix_length = common::insert_length_prefix<ChunkPrefix>(chunk, body_length);
+    // Copy the suffix's null terminator, too.
+    std::memcpy(chunk + prefix_length + body_length, chunk_suffix, sizeof chunk_suffix);
+
+    return prefix_length + body_length + sizeof chunk_suffix - 1;
 }
 
 // Wait for the host to attach to the USB terminal (i.e. ttyACM0).
@@ -192,6 +164,14 @@ picoro::Broadcaster<Measurement>& broadcaster() {
     return instance;
 }
 
+// Each measurement is formatted as a chunk at most once, no matter how many
+// clients are subscribed. The "free_bytes" field therefore reflects the heap at
+// the time the measurement was first formatted.
+common::RenderCache<max_chunk_length + 1>& chunk_cache() {
+    static common::RenderCache<max_chunk_length + 1> instance;
+    return instance;
+}
+
 picoro::Coroutine<void> monitor_scd4x(async_context_t *ctx) {
   for (;;) {
     ++latest.sequence_number;
@@ -268,28 +248,93 @@ picoro::Coroutine<void> wifi_connect(async_context_t *ctx, const char *SSID, con
     picoro::debug("Connected to WiFi.\n");
 }
 
-picoro::Coroutine<void> handle_client(picoro::Connection conn) {
-    picoro::debug("in handle_client(...), about to await recv()\n");
-    char readbuf[2048];
-    auto [count, err] = co_await conn.recv(readbuf, sizeof readbuf);
-    picoro::debug("in handle_client(...), received %d bytes with error %s\n", count, picoro::lwip_describe(err));
-    if (err) {
-      picoro::debug("in handle_client(...), since there was an error, I'm closing the connection and returning.\n");
-      co_return;
+// A client has limited time to send its request, and then to accept each
+// chunk of the response.
+constexpr common::RequestTimeouts request_timeouts = {
+    .idle = std::chrono::seconds(10),
+    .headers = std::chrono::seconds(5),
+    .body = std::chrono::seconds(5)};
+constexpr auto write_timeout = std::chrono::seconds(15);
+
+common::IdleTimeout& idle_timeout() {
+    static common::IdleTimeout instance;
+    return instance;
+}
+
+enum class Endpoint {
+    MEASUREMENTS
+};
+
+// GET /
+// GET /measurements
+//     Stream future measurements as JSON lines in a single chunked response.
+//
+// Any other path gets a 404 response, and then the connection is closed.
+constexpr auto routes = common::make_route_table<Endpoint>({
+    {"GET", "/", Endpoint::MEASUREMENTS},
+    {"GET", "/measurements", Endpoint::MEASUREMENTS}});
+
+// the same limits as the coroutines project's server
+common::AdmissionControl& admission() {
+    static common::AdmissionControl instance({
+        .max_connections = 8,
+        .max_refusing = 4,
+        .reserve_bytes = 16 * 1024,
+        .connection_bytes = 4 * 1024});
+    return instance;
+}
+
+picoro::Coroutine<void> handle_client(picoro::Connection conn, common::AdmissionControl::Ticket ticket) {
+    // `ticket` counts this connection as live until we return.
+    (void) ticket;
+    common::IdleTimeout::Watch watch(idle_timeout(), conn);
+    common::RequestReader<256> requests;
+    int count;
+    err_t err;
+    while (!requests.next()) {
+        picoro::debug("in handle_client(...), about to await recv()\n");
+        watch.expect_request(requests.parser(), request_timeouts);
+        std::tie(count, err) = co_await conn.recv(requests.free_space(), requests.free_size());
+        watch.cancel();
+        picoro::debug("in handle_client(...), received %d bytes with error %s\n", count, picoro::lwip_describe(err));
+        if (err) {
+          picoro::debug("in handle_client(...), since there was an error, I'm closing the connection and returning.\n");
+          co_return;
+        }
+        requests.received(count);
+    }
+    watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+    if (requests.status() != common::RequestParser::COMPLETE) {
+        co_await conn.send(common::error_response(requests.status()));
+        co_return;
+    }
+    const common::Request& request = requests.request();
+    switch (routes.find(request.method.view(), request.path.view()).status) {
+    case common::RouteStatus::FOUND:
+        break;
+    case common::RouteStatus::NOT_FOUND:
+        co_await conn.send(common::not_found_response);
+        co_return;
+    case common::RouteStatus::METHOD_NOT_ALLOWED:
+        co_await conn.send(common::get_only_response);
+        co_return;
     }
-    std::array<char, max_response_length + 1> buffer;
     picoro::debug("in handle_client(...), about to format response and await send()\n");
-    count = format_chunked_response_header(buffer);
-    std::tie(count, err) = co_await conn.send(std::string_view(buffer.data(), count));
+    std::tie(count, err) = co_await conn.send(chunked_response_header);
     if (err) {
         picoro::debug("Error sending headers: %s\n", picoro::lwip_describe(err));
         co_return;
     }
+    watch.cancel();
     for (;;) {
-        Measurement next = co_await broadcaster().next();
-        count = format_response_chunk(buffer, next);
+        const Measurement next = co_await broadcaster().next();
+        const auto chunk = chunk_cache().get(next.sequence_number, [&](auto& buffer) {
+            return format_response_chunk(buffer, next);
+        });
         picoro::debug("handle_client(...), about to send() a chunk.\n");
-        std::tie(count, err) = co_await conn.send(std::string_view(buffer.data(), count));
+        watch.expire_in(write_timeout, common::IdleTimeout::WRITE);
+        std::tie(count, err) = co_await conn.send(chunk->text());
+        watch.cancel();
         picoro::debug("handle_client(...), finished send(). Sent %d bytes with error %s.\n", count, picoro::lwip_describe(err));
         if (err) {
             picoro::debug("handle_client(...), send() had an error, so finishing handle_client\n");
@@ -315,7 +360,19 @@ picoro::Coroutine<void> http_server(int port, int listen_backlog) {
             continue;
         }
         picoro::debug("http_server: accept()ed a connection\n");
-        handle_client(std::move(conn)).detach();
+        switch (admission().decide(get_free_heap())) {
+        case common::AdmissionControl::ADMIT:
+            handle_client(std::move(conn), admission().admit()).detach();
+            break;
+        case common::AdmissionControl::REFUSE:
+            picoro::debug("http_server: Too busy. Refusing a connection.\n");
+            common::refuse(std::move(conn), admission().refuse()).detach();
+            break;
+        case common::AdmissionControl::DROP:
+            picoro::debug("http_server: Much too busy. Dropping a connection.\n");
+            admission().drop();
+            break;
+        }
     }
 }
 
@@ -323,6 +380,7 @@ picoro::Coroutine<void> networking(async_context_t *ctx) {
     co_await wifi_connect(ctx, "Annoying Saxophone", wifi_password);
     const int port = 80;
     const int listen_backlog = 4;
+    idle_timeout().run(ctx, std::chrono::seconds(1)).detach();
     co_await http_server(port, listen_backlog);
 }
 
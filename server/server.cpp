@@ -4,6 +4,7 @@
 
 #include <tusb.h>
 
+#include "hardware/i2c.h"
 #include "pico/async_context_poll.h"
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
@@ -11,6 +12,12 @@
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
 
+#include "scd4x_i2c.h"
+
+#include <common/admission.h>
+#include <common/format.h>
+#include <common/slot_pool.h>
+
 #include "secrets.h"
 
 #include <array>
@@ -49,48 +56,175 @@ struct Measurement {
     int32_t relative_humidity_millipercent = 0;
 } latest;
 
-template <std::size_t buffer_size>
-int format_response(
-    std::array<char, buffer_size>& buffer,
-    const Measurement& data) {
-
-    // 225 bytes is the largest the response could ever be. I counted.
-    static_assert(buffer_size >= 225 + 1);
-
-    constexpr char response_format[] =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: close\r\n"
-        "Content-Type: application/json\r\n"
-        "\r\n"
-        "{\"sequence_number\": %u,"
-        " \"CO2_ppm\": %hu,"
-        " \"temperature_celsius\": %ld.%03ld,"
-        " \"relative_humidity_percent\": %ld.%03ld}";
-
-    return std::snprintf(
-        buffer.data(),
-        buffer_size,
-        response_format,
-        data.sequence_number,
-        data.co2_ppm,
-        data.temperature_millicelsius / 1000,
-        std::abs(data.temperature_millicelsius) % 1000,
-        data.relative_humidity_millipercent / 1000,
-        std::abs(data.relative_humidity_millipercent) / 1000);
+// The response is rendered ahead of time into a "response image", and every
+// client is sent the same image, with no per-client formatting or buffer.
+// Each value has a fixed-width slot (JSON allows the spaces that pad it), so
+// the Content-Length never changes, and when `latest` changes only the slots
+// are overwritten (see `publish`).
+constexpr char response_body_format[] =
+    "{\"sequence_number\": %10u,"
+    " \"CO2_ppm\": %5hu,"
+    " \"temperature_celsius\": %12.3f,"
+    " \"relative_humidity_percent\": %12.3f}";
+
+// The temperature and humidity are formatted from integers, without floating
+// point.
+using ResponseBody = common::Format<response_body_format,
+    common::Decimal<unsigned>,
+    common::Decimal<uint16_t>,
+    common::Fixed<int32_t, 1000, 3>,
+    common::Fixed<int32_t, 1000, 3>>;
+
+static_assert(ResponseBody::is_fixed_width);
+
+constexpr char response_header_format[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Connection: close\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: %d\r\n"
+    "\r\n";
+
+using ResponseHeader = common::Format<response_header_format,
+    common::Decimal<int, int(ResponseBody::max_length), int(ResponseBody::max_length)>>;
+
+constexpr std::size_t response_length = ResponseHeader::max_length + ResponseBody::max_length;
+
+struct ResponseImage {
+    // +1 for the null terminator
+    std::array<char, response_length + 1> text;
+    // the number of clients whose responses lwIP may still be sending from
+    // `text`, which therefore must not change
+    int senders = 0;
+
+    char *body() { return text.data() + ResponseHeader::max_length; }
+};
+
+// There are two images, so that one can be patched while clients are still
+// being sent the other. `current_image` is the one sent to new clients.
+std::array<ResponseImage, 2> response_images;
+ResponseImage *current_image = &response_images[0];
+// whether `latest` has changed since `current_image` was patched
+bool image_out_of_date = false;
+
+void render_response_images() {
+    for (ResponseImage& image : response_images) {
+        ResponseHeader::write(image.text, int(ResponseBody::max_length));
+        ResponseBody::write(image.body(),
+            latest.sequence_number,
+            latest.co2_ppm,
+            latest.temperature_millicelsius,
+            latest.relative_humidity_millipercent);
+    }
+}
+
+// Bring the image sent to new clients up to date with `latest`, unless the
+// other image is still being sent, in which case try again when it isn't
+// (see `Client::~Client`).
+void update_response_image() {
+    ResponseImage& next = &response_images[0] == current_image ? response_images[1] : response_images[0];
+    if (next.senders) {
+        image_out_of_date = true;
+        return;
+    }
+    char *const body = next.body();
+    ResponseBody::patch<0>(body, latest.sequence_number);
+    ResponseBody::patch<1>(body, latest.co2_ppm);
+    ResponseBody::patch<2>(body, latest.temperature_millicelsius);
+    ResponseBody::patch<3>(body, latest.relative_humidity_millipercent);
+    current_image = &next;
+    image_out_of_date = false;
+}
+
+// Make the specified `measurement` the latest, numbering it after the previous
+// one.
+void publish(Measurement measurement) {
+    measurement.sequence_number = latest.sequence_number + 1;
+    latest = measurement;
+    update_response_image();
+}
+
+// The SCD4x is wired as in the co2 project, and is read with the same driver.
+// It measures every five seconds. `poll_scd4x` asks it every second whether it
+// has a new measurement, and publishes the measurement if so. The I2C
+// transactions take a few milliseconds, in which the event loop waits.
+const uint scd4x_sda_pin = 12;
+const uint scd4x_scl_pin = 13;
+const uint scd4x_clock_hz = 400 * 1000;
+const uint32_t scd4x_poll_ms = 1000;
+
+void poll_scd4x(async_context_t *context, async_at_time_worker_t *worker) {
+    bool ready = false;
+    int status = scd4x_get_data_ready_flag(&ready);
+    if (status) {
+        debug("scd4x_get_data_ready_flag error: %d\n", status);
+    } else if (ready) {
+        uint16_t co2_ppm, temperature_ticks, humidity_ticks;
+        status = scd4x_read_measurement_ticks(&co2_ppm, &temperature_ticks, &humidity_ticks);
+        if (status) {
+            debug("scd4x_read_measurement_ticks error: %d\n", status);
+        } else {
+            // the conversions in the SCD4x's datasheet, in integers
+            publish({
+                .co2_ppm = co2_ppm,
+                .temperature_millicelsius = ((21875 * int32_t(temperature_ticks)) >> 13) - 45000,
+                .relative_humidity_millipercent = (12500 * int32_t(humidity_ticks)) >> 13});
+        }
+    }
+    async_context_add_at_time_worker_in_ms(context, worker, scd4x_poll_ms);
+}
+
+async_at_time_worker_t scd4x_worker = {};
+
+void start_scd4x(async_context_t *context) {
+    i2c_init(i2c_default, scd4x_clock_hz);
+    gpio_set_function(scd4x_sda_pin, GPIO_FUNC_I2C);
+    gpio_set_function(scd4x_scl_pin, GPIO_FUNC_I2C);
+    gpio_pull_up(scd4x_sda_pin);
+    gpio_pull_up(scd4x_scl_pin);
+
+    const int status = scd4x_start_periodic_measurement();
+    if (status) {
+        debug("scd4x_start_periodic_measurement error: %d\n", status);
+    }
+    scd4x_worker.do_work = poll_scd4x;
+    async_context_add_at_time_worker_in_ms(context, &scd4x_worker, scd4x_poll_ms);
 }
 
 struct Client {
-    std::array<char, 256> response_buffer;
-    int response_length = 0;
+    // the image that this client's response is sent from
+    ResponseImage& image;
     int response_bytes_acked = 0;
+
+    explicit Client(ResponseImage& image)
+    : image(image) {
+        ++image.senders;
+    }
+
+    Client(const Client&) = delete;
+
+    ~Client() {
+        if (--image.senders == 0 && image_out_of_date) {
+            update_response_image();
+        }
+    }
 };
 
+// Each connection's `Client` lives in a slot of a fixed pool, rather than on
+// the heap. lwIP can't have more than `MEMP_NUM_TCP_PCB` connections anyway.
+constexpr std::size_t max_clients = MEMP_NUM_TCP_PCB;
+
+common::SlotPool<Client, max_clients>& clients() {
+    static common::SlotPool<Client, max_clients> instance;
+    return instance;
+}
+
 err_t send_response(Client& client, tcp_pcb *client_pcb) {
-    client.response_length = format_response(client.response_buffer, latest);
-    debug("Sending response of length %d\n", client.response_length);
+    debug("Sending response of length %d\n", int(response_length));
 
+    // The image isn't copied: lwIP refers to it until the client acknowledges
+    // it, and `Client` keeps it from being patched until then.
     const u8_t flags = 0;
-    err_t err = tcp_write(client_pcb, client.response_buffer.data(), client.response_length, flags);
+    err_t err = tcp_write(client_pcb, client.image.text.data(), response_length, flags);
     if (err) {
         debug("tcp_write error: %s\n", describe(err));
         return err;
@@ -110,7 +244,7 @@ err_t cleanup_connection(Client *client, tcp_pcb *client_pcb) {
     tcp_recv(client_pcb, NULL);
     tcp_err(client_pcb, NULL);
 
-    delete client;
+    clients().release(client);
 
     err_t err = tcp_close(client_pcb);
     if (err) {
@@ -122,8 +256,8 @@ err_t cleanup_connection(Client *client, tcp_pcb *client_pcb) {
 err_t on_sent(void *arg, tcp_pcb *client_pcb, u16_t len) {
     auto *client = static_cast<Client*>(arg);
     client->response_bytes_acked += len;
-    debug("client ACK'd %d/%d bytes of the sent response\n", client->response_bytes_acked, client->response_length);
-    if (client->response_bytes_acked == client->response_length) {
+    debug("client ACK'd %d/%d bytes of the sent response\n", client->response_bytes_acked, int(response_length));
+    if (client->response_bytes_acked == int(response_length)) {
         debug("Client has received the entire response. Closing connection.\n");
         return cleanup_connection(client, client_pcb);
     }
@@ -155,7 +289,10 @@ err_t on_recv(void *arg, tcp_pcb *client_pcb, pbuf *buf, err_t err) {
 
 void on_err(void *arg, err_t err) {
     debug("connection fatal error: %s\n", describe(err));
-    delete static_cast<Client*>(arg);
+    // lwIP has already freed the pcb.
+    if (arg) {
+        clients().release(static_cast<Client*>(arg));
+    }
 }
 
 err_t on_accept(void *arg, tcp_pcb *client_pcb, err_t err) {
@@ -165,7 +302,22 @@ err_t on_accept(void *arg, tcp_pcb *client_pcb, err_t err) {
     }
     debug("client connected\n");
 
-    auto *client = new Client;
+    auto *client = clients().acquire(*current_image);
+    if (!client) {
+        debug("No free client slots (exhausted %u times). Refusing the connection.\n", clients().exhausted());
+        // The refusal is a constant, so it needs no client state. lwIP sends
+        // it before finishing the close.
+        tcp_write(client_pcb, common::overloaded_response.data(), common::overloaded_response.size(), 0);
+        const err_t err = tcp_close(client_pcb);
+        if (err) {
+            debug("tcp_close error: %s\n", describe(err));
+            tcp_abort(client_pcb);
+            return ERR_ABRT;
+        }
+        return ERR_OK;
+    }
+    debug("%u/%u client slots in use (at most %u so far)\n",
+        unsigned(clients().size()), unsigned(max_clients), unsigned(clients().high_water_mark()));
     tcp_arg(client_pcb, client);
     tcp_sent(client_pcb, on_sent);
     tcp_recv(client_pcb, on_recv);
@@ -235,6 +387,8 @@ int main() {
 
     debug("Connected to WiFi.\n");
 
+    render_response_images();
+    start_scd4x(&context.core);
     setup_http_server(80);
 
     debug("Entering event loop.\n");